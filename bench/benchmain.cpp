@@ -0,0 +1,26 @@
+#include "benchutil.h"
+
+#include <string.h>
+
+using namespace rlisp::bench;
+
+// usage: rlisp-bench [substring...]
+// runs every registered benchmark whose name contains one of the arguments, or all of them without arguments
+int main(int argc, char** argv)
+{
+    for (auto&& bench : registry())
+    {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i)
+            selected = selected || strstr(bench.name, argv[i]) != nullptr;
+        if (!selected) continue;
+
+        State state;
+        bench.func(state);
+        printf("%-40s %12.1f ns/op", bench.name, state.ns_per_op());
+        if (state.observed())
+            printf(" %10.1f allocs/op %10.6f gcs/op", state.allocations_per_op(), state.collections_per_op());
+        printf("\n");
+    }
+    return 0;
+}
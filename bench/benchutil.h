@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <chrono>
+#include <vector>
+
+#include "mempool.h"
+
+namespace rlisp::bench
+{
+    struct State
+    {
+        // run the benchmark body until enough time has passed to give a stable per-iteration figure
+        bool keep_running()
+        {
+            if (!m_started)
+            {
+                // leave the benchmark's setup out of the first batch
+                m_started = true;
+                m_start = std::chrono::steady_clock::now();
+            }
+            if (m_remaining > 0)
+            {
+                --m_remaining;
+                return true;
+            }
+            auto elapsed = std::chrono::steady_clock::now() - m_start;
+            m_total += elapsed;
+            m_iterations += m_batch;
+            if (m_total < std::chrono::milliseconds(200))
+            {
+                m_batch *= 2;
+                m_remaining = m_batch - 1;
+                m_start = std::chrono::steady_clock::now();
+                return true;
+            }
+            if (m_pool)
+            {
+                // the pool usually dies with the benchmark body, so take the totals now
+                m_allocations = m_pool->num_allocations() - m_allocations;
+                m_collections = collections(*m_pool) - m_collections;
+                m_pool = nullptr;
+                m_observed = true;
+            }
+            return false;
+        }
+
+        double ns_per_op() const
+        {
+            return std::chrono::duration<double, std::nano>(m_total).count() / static_cast<double>(m_iterations);
+        }
+
+        // Reports the allocations and collections made in pool per op. Call it just before the loop: everything the
+        // pool does from then until keep_running() returns false is divided between the iterations.
+        void observe(const MemPool& pool)
+        {
+            m_pool = &pool;
+            m_allocations = pool.num_allocations();
+            m_collections = collections(pool);
+        }
+
+        bool observed() const { return m_observed; }
+        double allocations_per_op() const { return per_op(m_allocations); }
+        double collections_per_op() const { return per_op(m_collections); }
+
+    private:
+        static size_t collections(const MemPool& pool)
+        {
+            return pool.num_minor_collections() + pool.num_major_collections();
+        }
+        double per_op(size_t n) const { return static_cast<double>(n) / static_cast<double>(m_iterations); }
+
+        bool m_started = false;
+        size_t m_batch = 1;
+        size_t m_remaining = 1;
+        size_t m_iterations = 0;
+        std::chrono::steady_clock::duration m_total{};
+        std::chrono::steady_clock::time_point m_start;
+        const MemPool* m_pool = nullptr;
+        bool m_observed = false;
+        // the counts when observe() was called, then the differences once the benchmark has finished
+        size_t m_allocations = 0;
+        size_t m_collections = 0;
+    };
+
+    using BenchFunc = void (*)(State&);
+
+    struct Registration
+    {
+        const char* name;
+        BenchFunc func;
+    };
+
+    inline std::vector<Registration>& registry()
+    {
+        static std::vector<Registration> benches;
+        return benches;
+    }
+
+    struct Registrar
+    {
+        Registrar(const char* name, BenchFunc func) { registry().push_back({name, func}); }
+    };
+
+    // keeps the optimizer from discarding a computed value
+    template<class T>
+    void do_not_optimize(const T& value)
+    {
+#if defined(_MSC_VER)
+        static const void* volatile sink;
+        sink = &value;
+#else
+        asm volatile("" : : "r,m"(value) : "memory");
+#endif
+    }
+}
+
+#define RLISP_BENCH(NAME)                                                                                              \
+    static void NAME(rlisp::bench::State&);                                                                            \
+    static rlisp::bench::Registrar NAME##_registrar(#NAME, &NAME);                                                     \
+    static void NAME(rlisp::bench::State& state)
@@ -0,0 +1,215 @@
+#include "benchutil.h"
+#include "cons.h"
+#include "eval.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "mempool.h"
+#include "parser.h"
+#include "profiler.h"
+
+#include <string>
+
+using namespace rlisp;
+
+static void bench_eval(bench::State& state,
+                       const char* src,
+                       Engine engine = Engine::TreeWalker,
+                       Profiler* profiler = nullptr,
+                       Jit* jit = nullptr)
+{
+    Interpreter interp(MemPoolConfig{.initial_cells = 4096});
+    interp.pool().set_profiler(profiler);
+    interp.pool().set_jit(jit);
+    auto e = parse(src, interp.pool());
+    interp.pool().push_root(e);
+    state.observe(interp.pool());
+    while (state.keep_running())
+        bench::do_not_optimize(interp.eval(e, engine));
+    interp.pool().pop_root();
+}
+
+static const char closure_call[] = "((lambda (x y) (cond ((eq x y) t) (t nil))) 'a 'a)";
+
+static const char reverse_list[] = R"(
+(let
+ ((rev (lambda
+        (rev xs acc)
+        (cond
+         (xs (rev rev (cdr xs) (cons (car xs) acc)))
+         (t acc)))))
+ (rev rev '(1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30 31 32) nil))
+)";
+
+static const char sum_to_1000[] = R"(
+(let
+ ((sum (lambda
+        (sum n acc)
+        (cond
+         ((= n 0) acc)
+         (t (sum sum (- n 1) (+ acc n)))))))
+ (sum sum 1000 0))
+)";
+
+// non-tail recursion: every call allocates a frame that dies soon after
+static const char fib_15[] = R"(
+(let
+ ((fib (lambda
+        (fib n)
+        (cond
+         ((< n 2) n)
+         (t (+ (fib fib (- n 1)) (fib fib (- n 2))))))))
+ (fib fib 15))
+)";
+
+// the same, through a global name, which each call site finds in its call cache
+static const char global_fib[] =
+    "(define fib (lambda (n) (cond ((< n 2) n) (t (+ (fib (- n 1)) (fib (- n 2)))))))";
+
+static void bench_global_fib(bench::State& state, Engine engine, Jit* jit = nullptr)
+{
+    Interpreter interp(MemPoolConfig{.initial_cells = 4096});
+    interp.pool().set_jit(jit);
+    interp.eval(parse(global_fib, interp.pool()));
+    auto e = parse("(fib 15)", interp.pool());
+    interp.pool().push_root(e);
+    state.observe(interp.pool());
+    while (state.keep_running())
+        bench::do_not_optimize(interp.eval(e, engine));
+    interp.pool().pop_root();
+}
+
+// (let ((x0 0)) (let ((x1 (+ x0 1))) ... (+ x0 x99)))
+static std::string nested_lets(int depth)
+{
+    std::string src;
+    for (int i = 0; i < depth; ++i)
+    {
+        src += "(let ((x" + std::to_string(i) + " ";
+        src += i == 0 ? std::string("0") : "(+ x" + std::to_string(i - 1) + " 1)";
+        src += ")) ";
+    }
+    src += "(+ x0 x" + std::to_string(depth - 1) + ")";
+    src += std::string(depth, ')');
+    return src;
+}
+static const std::string nested_lets_100 = nested_lets(100);
+
+// sums the 64 elements of a literal by index, from the last to the first: a walk down a list for each one, against
+// constant time vector-ref
+static std::string sum_by_index(bool vector)
+{
+    std::string elements;
+    for (int i = 0; i < 64; ++i)
+        elements += std::to_string(i) + ' ';
+    std::string src = "(let ((nth (lambda (nth n l) (cond ((= n 0) (car l)) (t (nth nth (- n 1) (cdr l))))))) ";
+    src += "(let ((sum (lambda (sum xs i acc) (cond ((= i 0) acc) ";
+    src += vector ? "(t (sum sum xs (- i 1) (+ acc (vector-ref xs (- i 1))))))))) (sum sum #("
+                  : "(t (sum sum xs (- i 1) (+ acc (nth nth (- i 1) xs)))))))) (sum sum '(";
+    src += elements + ") 64 0)))";
+    return src;
+}
+static const std::string list_sum_64 = sum_by_index(false);
+static const std::string vector_sum_64 = sum_by_index(true);
+
+RLISP_BENCH(eval_t) { bench_eval(state, "t"); }
+
+// builds the global scope for every evaluation
+RLISP_BENCH(eval_oneshot_t)
+{
+    MemPool pool(4096);
+    auto e = parse("t", pool);
+    pool.push_root(e);
+    while (state.keep_running())
+        bench::do_not_optimize(eval(e, pool));
+    pool.pop_root();
+}
+
+RLISP_BENCH(eval_eq) { bench_eval(state, "(eq 'a 'a)"); }
+
+RLISP_BENCH(eval_lambda) { bench_eval(state, "(lambda (x) x)"); }
+
+RLISP_BENCH(eval_closure_call) { bench_eval(state, closure_call); }
+
+RLISP_BENCH(eval_reverse_list) { bench_eval(state, reverse_list); }
+
+RLISP_BENCH(eval_sum_to_1000) { bench_eval(state, sum_to_1000); }
+
+RLISP_BENCH(eval_fib_15) { bench_eval(state, fib_15); }
+
+RLISP_BENCH(eval_global_fib_15) { bench_global_fib(state, Engine::TreeWalker); }
+
+RLISP_BENCH(eval_nested_lets_100) { bench_eval(state, nested_lets_100.c_str()); }
+
+RLISP_BENCH(eval_list_sum_64) { bench_eval(state, list_sum_64.c_str()); }
+
+RLISP_BENCH(eval_vector_sum_64) { bench_eval(state, vector_sum_64.c_str()); }
+
+// the cost of profiling, against eval_fib_15 and bytecode_fib_15
+RLISP_BENCH(eval_fib_15_profiled)
+{
+    Profiler profiler;
+    bench_eval(state, fib_15, Engine::TreeWalker, &profiler);
+}
+
+RLISP_BENCH(eval_defined_global)
+{
+    Interpreter interp(MemPoolConfig{.initial_cells = 4096});
+    const char* names[] = {"a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o", "p"};
+    for (auto name : names)
+    {
+        auto src = std::string("(define ") + name + " '" + name + ")";
+        interp.eval(parse(src.c_str(), interp.pool()));
+    }
+    auto e = parse("(cons a p)", interp.pool());
+    interp.pool().push_root(e);
+    while (state.keep_running())
+        bench::do_not_optimize(interp.eval(e));
+    interp.pool().pop_root();
+}
+
+RLISP_BENCH(bytecode_eq) { bench_eval(state, "(eq 'a 'a)", Engine::Bytecode); }
+
+RLISP_BENCH(bytecode_closure_call) { bench_eval(state, closure_call, Engine::Bytecode); }
+
+RLISP_BENCH(bytecode_reverse_list) { bench_eval(state, reverse_list, Engine::Bytecode); }
+
+RLISP_BENCH(bytecode_sum_to_1000) { bench_eval(state, sum_to_1000, Engine::Bytecode); }
+
+RLISP_BENCH(bytecode_fib_15) { bench_eval(state, fib_15, Engine::Bytecode); }
+
+RLISP_BENCH(bytecode_global_fib_15) { bench_global_fib(state, Engine::Bytecode); }
+
+RLISP_BENCH(bytecode_fib_15_profiled)
+{
+    Profiler profiler;
+    bench_eval(state, fib_15, Engine::Bytecode, &profiler);
+}
+
+RLISP_BENCH(bytecode_nested_lets_100) { bench_eval(state, nested_lets_100.c_str(), Engine::Bytecode); }
+
+RLISP_BENCH(bytecode_list_sum_64) { bench_eval(state, list_sum_64.c_str(), Engine::Bytecode); }
+
+RLISP_BENCH(bytecode_vector_sum_64) { bench_eval(state, vector_sum_64.c_str(), Engine::Bytecode); }
+
+// the bytecode engine with hot closures compiled to machine code, against the bytecode_ figures
+static void bench_native(bench::State& state, const char* src)
+{
+    Jit jit;
+    bench_eval(state, src, Engine::Bytecode, nullptr, &jit);
+}
+
+RLISP_BENCH(native_reverse_list) { bench_native(state, reverse_list); }
+
+RLISP_BENCH(native_sum_to_1000) { bench_native(state, sum_to_1000); }
+
+RLISP_BENCH(native_fib_15) { bench_native(state, fib_15); }
+
+RLISP_BENCH(native_list_sum_64) { bench_native(state, list_sum_64.c_str()); }
+
+RLISP_BENCH(native_vector_sum_64) { bench_native(state, vector_sum_64.c_str()); }
+
+RLISP_BENCH(native_global_fib_15)
+{
+    Jit jit;
+    bench_global_fib(state, Engine::Bytecode, &jit);
+}
@@ -0,0 +1,39 @@
+#include "benchutil.h"
+#include "cons.h"
+#include "executor.h"
+#include "mempool.h"
+#include "parser.h"
+#include "symtab.h"
+
+#include <string>
+
+using namespace rlisp;
+
+static const char sum_to_1000[] = R"(
+(let
+ ((sum (lambda
+        (sum n acc)
+        (cond
+         ((= n 0) acc)
+         (t (sum sum (- n 1) (+ acc n)))))))
+ (sum sum 1000 0))
+)";
+
+// one op evaluates 64 independent jobs, so ns/op falls as threads are added for as long as there are cores to run them
+static void bench_executor(bench::State& state, size_t threads)
+{
+    SymbolTable atoms;
+    MemPool pool(MemPoolConfig{.initial_cells = 4096}, atoms);
+    Executor executor(atoms, threads, MemPoolConfig{.initial_cells = 4096});
+    auto e = parse(sum_to_1000, pool);
+    pool.push_root(e);
+    std::vector<Cons*> exprs(64, e);
+    while (state.keep_running())
+        bench::do_not_optimize(executor.eval_all(exprs, pool));
+    pool.pop_root();
+}
+
+RLISP_BENCH(executor_64_jobs_1_thread) { bench_executor(state, 1); }
+RLISP_BENCH(executor_64_jobs_2_threads) { bench_executor(state, 2); }
+RLISP_BENCH(executor_64_jobs_4_threads) { bench_executor(state, 4); }
+RLISP_BENCH(executor_64_jobs_8_threads) { bench_executor(state, 8); }
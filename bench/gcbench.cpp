@@ -0,0 +1,72 @@
+#include "benchutil.h"
+#include "cons.h"
+#include "interpreter.h"
+#include "mempool.h"
+#include "parser.h"
+
+using namespace rlisp;
+
+// builds a list of 1000 fixnums and reverses it: about 2000 live cells at the peak, plus frames
+static const char build_and_reverse[] = R"(
+(let
+ ((build (lambda
+          (build n acc)
+          (cond
+           ((= n 0) acc)
+           (t (build build (- n 1) (cons n acc))))))
+  (rev (lambda
+        (rev xs acc)
+        (cond
+         (xs (rev rev (cdr xs) (cons (car xs) acc)))
+         (t acc)))))
+ (rev rev (build build 1000 nil) nil))
+)";
+
+// a pool that cannot grow, so smaller pools collect more often
+static void bench_fixed_pool(bench::State& state, size_t cells, bool generational = true)
+{
+    MemPoolConfig config;
+    config.initial_cells = cells;
+    config.max_cells = cells;
+    config.generational = generational;
+    Interpreter interp(config);
+    auto e = parse(build_and_reverse, interp.pool());
+    interp.pool().push_root(e);
+    state.observe(interp.pool());
+    while (state.keep_running())
+        bench::do_not_optimize(interp.eval(e));
+    interp.pool().pop_root();
+}
+
+RLISP_BENCH(gc_build_reverse_16k_cells) { bench_fixed_pool(state, 16384); }
+RLISP_BENCH(gc_build_reverse_64k_cells) { bench_fixed_pool(state, 65536); }
+RLISP_BENCH(gc_build_reverse_256k_cells) { bench_fixed_pool(state, 262144); }
+RLISP_BENCH(gc_build_reverse_16k_cells_nongenerational) { bench_fixed_pool(state, 16384, false); }
+
+// Allocates garbage while a list of `live` cells stays reachable, so each collection marks the live list (every
+// time without generations, only once with them).
+static void bench_alloc_churn(bench::State& state, size_t live, bool generational = true, size_t incremental_step = 0)
+{
+    MemPoolConfig config;
+    config.initial_cells = 65536;
+    config.generational = generational;
+    config.incremental_step = incremental_step;
+    MemPool pool(config);
+    auto list = pool.nil();
+    pool.push_root(list);
+    for (size_t i = 0; i < live; ++i)
+    {
+        list = pool.alloc(pool.nil(), list);
+        pool.pop_push_root(list);
+    }
+    state.observe(pool);
+    while (state.keep_running())
+        bench::do_not_optimize(pool.alloc(pool.nil(), pool.nil()));
+    pool.pop_root();
+}
+
+RLISP_BENCH(gc_alloc_churn_no_live) { bench_alloc_churn(state, 0); }
+RLISP_BENCH(gc_alloc_churn_16k_live) { bench_alloc_churn(state, 16384); }
+RLISP_BENCH(gc_alloc_churn_16k_live_nongenerational) { bench_alloc_churn(state, 16384, false); }
+RLISP_BENCH(gc_alloc_churn_256k_live) { bench_alloc_churn(state, 262144); }
+RLISP_BENCH(gc_alloc_churn_256k_live_incremental) { bench_alloc_churn(state, 262144, true, 256); }
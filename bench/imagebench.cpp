@@ -0,0 +1,66 @@
+#include "benchutil.h"
+#include "image.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "vcpkgparser.h"
+
+#include <stdio.h>
+
+#include <filesystem>
+#include <string>
+
+using namespace rlisp;
+
+// A library of 256 small functions and 256 constant lists, like a prelude every program starts by loading.
+static std::string prelude_source()
+{
+    std::string src;
+    for (int i = 0; i < 256; ++i)
+    {
+        auto n = std::to_string(i);
+        src += "(define fn-" + n + " (lambda (x y) (cond ((< x " + n + ") (cons x y)) (t (fn-" + n +
+               " (- x 1) (cons 'step-" + n + " y))))))\n";
+        src += "(define table-" + n + " '(entry-" + n + " (" + n + " " + std::to_string(i * 7) + ") (key-" + n +
+               " . value-" + n + ") " + n + "))\n";
+    }
+    return src;
+}
+
+static bool load_source(Interpreter& interp, const std::string& src)
+{
+    vcpkg::Parse::ParserBase parser(src, "prelude");
+    while (parse_more(parser))
+    {
+        auto e = parse(parser, interp.pool());
+        if (parser.get_error() || interp.eval(e) == nullptr) return false;
+    }
+    return true;
+}
+
+// both start from a new interpreter, as a new process would
+RLISP_BENCH(prelude_parse_eval)
+{
+    auto src = prelude_source();
+    while (state.keep_running())
+    {
+        Interpreter interp;
+        bench::do_not_optimize(load_source(interp, src));
+    }
+}
+
+RLISP_BENCH(prelude_image_load)
+{
+    auto path = (std::filesystem::temp_directory_path() / "rlisp-bench-prelude.img").string();
+    std::string error;
+    {
+        Interpreter interp;
+        if (!load_source(interp, prelude_source()) || !save_image(path, interp.globals(), interp.pool(), error))
+            return;
+    }
+    while (state.keep_running())
+    {
+        Interpreter interp;
+        bench::do_not_optimize(load_image(path, interp.globals(), interp.pool(), error));
+    }
+    remove(path.c_str());
+}
@@ -0,0 +1,39 @@
+#include "benchutil.h"
+#include "cons.h"
+#include "mempool.h"
+
+using namespace rlisp;
+
+// what builtin_eq and builtin_lambda used to do per call
+RLISP_BENCH(intern_atom_t)
+{
+    MemPool pool;
+    while (state.keep_running())
+        bench::do_not_optimize(pool.intern_atom("t"));
+}
+
+RLISP_BENCH(symbols_t)
+{
+    MemPool pool;
+    while (state.keep_running())
+        bench::do_not_optimize(pool.symbols().t);
+}
+
+// what eval2 used to do per atom and per closure call
+RLISP_BENCH(atom_string_compare)
+{
+    MemPool pool;
+    auto x = pool.intern_atom("closure");
+    bench::do_not_optimize(x);
+    while (state.keep_running())
+        bench::do_not_optimize(x->is_atom("closure"));
+}
+
+RLISP_BENCH(atom_pointer_compare)
+{
+    MemPool pool;
+    auto x = pool.intern_atom("closure");
+    bench::do_not_optimize(x);
+    while (state.keep_running())
+        bench::do_not_optimize(x == pool.symbols().closure);
+}
@@ -0,0 +1,117 @@
+#include "benchutil.h"
+#include "cons.h"
+#include "mempool.h"
+#include "parser.h"
+#include "vcpkgparser.h"
+
+#include <string>
+
+using namespace rlisp;
+
+// 256 forms over a vocabulary of 512 names, so after the first parse every atom is already interned
+static std::string symbol_heavy_source()
+{
+    std::string src;
+    for (int i = 0; i < 256; ++i)
+    {
+        auto name = [&](int k) { return "symbol-" + std::to_string((i * 7 + k * 13) % 512); };
+        src += "(define " + name(0) + " (lambda (" + name(1) + " " + name(2) + ") (cons " + name(1) + " '(" + name(3) +
+               " " + name(4) + " . " + name(5) + "))))\n";
+    }
+    return src;
+}
+
+// about 64 KiB of nested lists of atoms and fixnums, the same on every run
+static std::string generated_tree_source()
+{
+    std::string src;
+    uint32_t seed = 12345;
+    auto next = [&] {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) & 0x7FFF;
+    };
+    int depth = 0;
+    while (src.size() < 65536 || depth > 0)
+    {
+        auto r = next() % 8;
+        if (r == 0 && depth < 32 && src.size() < 65536)
+        {
+            src += '(';
+            ++depth;
+        }
+        else if (r == 1 && depth > 0)
+        {
+            src += ") ";
+            --depth;
+        }
+        else if (r < 5)
+            src += "name-" + std::to_string(next() % 256) + ' ';
+        else
+            src += std::to_string(next()) + ' ';
+        if (depth == 0) src += '\n';
+    }
+    return src;
+}
+
+static void bench_parse_all(bench::State& state, const std::string& src)
+{
+    MemPool pool(1 << 16);
+    state.observe(pool);
+    while (state.keep_running())
+    {
+        vcpkg::Parse::ParserBase parser(src, "bench");
+        while (parse_more(parser))
+            bench::do_not_optimize(parse(parser, pool));
+    }
+}
+
+RLISP_BENCH(parse_symbol_heavy) { bench_parse_all(state, symbol_heavy_source()); }
+
+RLISP_BENCH(parse_generated_tree) { bench_parse_all(state, generated_tree_source()); }
+
+RLISP_BENCH(parse_long_list)
+{
+    std::string src = "(";
+    for (int i = 0; i < 4096; ++i)
+        src += "x ";
+    src += ")";
+    bench_parse_all(state, src);
+}
+
+// 512 forms quoting the same few records, as data-heavy scripts do; every form is kept, so what the pool retains grows
+// with the input unless equal structure is shared
+static std::string duplicated_quotes_source()
+{
+    std::string src;
+    for (int i = 0; i < 512; ++i)
+    {
+        auto k = std::to_string(i % 8);
+        src += "(define row-" + std::to_string(i) + " '((id " + k +
+               ") (tags (red green blue)) (size (10 20 30)) (owner (name someone) (group staff))))\n";
+    }
+    return src;
+}
+
+static void bench_parse_kept(bench::State& state, const std::string& src, HashConsing hash_consing)
+{
+    MemPoolConfig config;
+    config.initial_cells = 4096;
+    config.hash_consing = hash_consing;
+    MemPool pool(config);
+    state.observe(pool);
+    while (state.keep_running())
+    {
+        auto base = pool.num_roots();
+        vcpkg::Parse::ParserBase parser(src, "bench");
+        while (parse_more(parser))
+            pool.push_root(parse(parser, pool));
+        pool.truncate_roots(base);
+    }
+}
+
+RLISP_BENCH(parse_duplicated_quotes) { bench_parse_kept(state, duplicated_quotes_source(), HashConsing::None); }
+
+RLISP_BENCH(parse_duplicated_quotes_hash_consed)
+{
+    bench_parse_kept(state, duplicated_quotes_source(), HashConsing::Quoted);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace rlisp
+{
+    struct Cons;
+    struct MemPool;
+
+    // Each instruction is an opcode followed by its operands, all 32 bits wide. Values live on the MemPool root
+    // stack, so everything the VM is holding is visible to the collector.
+    enum class Op : uint32_t
+    {
+        // k: push constants[k]
+        Const,
+        // depth index: push a resolved local
+        Local,
+        // k: push the value of the free variable constants[k]
+        Global,
+        // k: push the function of the call form constants[k], whose function position is a free variable, through
+        // the pool's call site caches
+        Function,
+        // evaluation failed
+        Fail,
+        // target: pop; jump if the value was nil
+        JumpIfNil,
+        // target
+        Jump,
+        Cons,
+        Car,
+        Cdr,
+        Eq,
+        // binary arithmetic and comparison on fixnums; other operands fail
+        Add,
+        Sub,
+        Mul,
+        Lt,
+        Gt,
+        NumEq,
+        // vector index: push the element; anything else fails
+        VectorRef,
+        // vector index value: store the value in the vector, and push it
+        VectorSet,
+        VectorLength,
+        // k: push a closure over the current scope; constants[k] is the lambda's (args body)
+        Lambda,
+        // n: push a frame of n slots and make it the current scope
+        LetEnter,
+        // i: pop into slot i of the current frame
+        SetLocal,
+        // drop the frame pushed by LetEnter, keeping the value above it
+        LetLeave,
+        // k target: if the value on top is a builtin, replace it with the result of calling it on the form
+        // constants[k] and jump to target
+        CallBuiltin,
+        // n: apply the closure below the top n values to them
+        Call,
+        // n: like Call, but the callee replaces the current call instead of returning to it
+        TailCall,
+        Return,
+    };
+
+    struct Chunk
+    {
+        std::vector<uint32_t> code;
+        std::vector<Cons*> constants;
+    };
+
+    // Compiles code produced by rlisp::resolve. The chunk's constants point into expr, so expr must stay alive for as
+    // long as the chunk is used.
+    void compile(Cons* expr, Chunk& chunk, MemPool& pool);
+
+    // Runs resolved code; scope is the global scope, as for the tree walking evaluator.
+    Cons* run_bytecode(Cons* code, Cons* scope, MemPool& pool);
+}
@@ -0,0 +1,17 @@
+#include "callcache.h"
+
+using namespace rlisp;
+
+void CallCache::fill(Cons* form, Cons* scope, Cons* func)
+{
+    auto name = form->car;
+    if (!name->is_atom()) return;
+    ++m_stats.misses;
+    // a closure made in another GlobalEnv's scope looks its names up there
+    while (scope->is_frame())
+        scope = scope->slot(0);
+    if (!scope->is_globals() || scope->globals != m_globals) return;
+
+    if (!m_entries) m_entries = std::make_unique<Entry[]>(size_t(1) << index_bits);
+    m_entries[index(form)] = {form, name, func, m_version};
+}
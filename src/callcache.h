@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+
+#include "cons.h"
+
+namespace rlisp
+{
+    struct CallCacheStats
+    {
+        // calls whose function was found in the cache
+        uint64_t hits = 0;
+        // calls through a global name that had to look it up
+        uint64_t misses = 0;
+    };
+
+    // Call site caches for a GlobalEnv: the function a call form's function position, a global name, was found
+    // bound to. The table is direct mapped by the address of the form, so a form that collides with another just
+    // evicts it. An entry is only used while its version is the cache's, and invalidate() moves the cache to a new
+    // version, so rebinding a global makes every entry miss without touching them. A freed form's address may come
+    // back as a new form; the entry also holds the name, and a name's binding is the same whichever form asks.
+    struct CallCache
+    {
+        explicit CallCache(const GlobalEnv* globals) : m_globals(globals) { }
+
+        // returns the function of the call form, or nullptr if it is not cached
+        Cons* find(Cons* form)
+        {
+            if (!m_entries) return nullptr;
+            auto& entry = m_entries[index(form)];
+            if (entry.form != form || entry.version != m_version || entry.name != form->car) return nullptr;
+            ++m_stats.hits;
+            return entry.func;
+        }
+        // records func as the function of the call form, looked up in scope, if its function position is a global
+        void fill(Cons* form, Cons* scope, Cons* func);
+        void invalidate() { ++m_version; }
+
+        const CallCacheStats& stats() const { return m_stats; }
+
+    private:
+        struct Entry
+        {
+            Cons* form;
+            Cons* name;
+            Cons* func;
+            uint64_t version;
+        };
+        static constexpr int index_bits = 10;
+
+        static size_t index(Cons* form)
+        {
+            return static_cast<size_t>(((reinterpret_cast<uintptr_t>(form) >> 4) * 0x9E3779B97F4A7C15ull) >>
+                                       (64 - index_bits));
+        }
+
+        const GlobalEnv* m_globals;
+        // allocated by the first fill; entries start at version 0, which the cache never has
+        std::unique_ptr<Entry[]> m_entries;
+        uint64_t m_version = 1;
+        CallCacheStats m_stats;
+    };
+}
@@ -0,0 +1,187 @@
+#include "cellspace.h"
+
+#include "cons.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <new>
+
+#if defined(RLISP_COMPACT_CELLS)
+#include <iterator>
+#include <map>
+#include <mutex>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+using namespace rlisp;
+
+// Most arenas hold a few records and need one small chunk; those that keep growing, like a symbol table's, get
+// larger chunks up to a limit.
+static constexpr size_t min_arena_chunk_bytes = 4096;
+static constexpr size_t max_arena_chunk_bytes = 65536;
+
+void* CellArena::allocate(size_t bytes, size_t align)
+{
+    auto p = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(m_next) + align - 1) & ~(align - 1));
+    if (m_next == nullptr || static_cast<size_t>(m_end - p) < bytes)
+    {
+        auto size = std::min(min_arena_chunk_bytes << std::min<size_t>(m_chunks.size(), 4), max_arena_chunk_bytes);
+        size = std::max(size, bytes);
+        auto chunk = static_cast<char*>(allocate_cells(size));
+        if (!chunk) return nullptr;
+        m_chunks.emplace_back(chunk);
+        p = chunk;
+        m_end = chunk + size;
+    }
+    m_next = p + bytes;
+    return p;
+}
+
+#if defined(RLISP_COMPACT_CELLS)
+
+uintptr_t rlisp::cell_space_base = 0;
+BuiltinFunc rlisp::builtin_funcs[max_builtin_funcs];
+
+namespace
+{
+    // every offset must fit a 32-bit word
+    constexpr size_t reserved_bytes = size_t(1) << 32;
+    constexpr size_t granule = 4096;
+    // freed ranges at least this large are handed back to the system; smaller ones stay committed for reuse
+    constexpr size_t release_bytes = size_t(1) << 20;
+
+    // First fit over the free ranges of the reservation, which are merged with their neighbours when freed. Cells
+    // are allocated in bulk, so this is only reached for a new heap segment or arena chunk.
+    struct CellSpace
+    {
+        std::mutex mutex;
+        char* base = nullptr;
+        // offset to size, for the free ranges and for the ranges handed out
+        std::map<size_t, size_t> free;
+        std::map<size_t, size_t> used;
+        size_t builtins = 0;
+
+        bool reserve()
+        {
+#if defined(_WIN32)
+            base = static_cast<char*>(VirtualAlloc(nullptr, reserved_bytes, MEM_RESERVE, PAGE_NOACCESS));
+            if (!base) return false;
+#else
+            // pages are only backed once they are touched
+            auto p = mmap(
+                nullptr, reserved_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (p == MAP_FAILED) return false;
+            base = static_cast<char*>(p);
+#endif
+            cell_space_base = reinterpret_cast<uintptr_t>(base);
+            // no cell is ever at offset 0
+            free[granule] = reserved_bytes - granule;
+            return true;
+        }
+
+        void* allocate(size_t bytes)
+        {
+            bytes = (bytes + granule - 1) & ~(granule - 1);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!base && !reserve()) return nullptr;
+            for (auto it = free.begin(); it != free.end(); ++it)
+            {
+                if (it->second < bytes) continue;
+                auto offset = it->first;
+                auto rest = it->second - bytes;
+                free.erase(it);
+                if (rest != 0) free[offset + bytes] = rest;
+#if defined(_WIN32)
+                if (!VirtualAlloc(base + offset, bytes, MEM_COMMIT, PAGE_READWRITE))
+                {
+                    release(offset, bytes);
+                    return nullptr;
+                }
+#endif
+                used[offset] = bytes;
+                return base + offset;
+            }
+            return nullptr;
+        }
+
+        void deallocate(void* p)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = used.find(static_cast<size_t>(static_cast<char*>(p) - base));
+            auto offset = it->first;
+            auto bytes = it->second;
+            used.erase(it);
+            if (bytes >= release_bytes)
+            {
+#if defined(_WIN32)
+                VirtualFree(base + offset, bytes, MEM_DECOMMIT);
+#else
+                madvise(base + offset, bytes, MADV_DONTNEED);
+#endif
+            }
+            release(offset, bytes);
+        }
+
+        void release(size_t offset, size_t bytes)
+        {
+            auto next = free.lower_bound(offset);
+            if (next != free.end() && next->first == offset + bytes)
+            {
+                bytes += next->second;
+                next = free.erase(next);
+            }
+            if (next != free.begin())
+            {
+                auto prev = std::prev(next);
+                if (prev->first + prev->second == offset)
+                {
+                    prev->second += bytes;
+                    return;
+                }
+            }
+            free[offset] = bytes;
+        }
+    };
+
+    CellSpace& cell_space()
+    {
+        static CellSpace space;
+        return space;
+    }
+}
+
+void* rlisp::allocate_cells(size_t bytes) { return cell_space().allocate(bytes); }
+
+void rlisp::free_cells(void* p)
+{
+    if (p) cell_space().deallocate(p);
+}
+
+uint32_t rlisp::builtin_number(BuiltinFunc func)
+{
+    auto& space = cell_space();
+    std::lock_guard<std::mutex> lock(space.mutex);
+    for (size_t i = 0; i < space.builtins; ++i)
+    {
+        if (builtin_funcs[i] == func) return static_cast<uint32_t>(i);
+    }
+    if (space.builtins == max_builtin_funcs) abort();
+    builtin_funcs[space.builtins] = func;
+    return static_cast<uint32_t>(space.builtins++);
+}
+
+#else
+
+void* rlisp::allocate_cells(size_t bytes) { return ::operator new(bytes, std::nothrow); }
+
+void rlisp::free_cells(void* p) { ::operator delete(p); }
+
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <memory>
+#include <vector>
+
+namespace rlisp
+{
+    // Memory for cells. Everything a cell can point at is allocated here: heap segments, atoms and their names, and
+    // the builtin and global scope cells. With RLISP_COMPACT_CELLS it all comes from one address range reserved for
+    // the whole process, so that a cell can refer to another by a 32-bit offset (see cons.h); otherwise this is the
+    // ordinary heap.
+
+    // returns nullptr when out of memory; the memory is aligned for a Cons
+    void* allocate_cells(size_t bytes);
+    void free_cells(void* p);
+
+    struct FreeCells
+    {
+        void operator()(void* p) const { free_cells(p); }
+    };
+
+    // A bump allocator for small records holding cells, which are all freed together when the arena is destroyed.
+    struct CellArena
+    {
+        CellArena() = default;
+        CellArena(const CellArena&) = delete;
+        CellArena& operator=(const CellArena&) = delete;
+
+        // align must be a power of two no larger than a Cons's; returns nullptr when out of memory
+        void* allocate(size_t bytes, size_t align);
+
+    private:
+        std::vector<std::unique_ptr<char, FreeCells>> m_chunks;
+        char* m_next = nullptr;
+        char* m_end = nullptr;
+    };
+}
@@ -0,0 +1,242 @@
+#include "bytecode.h"
+#include "cons.h"
+#include "mempool.h"
+
+using namespace rlisp;
+
+namespace
+{
+    // Mirrors the shape checks of the builtins in eval.cpp: a malformed form compiles to Fail, so that it only fails
+    // if it is actually evaluated.
+    struct Compiler
+    {
+        Compiler(Chunk& chunk, MemPool& pool) : chunk(chunk), pool(pool), syms(pool.symbols()) { }
+
+        // an expression in tail position is the last thing evaluated before returning
+        void expr(Cons* e, bool tail = false);
+        void emit(Op op) { chunk.code.push_back(static_cast<uint32_t>(op)); }
+
+    private:
+        void emit(Op op, uint32_t a)
+        {
+            emit(op);
+            chunk.code.push_back(a);
+        }
+        uint32_t constant(Cons* c)
+        {
+            chunk.constants.push_back(c);
+            return static_cast<uint32_t>(chunk.constants.size() - 1);
+        }
+        // returns the position of the jump target so it can be patched once known
+        size_t emit_jump(Op op)
+        {
+            emit(op, 0);
+            return chunk.code.size() - 1;
+        }
+        void patch(size_t at) { chunk.code[at] = static_cast<uint32_t>(chunk.code.size()); }
+        // true if the form has exactly n arguments
+        bool has_args(Cons* e, size_t n) const
+        {
+            auto a = e->cdr;
+            for (; n > 0; --n, a = a->cdr)
+            {
+                if (!a->is_cons()) return false;
+            }
+            return a == pool.nil();
+        }
+
+        bool binary_op(Cons* head, Op& op) const
+        {
+            if (head == syms.add)
+                op = Op::Add;
+            else if (head == syms.sub)
+                op = Op::Sub;
+            else if (head == syms.mul)
+                op = Op::Mul;
+            else if (head == syms.lt)
+                op = Op::Lt;
+            else if (head == syms.gt)
+                op = Op::Gt;
+            else if (head == syms.num_eq)
+                op = Op::NumEq;
+            else
+                return false;
+            return true;
+        }
+
+        // the vector builtins, which take count arguments
+        bool vector_op(Cons* head, Op& op, size_t& count) const
+        {
+            if (head == syms.vector_ref)
+            {
+                op = Op::VectorRef;
+                count = 2;
+            }
+            else if (head == syms.vector_set)
+            {
+                op = Op::VectorSet;
+                count = 3;
+            }
+            else if (head == syms.vector_length)
+            {
+                op = Op::VectorLength;
+                count = 1;
+            }
+            else
+                return false;
+            return true;
+        }
+
+        void cond(Cons* e, bool tail);
+        void let(Cons* e, bool tail);
+        void call(Cons* e, bool tail);
+
+        Chunk& chunk;
+        MemPool& pool;
+        const Symbols& syms;
+    };
+}
+
+void Compiler::cond(Cons* e, bool tail)
+{
+    std::vector<size_t> ends;
+    auto case_list = e->cdr;
+    do
+    {
+        // running out of cases is a failure too
+        if (!case_list->is_cons()) break;
+
+        auto cur_case = case_list->car;
+        case_list = case_list->cdr;
+
+        if (!cur_case->is_cons()) break;
+        if (!cur_case->cdr->is_cons()) break;
+        if (cur_case->cdr->cdr != pool.nil()) break;
+
+        expr(cur_case->car);
+        auto next = emit_jump(Op::JumpIfNil);
+        expr(cur_case->cdr->car, tail);
+        ends.push_back(emit_jump(Op::Jump));
+        patch(next);
+    } while (true);
+    emit(Op::Fail);
+    for (auto at : ends)
+        patch(at);
+}
+
+void Compiler::let(Cons* e, bool tail)
+{
+    // (let ((a b) (c d)) e)
+    if (!has_args(e, 2)) return emit(Op::Fail);
+    auto pairs = e->cdr->car;
+    uint32_t count = 0;
+    for (auto p = pairs; p->is_cons(); p = p->cdr, ++count)
+    {
+        auto pair = p->car;
+        if (!pair->is_cons()) return emit(Op::Fail);
+        if (!pair->cdr->is_cons()) return emit(Op::Fail);
+        if (pair->cdr->cdr != pool.nil()) return emit(Op::Fail);
+        if (!pair->car->is_atom()) return emit(Op::Fail);
+    }
+
+    emit(Op::LetEnter, count);
+    uint32_t i = 0;
+    for (; pairs->is_cons(); pairs = pairs->cdr, ++i)
+    {
+        expr(pairs->car->cdr->car);
+        emit(Op::SetLocal, i);
+    }
+    if (pairs != pool.nil()) return emit(Op::Fail);
+    expr(e->cdr->cdr->car, tail);
+    emit(Op::LetLeave);
+}
+
+void Compiler::call(Cons* e, bool tail)
+{
+    // the function position may turn out to be a builtin, which takes its arguments unevaluated
+    auto form = constant(e);
+    auto head = e->car;
+    if (!is_immediate(head) && head->is_atom() && head != pool.nil() && head != syms.t)
+        emit(Op::Function, form);
+    else
+        expr(head);
+    emit(Op::CallBuiltin, form);
+    auto done = chunk.code.size();
+    chunk.code.push_back(0);
+
+    uint32_t count = 0;
+    auto args = e->cdr;
+    for (; args->is_cons(); args = args->cdr, ++count)
+        expr(args->car);
+    if (args != pool.nil())
+        emit(Op::Fail);
+    else
+        emit(tail ? Op::TailCall : Op::Call, count);
+    patch(done);
+}
+
+void Compiler::expr(Cons* e, bool tail)
+{
+    if (is_immediate(e, Immediate::LocalRef))
+    {
+        auto ref = local_ref(e);
+        emit(Op::Local, static_cast<uint32_t>(ref.depth));
+        chunk.code.push_back(static_cast<uint32_t>(ref.index));
+        return;
+    }
+    if (is_fixnum(e)) return emit(Op::Const, constant(e));
+    if (is_immediate(e)) return emit(Op::Fail);
+    if (e == pool.nil() || e == syms.t || e->is_vector()) return emit(Op::Const, constant(e));
+    if (e->is_atom()) return emit(Op::Global, constant(e));
+    if (!e->is_cons()) return emit(Op::Fail);
+
+    // the resolver has already turned shadowed names into local references, so an atom here names the builtin
+    auto head = e->car;
+    if (is_immediate(head) || !head->is_atom()) return call(e, tail);
+    if (head == syms.quote)
+    {
+        if (!has_args(e, 1)) return emit(Op::Fail);
+        return emit(Op::Const, constant(e->cdr->car));
+    }
+    if (head == syms.cond) return cond(e, tail);
+    if (head == syms.lambda) return emit(Op::Lambda, constant(e->cdr));
+    if (head == syms.let) return let(e, tail);
+    if (head == syms.cons || head == syms.eq)
+    {
+        if (!has_args(e, 2)) return emit(Op::Fail);
+        expr(e->cdr->car);
+        expr(e->cdr->cdr->car);
+        return emit(head == syms.cons ? Op::Cons : Op::Eq);
+    }
+    if (head == syms.car || head == syms.cdr)
+    {
+        if (!has_args(e, 1)) return emit(Op::Fail);
+        expr(e->cdr->car);
+        return emit(head == syms.car ? Op::Car : Op::Cdr);
+    }
+    Op vector;
+    size_t count;
+    if (vector_op(head, vector, count))
+    {
+        if (!has_args(e, count)) return emit(Op::Fail);
+        for (auto args = e->cdr; args != pool.nil(); args = args->cdr)
+            expr(args->car);
+        return emit(vector);
+    }
+    // the variadic forms of + - * go through the builtin
+    Op arith;
+    if (binary_op(head, arith) && has_args(e, 2))
+    {
+        expr(e->cdr->car);
+        expr(e->cdr->cdr->car);
+        return emit(arith);
+    }
+    call(e, tail);
+}
+
+void rlisp::compile(Cons* e, Chunk& chunk, MemPool& pool)
+{
+    Compiler c(chunk, pool);
+    c.expr(e, true);
+    c.emit(Op::Return);
+}
@@ -1,26 +1,317 @@
 #pragma once
 
-#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#include <string_view>
 
 namespace rlisp
 {
     struct Cons;
+    struct GlobalEnv;
 
     using BuiltinFunc = Cons* (*)(Cons*, Cons*, struct MemPool&);
 
+    // the name of an atom; owned by the SymbolTable that interned it, and NUL terminated
+    struct AtomName
+    {
+        const char* data;
+        size_t size;
+
+        std::string_view view() const { return {data, size}; }
+    };
+
+    // Tags stored in car to mark cells that are not pairs (see Cons::set_tag). Any car value above max_tag is a
+    // pointer, so the cell is a pair.
+    enum class Tag : uintptr_t
+    {
+        Atom = 0,
+        Builtin = 1,
+        // the end of every scope chain; the cell belongs to a GlobalEnv (see globals.h)
+        Globals = 2,
+        // block header: followed by contiguous cells holding slot values; slot 0 is the parent frame
+        Frame = 3,
+        // block holding the values of a GlobalEnv
+        GlobalValues = 4,
+        // block made by evaluating a lambda; see make_closure in scope.h for its slots
+        Closure = 5,
+        // block holding the elements of a vector, one per slot; unlike other blocks it may have no slots
+        Vector = 6,
+    };
+    constexpr uintptr_t min_block_tag = 3;
+    constexpr uintptr_t max_tag = 10;
+
+    // make-vector fails beyond this many elements, so that the cells of a vector can be counted without overflow
+    constexpr int64_t max_vector_length = int64_t(1) << 28;
+
+    // Values with any of the top four bits set are immediates rather than pointers: no user space address has them
+    // set. Keeping the tag at the top means an immediate stored in car is never mistaken for one of the tags above.
+    // The payload sits above the low four bits, which stay clear so an immediate is aligned like a cell pointer.
+    enum class Immediate : uintptr_t
+    {
+        // a small integer; see make_fixnum
+        Fixnum = 1,
+        // a variable reference resolved to (frame depth, slot); only appears in code produced by rlisp::resolve
+        LocalRef = 2,
+    };
+    constexpr int immediate_shift = sizeof(uintptr_t) * 8 - 4;
+#if defined(RLISP_COMPACT_CELLS)
+    // a compact cell keeps the kind in three bits of a 32-bit word, and the payload in the rest
+    constexpr int immediate_payload_bits = 29;
+#else
+    constexpr int immediate_payload_bits = immediate_shift - 4;
+#endif
+    constexpr uintptr_t immediate_payload_mask = (uintptr_t(1) << immediate_payload_bits) - 1;
+
+    inline bool is_immediate(const Cons* c) { return (reinterpret_cast<uintptr_t>(c) >> immediate_shift) != 0; }
+    inline bool is_immediate(const Cons* c, Immediate kind)
+    {
+        return (reinterpret_cast<uintptr_t>(c) >> immediate_shift) == static_cast<uintptr_t>(kind);
+    }
+
+    inline Cons* make_immediate(Immediate kind, uintptr_t payload)
+    {
+        return reinterpret_cast<Cons*>((static_cast<uintptr_t>(kind) << immediate_shift) |
+                                       ((payload & immediate_payload_mask) << 4));
+    }
+    inline uintptr_t immediate_payload(const Cons* c)
+    {
+        return (reinterpret_cast<uintptr_t>(c) >> 4) & immediate_payload_mask;
+    }
+
+#if defined(RLISP_COMPACT_CELLS)
+    // Compact cells are two 32-bit words instead of two pointers. Every cell lives in one reserved address range (see
+    // cellspace.h), so a word can hold a cell as its offset from cell_space_base. Cells are 8-byte aligned, which
+    // leaves the low three bits of the word for a tag:
+    //   000  the offset of a cell
+    //   kind an immediate of that Immediate kind, with the payload in the upper 29 bits
+    //   111  in car only, the header of a cell that is not a pair, with the Tag in the upper bits
+    // Values outside cells are still full pointers; the fields convert on every load and store.
+    extern uintptr_t cell_space_base;
+    constexpr uint32_t header_bits = 7;
+
+    inline uint32_t encode_cell(const Cons* c)
+    {
+        auto v = reinterpret_cast<uintptr_t>(c);
+        auto kind = v >> immediate_shift;
+        if (kind != 0) return static_cast<uint32_t>((((v >> 4) & immediate_payload_mask) << 3) | kind);
+        return static_cast<uint32_t>(v - cell_space_base);
+    }
+    inline Cons* decode_cell(uint32_t word)
+    {
+        if (word & header_bits) return make_immediate(static_cast<Immediate>(word & header_bits), word >> 3);
+        return reinterpret_cast<Cons*>(cell_space_base + word);
+    }
+
+    // a car, cdr or block slot
+    struct CellRef
+    {
+        CellRef() = default;
+        CellRef(Cons* c) : word(encode_cell(c)) { }
+        // a cell never holds nullptr, which has no encoding
+        CellRef(std::nullptr_t) = delete;
+        CellRef& operator=(Cons* c)
+        {
+            word = encode_cell(c);
+            return *this;
+        }
+        CellRef& operator=(std::nullptr_t) = delete;
+        operator Cons*() const { return decode_cell(word); }
+        Cons* operator->() const { return decode_cell(word); }
+
+        uint32_t word;
+    };
+
+    // a pointer to something else allocated in the cell space, such as an atom's name
+    template<class T>
+    struct CellSpacePtr
+    {
+        CellSpacePtr& operator=(T* p)
+        {
+            word = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(p) - cell_space_base);
+            return *this;
+        }
+        operator T*() const { return reinterpret_cast<T*>(cell_space_base + word); }
+        T* operator->() const { return *this; }
+
+        uint32_t word;
+    };
+
+    // Builtins are numbered in the order they are first stored in a cell; a process has a few dozen at most.
+    constexpr size_t max_builtin_funcs = 256;
+    extern BuiltinFunc builtin_funcs[max_builtin_funcs];
+    // returns the number of func, registering it if it is new; aborts if there are too many
+    uint32_t builtin_number(BuiltinFunc func);
+
+    struct BuiltinRef
+    {
+        BuiltinRef& operator=(BuiltinFunc func)
+        {
+            word = builtin_number(func);
+            return *this;
+        }
+        // also lets the field be called like the function it refers to
+        operator BuiltinFunc() const { return builtin_funcs[word]; }
+
+        uint32_t word;
+    };
+
+    using AtomRef = CellSpacePtr<const AtomName>;
+    // the GlobalEnv* stored in the cell space beside the scope cell (see GlobalEnv)
+    struct GlobalsRef
+    {
+        GlobalsRef& operator=(GlobalEnv* const* p)
+        {
+            word = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(p) - cell_space_base);
+            return *this;
+        }
+        operator GlobalEnv*() const { return *reinterpret_cast<GlobalEnv* const*>(cell_space_base + word); }
+        GlobalEnv* operator->() const { return *this; }
+
+        uint32_t word;
+    };
+    using BlockSize = uint32_t;
+#else
+    using CellRef = Cons*;
+    using AtomRef = const AtomName*;
+    using BuiltinRef = BuiltinFunc;
+    using GlobalsRef = GlobalEnv*;
+    using BlockSize = size_t;
+#endif
+
+    // The predicates check for an immediate before reading the cell, so they may be called on any value.
     struct Cons
     {
-        bool is_atom() const { return car == 0; }
-        bool is_atom(const char* v) const { return car == 0 && *atom == v; }
-        bool is_cons() const { return 10 < (uintptr_t)car; }
-        bool is_builtin() const { return 1 == (uintptr_t)car; }
+#if defined(RLISP_COMPACT_CELLS)
+        bool is_atom() const { return !is_immediate(this) && car.word == header(Tag::Atom); }
+        // a single test of the tag bits: immediates and offsets are both pairs' cars
+        bool is_cons() const { return !is_immediate(this) && (car.word & header_bits) != header_bits; }
+        bool is_builtin() const { return !is_immediate(this) && car.word == header(Tag::Builtin); }
+        bool is_block() const
+        {
+            return !is_immediate(this) && (car.word & header_bits) == header_bits && (car.word >> 3) >= min_block_tag;
+        }
+        bool is_frame() const { return !is_immediate(this) && car.word == header(Tag::Frame); }
+        bool is_closure() const { return !is_immediate(this) && car.word == header(Tag::Closure); }
+        bool is_vector() const { return !is_immediate(this) && car.word == header(Tag::Vector); }
+        bool is_globals() const { return !is_immediate(this) && car.word == header(Tag::Globals); }
+
+        // marks the cell as the kind of non-pair the tag names
+        void set_tag(Tag tag) { car.word = header(tag); }
+        // the tag of a cell that is not a pair
+        Tag tag() const { return static_cast<Tag>(car.word >> 3); }
+#else
+        bool is_atom() const { return !is_immediate(this) && car == 0; }
+        bool is_cons() const { return !is_immediate(this) && max_tag < (uintptr_t)car; }
+        bool is_builtin() const { return !is_immediate(this) && 1 == (uintptr_t)car; }
+        bool is_block() const
+        {
+            return !is_immediate(this) && min_block_tag <= (uintptr_t)car && (uintptr_t)car <= max_tag;
+        }
+        bool is_frame() const { return !is_immediate(this) && (uintptr_t)Tag::Frame == (uintptr_t)car; }
+        bool is_closure() const { return !is_immediate(this) && (uintptr_t)Tag::Closure == (uintptr_t)car; }
+        bool is_vector() const { return !is_immediate(this) && (uintptr_t)Tag::Vector == (uintptr_t)car; }
+        bool is_globals() const { return !is_immediate(this) && (uintptr_t)Tag::Globals == (uintptr_t)car; }
+
+        // marks the cell as the kind of non-pair the tag names
+        void set_tag(Tag tag) { car = reinterpret_cast<Cons*>(tag); }
+        // the tag of a cell that is not a pair
+        Tag tag() const { return static_cast<Tag>(reinterpret_cast<uintptr_t>(static_cast<Cons*>(car))); }
+#endif
+        bool is_atom(const char* v) const { return is_atom() && atom->view() == v; }
+
+        // Blocks store two slots per cell after the header.
+        static size_t block_cells(size_t slots) { return 1 + (slots + 1) / 2; }
+        CellRef& slot(size_t i)
+        {
+            auto& cell = this[1 + i / 2];
+            return i % 2 ? cell.cdr : cell.car;
+        }
 
-        Cons* car;
+        CellRef car;
         union
         {
-            Cons* cdr;
-            const std::string* atom;
-            BuiltinFunc builtin;
+            CellRef cdr;
+            AtomRef atom;
+            BuiltinRef builtin;
+            BlockSize block_size;
+            GlobalsRef globals;
         };
+
+#if defined(RLISP_COMPACT_CELLS)
+    private:
+        static constexpr uint32_t header(Tag tag) { return static_cast<uint32_t>(tag) << 3 | header_bits; }
+#endif
+    };
+    static_assert(sizeof(Cons) == 2 * sizeof(CellRef));
+
+    struct LocalRef
+    {
+        size_t depth;
+        size_t index;
     };
+
+    // the slot index takes the low bits of the payload and the depth the rest
+#if defined(RLISP_COMPACT_CELLS)
+    constexpr int local_index_bits = 16;
+#else
+    constexpr int local_index_bits = 24;
+#endif
+    constexpr size_t max_local_index = (size_t(1) << local_index_bits) - 1;
+    constexpr size_t max_local_depth = (size_t(1) << (immediate_payload_bits - local_index_bits)) - 1;
+
+    // depth and index must not exceed max_local_depth and max_local_index
+    inline Cons* make_local_ref(size_t depth, size_t index)
+    {
+        return make_immediate(Immediate::LocalRef, (static_cast<uintptr_t>(depth) << local_index_bits) | index);
+    }
+    inline LocalRef local_ref(const Cons* c)
+    {
+        auto payload = immediate_payload(c);
+        return {payload >> local_index_bits, payload & max_local_index};
+    }
+
+    // small signed integers, held in the payload in two's complement
+    constexpr int64_t fixnum_max = (int64_t(1) << (immediate_payload_bits - 1)) - 1;
+    constexpr int64_t fixnum_min = -fixnum_max - 1;
+
+    inline bool is_fixnum(const Cons* c) { return is_immediate(c, Immediate::Fixnum); }
+    // v must be in [fixnum_min, fixnum_max]
+    inline Cons* make_fixnum(int64_t v) { return make_immediate(Immediate::Fixnum, static_cast<uintptr_t>(v)); }
+    inline int64_t fixnum_value(const Cons* c)
+    {
+        // drop the kind bits and anything above the payload, then shift back down with sign extension
+        return static_cast<int64_t>(reinterpret_cast<uintptr_t>(c) << (immediate_shift - immediate_payload_bits)) >>
+               (immediate_shift + 4 - immediate_payload_bits);
+    }
+
+    // Arithmetic fails rather than leaving the fixnum range. Two fixnums always add or subtract within an int64_t, so
+    // sums are checked afterwards; products are checked for overflowing an int64_t first, then like sums.
+    inline bool fixnum_in_range(int64_t v) { return fixnum_min <= v && v <= fixnum_max; }
+    inline bool fixnum_mul(int64_t a, int64_t b, int64_t& result)
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int64_t high;
+        result = _mul128(a, b, &high);
+        // the product fits when the high word only extends the sign of the low one
+        if (high != (result >> 63)) return false;
+#else
+        if (__builtin_mul_overflow(a, b, &result)) return false;
+#endif
+        return fixnum_in_range(result);
+    }
+
+    // sets i to the slot of v that k indexes; false unless v is a vector and k a fixnum within it
+    inline bool vector_index(Cons* v, Cons* k, size_t& i)
+    {
+        if (!v->is_vector() || !is_fixnum(k)) return false;
+        auto index = fixnum_value(k);
+        if (index < 0 || static_cast<uint64_t>(index) >= v->block_size) return false;
+        i = static_cast<size_t>(index);
+        return true;
+    }
 }
@@ -0,0 +1,146 @@
+#include "copy.h"
+
+#include "cons.h"
+#include "mempool.h"
+
+#include <unordered_map>
+#include <vector>
+
+using namespace rlisp;
+
+namespace
+{
+    // a list whose elements are being copied, front to back
+    struct Open
+    {
+        // the pair whose car is being copied
+        Cons* src;
+        // the last pair copied so far, or nullptr; the first is kept in a root slot
+        Cons* tail;
+    };
+
+    struct Copier
+    {
+        explicit Copier(MemPool& pool) : pool(pool), base(pool.num_roots()) { }
+        ~Copier() { pool.truncate_roots(base); }
+
+        Cons* copy(Cons* value);
+
+    private:
+        // returns true with the copy of v in out if v is not a pair or has been copied already, and false if v is a
+        // pair still to be copied; out is nullptr if v cannot be copied at all
+        bool leaf(Cons* v, Cons*& out)
+        {
+            if (is_immediate(v) || v->is_atom())
+            {
+                out = v;
+                return true;
+            }
+            if (!v->is_cons() && !v->is_vector())
+            {
+                out = nullptr;
+                return true;
+            }
+            auto it = copies.find(v);
+            if (it != copies.end())
+            {
+                out = it->second;
+                return true;
+            }
+            if (!v->is_vector()) return false;
+            out = vector(v);
+            return true;
+        }
+        Cons* vector(Cons* v);
+
+        MemPool& pool;
+        size_t base;
+        std::vector<Open> open;
+        // pairs copied so far; every copy is reachable from a root slot of an open list or from the result
+        std::unordered_map<Cons*, Cons*> copies;
+    };
+}
+
+// Like the parser, lists are copied front to back through a tail pointer and nesting is tracked on an explicit stack,
+// so neither long nor deeply nested values recurse, and the roots used are bounded by the nesting depth.
+Cons* Copier::copy(Cons* value)
+{
+    auto v = value;
+    while (true)
+    {
+        Cons* result;
+        if (!leaf(v, result))
+        {
+            // start copying the list at v with its first element
+            open.push_back({v, nullptr});
+            pool.push_root(pool.nil());
+            v = v->car;
+            continue;
+        }
+
+        // hand the copied value to the lists that contain it until one has another element to copy
+        while (true)
+        {
+            if (!result) return nullptr;
+            if (open.empty()) return result;
+
+            auto& top = open.back();
+            auto slot = base + open.size() - 1;
+            // alloc keeps result alive if it collects
+            auto cell = pool.alloc(result, pool.nil());
+            if (!cell) return nullptr;
+            copies.emplace(top.src, cell);
+            if (top.tail)
+                pool.set_cdr(top.tail, cell);
+            else
+                pool.set_root(slot, cell);
+            top.tail = cell;
+
+            auto next = top.src->cdr;
+            Cons* rest;
+            if (!leaf(next, rest))
+            {
+                top.src = next;
+                v = next->car;
+                break;
+            }
+            if (!rest) return nullptr;
+            // the list ends here, in nil, an atom, or structure copied already
+            pool.set_cdr(top.tail, rest);
+            result = pool.root(slot);
+            open.pop_back();
+            pool.pop_root();
+        }
+    }
+}
+
+// Each element is copied by a walk of its own, with the lists open around the vector set aside, so only vectors nested
+// in vectors recurse. The copy is recorded before its elements are copied, so a vector that holds itself copies too.
+Cons* Copier::vector(Cons* v)
+{
+    auto n = static_cast<size_t>(v->block_size);
+    auto copy = pool.alloc_block(Tag::Vector, n, pool.nil());
+    if (!copy) return nullptr;
+    copies.emplace(v, copy);
+    auto outer = std::move(open);
+    open.clear();
+    auto outer_base = base;
+    pool.push_root(copy);
+    base = pool.num_roots();
+    for (size_t i = 0; i < n && copy; ++i)
+    {
+        auto element = this->copy(v->slot(i));
+        pool.truncate_roots(base);
+        open.clear();
+        if (element)
+            pool.set_slot(copy, i, element);
+        else
+            copy = nullptr;
+    }
+    pool.truncate_roots(base - 1);
+    base = outer_base;
+    open = std::move(outer);
+    return copy;
+}
+
+Cons* rlisp::copy_value(Cons* value, MemPool& pool) { return Copier(pool).copy(value); }
@@ -0,0 +1,14 @@
+#pragma once
+
+namespace rlisp
+{
+    struct Cons;
+    struct MemPool;
+
+    // Copies the data in value into pool, which must intern atoms in the same SymbolTable as the pool value lives in,
+    // so that atoms carry over by pointer. Structure shared within value stays shared in the copy. Only lists,
+    // vectors, atoms and fixnums can be copied: closures, builtins and frames belong to the heap and globals they were
+    // made in, so a value containing one returns nullptr, as does running out of memory. value's own pool must not
+    // collect while it is copied.
+    Cons* copy_value(Cons* value, MemPool& pool);
+}
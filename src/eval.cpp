@@ -1,7 +1,13 @@
 #include "eval.h"
 
+#include "bytecode.h"
+#include "callcache.h"
 #include "cons.h"
+#include "globals.h"
 #include "mempool.h"
+#include "profiler.h"
+#include "resolve.h"
+#include "scope.h"
 
 using namespace rlisp;
 
@@ -19,9 +25,13 @@ static Cons* single_arg_eval(Cons* e, MemPool& pool)
 
 struct ScopedPin
 {
-    ScopedPin(Cons* c, MemPool& p) : pool(p) { pool.push_root(c); }
+    ScopedPin(Cons* c, MemPool& p) : pool(p), index(p.num_roots()) { pool.push_root(c); }
     ~ScopedPin() { pool.pop_root(); }
 
+    Cons* get() const { return pool.root(index); }
+    // replaces the pinned value without growing the root stack
+    void set(Cons* c) { pool.set_root(index, c); }
+
     ScopedPin(const ScopedPin&) = delete;
     ScopedPin& operator=(const ScopedPin&) = delete;
     ScopedPin(ScopedPin&&) = delete;
@@ -29,11 +39,55 @@ struct ScopedPin
 
 private:
     MemPool& pool;
+    size_t index;
+};
+
+// Makes the pool look functions up through the call site caches of the scope being evaluated in, and restores those
+// of any evaluation this one is nested in.
+struct ScopedCallCache
+{
+    ScopedCallCache(CallCache* calls, MemPool& p) : pool(p), outer(p.call_cache()) { pool.set_call_cache(calls); }
+    ~ScopedCallCache() { pool.set_call_cache(outer); }
+
+    ScopedCallCache(const ScopedCallCache&) = delete;
+    ScopedCallCache& operator=(const ScopedCallCache&) = delete;
+
+private:
+    MemPool& pool;
+    CallCache* outer;
+};
+
+// Reports the closure an eval2 loop is running to the pool's profiler, if it has one; with none, all this costs is a
+// test of entered on the way out. A tail call leaves the closure it replaces.
+struct ProfiledCall
+{
+    explicit ProfiledCall(MemPool& p) : pool(p) { }
+    ~ProfiledCall()
+    {
+        if (entered) pool.profiler()->leave(pool);
+    }
+
+    void enter(Cons* lambda)
+    {
+        auto profiler = pool.profiler();
+        if (!profiler) return;
+        if (entered) profiler->leave(pool);
+        profiler->enter_closure(lambda, pool);
+        entered = true;
+    }
+
+    ProfiledCall(const ProfiledCall&) = delete;
+    ProfiledCall& operator=(const ProfiledCall&) = delete;
+
+private:
+    MemPool& pool;
+    bool entered = false;
 };
 
 static Cons* eval2(Cons* e, Cons* scope, MemPool& pool);
 
-static Cons* builtin_cond(Cons* e, Cons* scope, MemPool& pool)
+// returns the expression of the chosen case, which is in tail position
+static Cons* cond_branch(Cons* e, Cons* scope, MemPool& pool)
 {
     auto case_list = e->cdr;
     do
@@ -50,10 +104,16 @@ static Cons* builtin_cond(Cons* e, Cons* scope, MemPool& pool)
         auto ea = eval2(cur_case->car, scope, pool);
         if (ea == nullptr) return nullptr;
         if (ea == pool.nil()) continue;
-        return eval2(cur_case->cdr->car, scope, pool);
+        return cur_case->cdr->car;
     } while (true);
 }
 
+static Cons* builtin_cond(Cons* e, Cons* scope, MemPool& pool)
+{
+    auto branch = cond_branch(e, scope, pool);
+    return branch ? eval2(branch, scope, pool) : nullptr;
+}
+
 static Cons* builtin_cons(Cons* e, Cons* scope, MemPool& pool)
 {
     if (!e->cdr->is_cons()) return nullptr;
@@ -65,7 +125,7 @@ static Cons* builtin_cons(Cons* e, Cons* scope, MemPool& pool)
     auto a2 = eval2(e->cdr->cdr->car, scope, pool);
     pool.pop_root();
     if (a2 == nullptr) return nullptr;
-    return pool.alloc(a1, a2);
+    return pool.cons(a1, a2);
 }
 
 static Cons* builtin_eq(Cons* e, Cons* scope, MemPool& pool)
@@ -79,19 +139,13 @@ static Cons* builtin_eq(Cons* e, Cons* scope, MemPool& pool)
     auto a2 = eval2(e->cdr->cdr->car, scope, pool);
     pool.pop_root();
     if (a2 == nullptr) return nullptr;
-    return a1 == a2 ? pool.intern_atom("t") : pool.nil();
+    return a1 == a2 ? pool.symbols().t : pool.nil();
 }
 
-static Cons* builtin_lambda(Cons* e, Cons* scope, MemPool& pool)
-{
-    auto closure = pool.intern_atom("closure");
-    if (closure == nullptr) return nullptr;
-    auto x = pool.alloc(scope, e->cdr);
-    if (x == nullptr) return nullptr;
-    return pool.alloc(closure, x);
-}
+static Cons* builtin_lambda(Cons* e, Cons* scope, MemPool& pool) { return make_closure(e->cdr, scope, pool); }
 
-static Cons* builtin_let(Cons* e, Cons* scope, MemPool& pool)
+// returns the frame to evaluate the body in; the body is in tail position
+static Cons* let_frame(Cons* e, Cons* scope, MemPool& pool)
 {
     // (let ((a b) (c d)) e)
 
@@ -99,29 +153,36 @@ static Cons* builtin_let(Cons* e, Cons* scope, MemPool& pool)
     if (!e->cdr->cdr->is_cons()) return nullptr;
     if (e->cdr->cdr->cdr != pool.nil()) return nullptr;
     auto pairs = e->cdr->car;
-    auto expr = e->cdr->cdr->car;
 
-    auto newscope = scope;
-    ScopedPin pin_scope(newscope, pool);
-    while (pairs->is_cons())
+    size_t count = 0;
+    for (auto p = pairs; p->is_cons(); p = p->cdr)
     {
-        auto pair = pairs->car;
+        auto pair = p->car;
         if (!pair->is_cons()) return nullptr;
         if (!pair->cdr->is_cons()) return nullptr;
         if (pair->cdr->cdr != pool.nil()) return nullptr;
-        auto ident = pair->car;
-        if (!ident->is_atom()) return nullptr;
-        auto ident_val = eval2(pair->cdr->car, newscope, pool);
+        if (!pair->car->is_atom()) return nullptr;
+        ++count;
+    }
+
+    // every binding lives in one frame; each value is evaluated with the bindings before it in place
+    auto frame = pool.alloc_block(Tag::Frame, count + 1, scope);
+    if (!frame) return nullptr;
+    ScopedPin pin_frame(frame, pool);
+    for (size_t i = 1; pairs->is_cons(); ++i, pairs = pairs->cdr)
+    {
+        auto ident_val = eval2(pairs->car->cdr->car, frame, pool);
         if (!ident_val) return nullptr;
-        auto scope_entry = pool.alloc(ident, ident_val);
-        if (!scope_entry) return nullptr;
-        newscope = pool.alloc(scope_entry, newscope);
-        if (!newscope) return nullptr;
-        pool.pop_push_root(newscope);
-        pairs = pairs->cdr;
+        pool.set_slot(frame, i, ident_val);
     }
     if (pairs != pool.nil()) return nullptr;
-    return eval2(expr, newscope, pool);
+    return frame;
+}
+
+static Cons* builtin_let(Cons* e, Cons* scope, MemPool& pool)
+{
+    auto frame = let_frame(e, scope, pool);
+    return frame ? eval2(e->cdr->cdr->car, frame, pool) : nullptr;
 }
 
 static Cons* builtin_quote(Cons* e, Cons*, MemPool& pool) { return single_arg(e->cdr, pool); }
@@ -139,125 +200,383 @@ static Cons* builtin_car_cdr_common(Cons* e, Cons* scope, MemPool& pool)
 static Cons* builtin_car(Cons* e, Cons* scope, MemPool& pool)
 {
     auto x = builtin_car_cdr_common(e, scope, pool);
-    return x ? x->car : nullptr;
+    if (!x) return nullptr;
+    return x->car;
 }
 
 static Cons* builtin_cdr(Cons* e, Cons* scope, MemPool& pool)
 {
     auto x = builtin_car_cdr_common(e, scope, pool);
-    return x ? x->cdr : nullptr;
+    if (!x) return nullptr;
+    return x->cdr;
 }
 
-// assume scope is pinned; e is not pinned
-static Cons* eval2(Cons* e, Cons* scope, MemPool& pool)
+// Binds the arguments of the application e in a new frame and returns it; the closure's body is in tail position.
+static Cons* apply_closure(Cons* func, Cons* e, Cons* scope, MemPool& pool)
 {
+    auto count = closure_arity(func);
+    // func itself is not pinned by the caller, and evaluating the arguments may collect it
+    ScopedPin pin_func(func, pool);
+    auto frame = pool.alloc_block(Tag::Frame, count + 1, closure_scope(func));
+    if (frame == nullptr) return nullptr;
+    ScopedPin pin_frame(frame, pool);
+
+    // bind
+    auto applylist = e->cdr;
+    for (size_t i = 1; i <= count; ++i, applylist = applylist->cdr)
+    {
+        if (!applylist->is_cons()) return nullptr;
+        auto ea = eval2(applylist->car, scope, pool);
+        if (ea == nullptr) return nullptr;
+        pool.set_slot(frame, i, ea);
+    }
+    if (applylist != pool.nil()) return nullptr;
+    return frame;
+}
+
+// variables, constants, and anything else that is not an application
+static Cons* eval_leaf(Cons* e, Cons* scope, MemPool& pool)
+{
+    if (is_immediate(e, Immediate::LocalRef)) return lookup_local(e, scope);
+    if (is_fixnum(e)) return e;
     if (e == pool.nil()) return e;
+    // vector literals evaluate to themselves
+    if (e->is_vector()) return e;
     if (e->is_atom())
     {
-        if (*e->atom == "t")
+        if (e == pool.symbols().t)
             return e;
         else
-        {
-            while (scope->is_cons())
-            {
-                if (!scope->car->is_cons()) return nullptr;
-                if (scope->car->car == e) return scope->car->cdr;
-                scope = scope->cdr;
-            }
-            return nullptr;
-        }
+            return lookup_free(e, scope);
     }
-    else if (e->is_cons())
-    {
-        ScopedPin pin(e, pool);
-        auto func = eval2(e->car, scope, pool);
-        if (func == nullptr) return nullptr;
+    return nullptr;
+}
 
-        if (func->is_builtin())
+// Neither e nor scope need to be pinned by the caller. Tail calls (the chosen cond case, a let body, a closure body)
+// replace e and scope and loop instead of recursing, so iteration written as recursion runs in constant C++ stack
+// and root stack.
+static Cons* eval2(Cons* e, Cons* scope, MemPool& pool)
+{
+    if (is_immediate(e) || !e->is_cons()) return eval_leaf(e, scope, pool);
+
+    ScopedPin pin(e, pool);
+    ScopedPin pin_scope(scope, pool);
+    ProfiledCall profiled(pool);
+    auto calls = pool.call_cache();
+    do
+    {
+        auto func = calls ? calls->find(e) : nullptr;
+        if (func == nullptr)
         {
-            return func->builtin(e, scope, pool);
+            func = eval2(e->car, scope, pool);
+            if (func == nullptr) return nullptr;
+            if (calls) calls->fill(e, scope, func);
         }
-        else if (!func->is_cons())
+
+        if (func->is_builtin())
         {
-            // only cons's can be function objects
-            return nullptr;
+            if (func->builtin == &builtin_cond)
+            {
+                e = cond_branch(e, scope, pool);
+            }
+            else if (func->builtin == &builtin_let)
+            {
+                auto frame = let_frame(e, scope, pool);
+                if (frame == nullptr) return nullptr;
+                e = e->cdr->cdr->car;
+                scope = frame;
+            }
+            else if (auto profiler = pool.profiler())
+            {
+                profiler->enter_builtin(func, e, pool);
+                auto v = func->builtin(e, scope, pool);
+                profiler->leave(pool);
+                return v;
+            }
+            else
+                return func->builtin(e, scope, pool);
         }
-        else if (func->car->is_atom("closure"))
+        else if (func->is_closure())
         {
-            // closure object:
-            // (closure (*scope*) (x y) (+ x y))
-
-            if (!func->cdr->is_cons()) return nullptr;
-            if (!func->cdr->cdr->is_cons()) return nullptr;
-            if (!func->cdr->cdr->cdr->is_cons()) return nullptr;
-            if (func->cdr->cdr->cdr->cdr != pool.nil()) return nullptr;
-            auto newscope = func->cdr->car;
-            auto arglist = func->cdr->cdr->car;
-            auto expr = func->cdr->cdr->cdr->car;
-            ScopedPin pin_func(func->cdr, pool);
-
-            auto applylist = e->cdr;
-            ScopedPin pin_newscope(newscope, pool);
-            do
-            {
-                if (applylist == pool.nil() && arglist == pool.nil())
-                {
-                    return eval2(expr, newscope, pool);
-                }
-                else if (!applylist->is_cons() || !arglist->is_cons())
-                {
-                    return nullptr;
-                }
-                else if (!arglist->car->is_atom())
-                {
-                    return nullptr;
-                }
-                else
-                {
-                    // bind
-                    auto ea = eval2(applylist->car, scope, pool);
-                    if (ea == nullptr) return nullptr;
-                    auto x = pool.alloc(arglist->car, ea);
-                    if (x == nullptr) return nullptr;
-                    newscope = pool.alloc(x, newscope);
-                    if (newscope == nullptr) return nullptr;
-                    // replace pinned scope with newer scope
-                    pool.pop_push_root(newscope);
-
-                    applylist = applylist->cdr;
-                    arglist = arglist->cdr;
-                }
-            } while (1);
+            auto frame = apply_closure(func, e, scope, pool);
+            if (frame == nullptr) return nullptr;
+            profiled.enter(closure_lambda(func));
+            e = closure_body(func);
+            scope = frame;
         }
-        return nullptr;
+        else
+            return nullptr;
+
+        if (e == nullptr) return nullptr;
+        if (is_immediate(e) || !e->is_cons()) return eval_leaf(e, scope, pool);
+        pin.set(e);
+        pin_scope.set(scope);
+    } while (true);
+}
+
+static Cons* builtin_add(Cons* e, Cons* scope, MemPool& pool)
+{
+    // (+ a b ...); fixnums are immediates, so nothing here allocates or needs pinning
+    int64_t sum = 0;
+    auto args = e->cdr;
+    for (; args->is_cons(); args = args->cdr)
+    {
+        auto x = eval2(args->car, scope, pool);
+        if (!is_fixnum(x)) return nullptr;
+        sum += fixnum_value(x);
+        if (!fixnum_in_range(sum)) return nullptr;
     }
-    else
-        return nullptr;
+    if (args != pool.nil()) return nullptr;
+    return make_fixnum(sum);
 }
 
-struct BuiltinCons
+static Cons* builtin_sub(Cons* e, Cons* scope, MemPool& pool)
 {
-    BuiltinCons(std::string&& name, BuiltinFunc func, Cons* prev_scope, MemPool& pool)
-        : builtin{.car = (Cons*)1, .builtin = func}
-        , scope_entry{pool.intern_atom(std::move(name)), &builtin}
-        , scope{&scope_entry, prev_scope}
+    // (- a) negates; (- a b ...) subtracts the rest from a
+    auto args = e->cdr;
+    if (!args->is_cons()) return nullptr;
+    auto x = eval2(args->car, scope, pool);
+    if (!is_fixnum(x)) return nullptr;
+    int64_t result = fixnum_value(x);
+    args = args->cdr;
+    if (args == pool.nil()) result = -result;
+    for (; args->is_cons(); args = args->cdr)
     {
+        x = eval2(args->car, scope, pool);
+        if (!is_fixnum(x)) return nullptr;
+        result -= fixnum_value(x);
+        if (!fixnum_in_range(result)) return nullptr;
     }
+    if (args != pool.nil()) return nullptr;
+    if (!fixnum_in_range(result)) return nullptr;
+    return make_fixnum(result);
+}
 
-    Cons builtin;
-    Cons scope_entry;
-    Cons scope;
-};
+static Cons* builtin_mul(Cons* e, Cons* scope, MemPool& pool)
+{
+    // (* a b ...)
+    int64_t product = 1;
+    auto args = e->cdr;
+    for (; args->is_cons(); args = args->cdr)
+    {
+        auto x = eval2(args->car, scope, pool);
+        if (!is_fixnum(x)) return nullptr;
+        if (!fixnum_mul(product, fixnum_value(x), product)) return nullptr;
+    }
+    if (args != pool.nil()) return nullptr;
+    return make_fixnum(product);
+}
+
+static bool eval_fixnum_pair(Cons* e, Cons* scope, MemPool& pool, int64_t& a, int64_t& b)
+{
+    if (!e->cdr->is_cons()) return false;
+    if (!e->cdr->cdr->is_cons()) return false;
+    if (e->cdr->cdr->cdr != pool.nil()) return false;
+    auto x = eval2(e->cdr->car, scope, pool);
+    if (!is_fixnum(x)) return false;
+    auto y = eval2(e->cdr->cdr->car, scope, pool);
+    if (!is_fixnum(y)) return false;
+    a = fixnum_value(x);
+    b = fixnum_value(y);
+    return true;
+}
+
+static Cons* builtin_lt(Cons* e, Cons* scope, MemPool& pool)
+{
+    int64_t a, b;
+    if (!eval_fixnum_pair(e, scope, pool, a, b)) return nullptr;
+    return a < b ? pool.symbols().t : pool.nil();
+}
+
+static Cons* builtin_gt(Cons* e, Cons* scope, MemPool& pool)
+{
+    int64_t a, b;
+    if (!eval_fixnum_pair(e, scope, pool, a, b)) return nullptr;
+    return a > b ? pool.symbols().t : pool.nil();
+}
+
+static Cons* builtin_num_eq(Cons* e, Cons* scope, MemPool& pool)
+{
+    int64_t a, b;
+    if (!eval_fixnum_pair(e, scope, pool, a, b)) return nullptr;
+    return a == b ? pool.symbols().t : pool.nil();
+}
+
+static Cons* builtin_make_vector(Cons* e, Cons* scope, MemPool& pool)
+{
+    // (make-vector n) or (make-vector n fill); the elements start as fill, or nil
+    auto args = e->cdr;
+    if (!args->is_cons()) return nullptr;
+    auto rest = args->cdr;
+    if (rest != pool.nil() && (!rest->is_cons() || rest->cdr != pool.nil())) return nullptr;
+    auto n = eval2(args->car, scope, pool);
+    if (!is_fixnum(n) || fixnum_value(n) < 0 || fixnum_value(n) > max_vector_length) return nullptr;
+    auto fill = pool.nil();
+    if (rest != pool.nil())
+    {
+        fill = eval2(rest->car, scope, pool);
+        if (fill == nullptr) return nullptr;
+    }
+    // alloc_block keeps fill alive, and marks it if a collection is under way, so it needs no barrier after
+    auto slots = static_cast<size_t>(fixnum_value(n));
+    auto v = pool.alloc_block(Tag::Vector, slots, fill);
+    if (v == nullptr) return nullptr;
+    for (size_t i = 1; i < slots; ++i)
+        v->slot(i) = fill;
+    return v;
+}
+
+// evaluates the vector and index that start args, returning the vector and setting i to the slot the index names
+static Cons* eval_vector_index(Cons* args, Cons* scope, MemPool& pool, size_t& i)
+{
+    auto v = eval2(args->car, scope, pool);
+    if (v == nullptr) return nullptr;
+    pool.push_root(v);
+    auto k = eval2(args->cdr->car, scope, pool);
+    pool.pop_root();
+    if (k == nullptr || !vector_index(v, k, i)) return nullptr;
+    return v;
+}
+
+static Cons* builtin_vector_ref(Cons* e, Cons* scope, MemPool& pool)
+{
+    // (vector-ref v i)
+    if (!e->cdr->is_cons()) return nullptr;
+    if (!e->cdr->cdr->is_cons()) return nullptr;
+    if (e->cdr->cdr->cdr != pool.nil()) return nullptr;
+    size_t i;
+    auto v = eval_vector_index(e->cdr, scope, pool, i);
+    if (v == nullptr) return nullptr;
+    return v->slot(i);
+}
+
+static Cons* builtin_vector_set(Cons* e, Cons* scope, MemPool& pool)
+{
+    // (vector-set! v i x) stores x in slot i of v, and returns x
+    if (!e->cdr->is_cons()) return nullptr;
+    if (!e->cdr->cdr->is_cons()) return nullptr;
+    if (!e->cdr->cdr->cdr->is_cons()) return nullptr;
+    if (e->cdr->cdr->cdr->cdr != pool.nil()) return nullptr;
+    size_t i;
+    auto v = eval_vector_index(e->cdr, scope, pool, i);
+    if (v == nullptr) return nullptr;
+    ScopedPin pin(v, pool);
+    auto x = eval2(e->cdr->cdr->cdr->car, scope, pool);
+    if (x == nullptr) return nullptr;
+    pool.set_slot(v, i, x);
+    return x;
+}
+
+static Cons* builtin_vector_length(Cons* e, Cons* scope, MemPool& pool)
+{
+    if (!e->cdr->is_cons()) return nullptr;
+    if (e->cdr->cdr != pool.nil()) return nullptr;
+    auto v = eval2(e->cdr->car, scope, pool);
+    if (v == nullptr || !v->is_vector()) return nullptr;
+    return make_fixnum(static_cast<int64_t>(v->block_size));
+}
+
+static Cons* builtin_define(Cons* e, Cons* scope, MemPool& pool)
+{
+    // (define name e)
+    // binds name in the global scope, even when evaluated inside a closure or let
+
+    if (!e->cdr->is_cons()) return nullptr;
+    if (!e->cdr->cdr->is_cons()) return nullptr;
+    if (e->cdr->cdr->cdr != pool.nil()) return nullptr;
+    auto name = e->cdr->car;
+    if (is_immediate(name) || !name->is_atom()) return nullptr;
+    if (name == pool.nil() || name == pool.symbols().t) return nullptr;
+    // the resolver and the compiler treat the builtins and special forms as fixed, so their names cannot be rebound
+    if (find_builtin(name, pool) != nullptr) return nullptr;
 
-Cons* rlisp::eval(Cons* e, MemPool& pool)
-{
-    BuiltinCons l1("cond", &builtin_cond, pool.nil(), pool);
-    BuiltinCons l2("lambda", &builtin_lambda, &l1.scope, pool);
-    BuiltinCons l3("eq", &builtin_eq, &l2.scope, pool);
-    BuiltinCons l4("cons", &builtin_cons, &l3.scope, pool);
-    BuiltinCons l5("car", &builtin_car, &l4.scope, pool);
-    BuiltinCons l6("cdr", &builtin_cdr, &l5.scope, pool);
-    BuiltinCons l7("quote", &builtin_quote, &l6.scope, pool);
-    BuiltinCons l8("let", &builtin_let, &l7.scope, pool);
-    return eval2(e, &l8.scope, pool);
+    auto globals = global_env(scope);
+    if (globals == nullptr) return nullptr;
+    auto value = eval2(e->cdr->cdr->car, scope, pool);
+    if (value == nullptr) return nullptr;
+    if (!globals->define(name, value)) return nullptr;
+    if (auto profiler = pool.profiler()) profiler->name(value, name);
+    return name;
+}
+
+namespace
+{
+    struct BuiltinDef
+    {
+        Cons* Symbols::*name;
+        BuiltinFunc func;
+    };
+
+    // every builtin define_builtins registers, and the symbol it is bound to
+    constexpr BuiltinDef builtin_defs[] = {
+        {&Symbols::cond, &builtin_cond},
+        {&Symbols::lambda, &builtin_lambda},
+        {&Symbols::eq, &builtin_eq},
+        {&Symbols::cons, &builtin_cons},
+        {&Symbols::car, &builtin_car},
+        {&Symbols::cdr, &builtin_cdr},
+        {&Symbols::quote, &builtin_quote},
+        {&Symbols::let, &builtin_let},
+        {&Symbols::define, &builtin_define},
+        {&Symbols::add, &builtin_add},
+        {&Symbols::sub, &builtin_sub},
+        {&Symbols::mul, &builtin_mul},
+        {&Symbols::lt, &builtin_lt},
+        {&Symbols::gt, &builtin_gt},
+        {&Symbols::num_eq, &builtin_num_eq},
+        {&Symbols::make_vector, &builtin_make_vector},
+        {&Symbols::vector_ref, &builtin_vector_ref},
+        {&Symbols::vector_set, &builtin_vector_set},
+        {&Symbols::vector_length, &builtin_vector_length},
+    };
+}
+
+bool rlisp::define_builtins(GlobalEnv& globals, MemPool& pool)
+{
+    auto& syms = pool.symbols();
+    for (auto&& def : builtin_defs)
+    {
+        if (!globals.define_builtin(syms.*def.name, def.func)) return false;
+    }
+    return true;
+}
+
+Cons* rlisp::builtin_name(BuiltinFunc func, MemPool& pool)
+{
+    for (auto&& def : builtin_defs)
+    {
+        if (def.func == func) return pool.symbols().*def.name;
+    }
+    return nullptr;
+}
+
+BuiltinFunc rlisp::find_builtin(Cons* name, MemPool& pool)
+{
+    for (auto&& def : builtin_defs)
+    {
+        if (pool.symbols().*def.name == name) return def.func;
+    }
+    return nullptr;
+}
+
+Cons* rlisp::eval(Cons* e, GlobalEnv& globals, MemPool& pool, Engine engine)
+{
+    auto code = resolve(e, pool);
+    if (code == nullptr) return nullptr;
+    ScopedPin pin_code(code, pool);
+    ScopedCallCache calls(&globals.calls(), pool);
+
+    if (engine == Engine::Bytecode) return run_bytecode(code, globals.scope(), pool);
+    return eval2(code, globals.scope(), pool);
+}
+
+Cons* rlisp::eval(Cons* e, MemPool& pool, Engine engine)
+{
+    ScopedPin pin(e, pool);
+    GlobalEnv globals(pool);
+    if (!define_builtins(globals, pool)) return nullptr;
+    auto v = eval(e, globals, pool, engine);
+    // a closure or builtin would refer to globals once it is gone
+    if (v != nullptr && (v->is_closure() || v->is_builtin())) return nullptr;
+    return v;
 }
@@ -1,9 +1,29 @@
 #pragma once
 
+#include "cons.h"
+
 namespace rlisp
 {
-    struct Cons;
+    struct GlobalEnv;
     struct MemPool;
 
-    Cons* eval(Cons* expr, MemPool& pool);
+    enum class Engine
+    {
+        TreeWalker,
+        // compiles to bytecode for a stack machine (see bytecode.h)
+        Bytecode,
+    };
+
+    // Evaluates expr against a global scope holding only the builtins, built for this call. Fails if the value is a
+    // closure or builtin, which would outlive that scope; any held inside the value must not be applied.
+    Cons* eval(Cons* expr, MemPool& pool, Engine engine = Engine::TreeWalker);
+    // evaluates expr against globals, which define forms add to
+    Cons* eval(Cons* expr, GlobalEnv& globals, MemPool& pool, Engine engine = Engine::TreeWalker);
+
+    // registers the special forms and primitives; returns false if the pool is out of memory
+    bool define_builtins(GlobalEnv& globals, MemPool& pool);
+    // The atom define_builtins binds func to, and the builtin it binds to the atom name; nullptr for anything else.
+    // A builtin keeps its name even where the global has been redefined.
+    Cons* builtin_name(BuiltinFunc func, MemPool& pool);
+    BuiltinFunc find_builtin(Cons* name, MemPool& pool);
 }
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "executor.h"
+
+#include "copy.h"
+#include "mempool.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+using namespace rlisp;
+
+namespace
+{
+    // The jobs a worker has left. The owner takes from the front so that its jobs run in order; thieves take from
+    // the back, where they are least likely to contend with the owner.
+    struct JobQueue
+    {
+        bool pop_front(size_t& job)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (jobs.empty()) return false;
+            job = jobs.front();
+            jobs.pop_front();
+            return true;
+        }
+
+        bool pop_back(size_t& job)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (jobs.empty()) return false;
+            job = jobs.back();
+            jobs.pop_back();
+            return true;
+        }
+
+        std::mutex mutex;
+        std::deque<size_t> jobs;
+    };
+}
+
+// Takes the next job from the worker's own queue, or steals one. No job adds jobs, so once every queue has been found
+// empty there is nothing left to do.
+static bool next_job(std::vector<JobQueue>& queues, size_t worker, size_t& job)
+{
+    if (queues[worker].pop_front(job)) return true;
+    for (size_t i = 1; i < queues.size(); ++i)
+    {
+        if (queues[(worker + i) % queues.size()].pop_back(job)) return true;
+    }
+    return false;
+}
+
+Executor::Executor(SymbolTable& atoms, size_t threads, const MemPoolConfig& config)
+{
+    for (size_t i = 0; i < std::max<size_t>(1, threads); ++i)
+        m_isolates.push_back(std::make_unique<Interpreter>(atoms, config));
+}
+
+Executor::~Executor() = default;
+
+std::vector<Cons*> Executor::eval_all(const std::vector<Cons*>& exprs, MemPool& pool, Engine engine)
+{
+    auto workers = std::min(m_isolates.size(), std::max<size_t>(1, exprs.size()));
+    std::vector<JobQueue> queues(workers);
+    for (size_t i = 0; i < exprs.size(); ++i)
+        queues[i * workers / exprs.size()].jobs.push_back(i);
+
+    // each value stays in its isolate's root stack until it has been copied out
+    std::vector<Cons*> values(exprs.size());
+    std::vector<size_t> bases(workers);
+    auto work = [&](size_t worker) {
+        auto& interp = *m_isolates[worker];
+        auto& ipool = interp.pool();
+        bases[worker] = ipool.num_roots();
+        size_t job = 0;
+        while (next_job(queues, worker, job))
+        {
+            auto e = copy_value(exprs[job], ipool);
+            auto value = e ? interp.eval(e, engine) : nullptr;
+            ipool.push_root(value ? value : ipool.nil());
+            values[job] = value;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t worker = 1; worker < workers; ++worker)
+        threads.emplace_back(work, worker);
+    work(0);
+    for (auto&& t : threads)
+        t.join();
+
+    // copying into pool may collect it, so the values copied so far are kept on its root stack until the end
+    auto base = pool.num_roots();
+    for (auto&& value : values)
+    {
+        if (value) value = copy_value(value, pool);
+        pool.push_root(value ? value : pool.nil());
+    }
+    pool.truncate_roots(base);
+    for (size_t worker = 0; worker < workers; ++worker)
+        m_isolates[worker]->pool().truncate_roots(bases[worker]);
+    return values;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "eval.h"
+#include "interpreter.h"
+
+namespace rlisp
+{
+    struct Cons;
+    struct MemPool;
+    struct SymbolTable;
+
+    // Evaluates independent expressions in parallel. Each worker owns an isolate: an Interpreter with its own heap,
+    // root stack and global scope, interning atoms in a shared SymbolTable so that atoms compare by pointer across
+    // isolates. Nothing else is shared, so expressions are copied into an isolate before they are evaluated and their
+    // values are copied back out (see copy_value), and a define in one job is only seen by later jobs that happen to
+    // run on the same isolate.
+    struct Executor
+    {
+        Executor(SymbolTable& atoms, size_t threads, const MemPoolConfig& config = MemPoolConfig());
+        ~Executor();
+
+        Executor(const Executor&) = delete;
+        Executor& operator=(const Executor&) = delete;
+
+        // Evaluates every expression and copies the values into pool, which must intern atoms in the executor's table
+        // and must not be used by another thread until this returns. A value is nullptr if evaluation failed or the
+        // value cannot be copied, such as a closure. Like eval's result, the values are not rooted. Jobs are dealt out
+        // to the workers in contiguous runs, and a worker that runs out steals from the back of another's run.
+        std::vector<Cons*> eval_all(const std::vector<Cons*>& exprs,
+                                    MemPool& pool,
+                                    Engine engine = Engine::TreeWalker);
+
+        size_t threads() const { return m_isolates.size(); }
+        Interpreter& isolate(size_t i) { return *m_isolates[i]; }
+
+    private:
+        std::vector<std::unique_ptr<Interpreter>> m_isolates;
+    };
+}
@@ -0,0 +1,78 @@
+#include "globals.h"
+
+#include <new>
+
+using namespace rlisp;
+
+GlobalEnv::GlobalEnv(MemPool& pool) : m_pool(pool), m_root(pool.num_roots())
+{
+    auto memory = m_cells.allocate(sizeof(ScopeRecord), alignof(ScopeRecord));
+    if (!memory) throw std::bad_alloc();
+    auto record = new (memory) ScopeRecord;
+    record->env = this;
+    record->cell.set_tag(Tag::Globals);
+#if defined(RLISP_COMPACT_CELLS)
+    record->cell.globals = &record->env;
+#else
+    record->cell.globals = this;
+#endif
+    m_scope = &record->cell;
+    pool.push_root(pool.nil());
+    m_index.resize(32);
+}
+
+GlobalEnv::~GlobalEnv() { m_pool.pop_root(); }
+
+void GlobalEnv::rehash()
+{
+    std::vector<Entry> old(m_index.size() * 2);
+    old.swap(m_index);
+    for (auto&& entry : old)
+    {
+        if (entry.name != nullptr) m_index[find(entry.name)] = entry;
+    }
+}
+
+bool GlobalEnv::define(Cons* name, Cons* value)
+{
+    auto& entry = m_index[find(name)];
+    if (entry.name != nullptr)
+    {
+        // only rebinding changes what a call site may have cached
+        m_calls.invalidate();
+        m_pool.set_slot(values(), entry.slot, value);
+        return true;
+    }
+
+    auto slot = m_size;
+    auto old = values();
+    if (old == m_pool.nil() || slot == old->block_size)
+    {
+        // grow geometrically so that a run of defines is linear overall
+        m_pool.push_root(value);
+        auto grown = m_pool.alloc_block(Tag::GlobalValues, slot < 8 ? 16 : slot * 2, m_pool.nil());
+        m_pool.pop_root();
+        if (!grown) return false;
+        old = values();
+        for (size_t i = 0; i < slot; ++i)
+            grown->slot(i) = old->slot(i);
+        m_pool.set_root(m_root, grown);
+    }
+    m_pool.set_slot(values(), slot, value);
+    entry = {name, slot};
+    m_names.push_back(name);
+    ++m_size;
+    // keep the table at most half full so probe sequences stay short
+    if (m_size * 2 > m_index.size()) rehash();
+    return true;
+}
+
+bool GlobalEnv::define_builtin(Cons* name, BuiltinFunc func)
+{
+    auto memory = m_cells.allocate(sizeof(Cons), alignof(Cons));
+    if (!memory) return false;
+    auto cell = new (memory) Cons;
+    cell->set_tag(Tag::Builtin);
+    cell->builtin = func;
+    return define(name, cell);
+}
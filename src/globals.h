@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "callcache.h"
+#include "cellspace.h"
+#include "cons.h"
+#include "mempool.h"
+
+namespace rlisp
+{
+    // The global scope: every name bound by define or registered as a builtin. Names are found through a hash index
+    // rather than by walking a list, and the values live in a heap block kept in a root slot so the collector sees
+    // them. The root slot is pushed on construction and popped on destruction, so a GlobalEnv must be destroyed in
+    // stack order with any other roots.
+    struct GlobalEnv
+    {
+        explicit GlobalEnv(MemPool& pool);
+        ~GlobalEnv();
+
+        GlobalEnv(const GlobalEnv&) = delete;
+        GlobalEnv& operator=(const GlobalEnv&) = delete;
+
+        // the cell that ends every scope chain evaluated against this environment
+        Cons* scope() { return m_scope; }
+
+        // returns nullptr if name is unbound
+        Cons* lookup(Cons* name) const
+        {
+            auto i = find(name);
+            if (m_index[i].name == nullptr) return nullptr;
+            return values()->slot(m_index[i].slot);
+        }
+
+        // binds or rebinds name; returns false if the pool is out of memory
+        bool define(Cons* name, Cons* value);
+        bool define_builtin(Cons* name, BuiltinFunc func);
+
+        // the call site caches for code evaluated in this scope; see MemPool::set_call_cache
+        CallCache& calls() { return m_calls; }
+
+        size_t size() const { return m_size; }
+        // the bindings by slot, in the order they were first defined
+        Cons* name_at(size_t slot) const { return m_names[slot]; }
+        Cons* value_at(size_t slot) const { return values()->slot(slot); }
+
+    private:
+        struct Entry
+        {
+            // nullptr marks an empty entry
+            Cons* name;
+            size_t slot;
+        };
+
+        Cons* values() const { return m_pool.root(m_root); }
+        // Open addressing with linear probing over a power of two sized table. Names are interned, so they hash and
+        // compare by address. Returns the entry for name, or the empty entry where it would be inserted.
+        size_t find(Cons* name) const
+        {
+            auto mask = m_index.size() - 1;
+            auto i = static_cast<size_t>((reinterpret_cast<uintptr_t>(name) >> 4) * 0x9E3779B97F4A7C15ull) & mask;
+            while (m_index[i].name != nullptr && m_index[i].name != name)
+                i = (i + 1) & mask;
+            return i;
+        }
+        void rehash();
+
+        // the scope cell, followed by this GlobalEnv's address for compact cells to refer to
+        struct ScopeRecord
+        {
+            Cons cell;
+            GlobalEnv* env;
+        };
+
+        MemPool& m_pool;
+        size_t m_root;
+        // the scope and builtin cells live outside the heap, at stable addresses
+        CellArena m_cells;
+        Cons* m_scope;
+        std::vector<Entry> m_index;
+        std::vector<Cons*> m_names;
+        size_t m_size = 0;
+        CallCache m_calls{this};
+    };
+}
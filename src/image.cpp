@@ -0,0 +1,438 @@
+#include "image.h"
+
+#include "cons.h"
+#include "eval.h"
+#include "globals.h"
+#include "mappedfile.h"
+#include "mempool.h"
+#include "scope.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unordered_map>
+#include <vector>
+
+using namespace rlisp;
+
+namespace
+{
+    constexpr char image_magic[8] = {'r', 'l', 'i', 's', 'p', 'i', 'm', 'g'};
+    constexpr uint32_t image_version = 1;
+    // written in the byte order of the saving machine, so that an image from one with the other order is rejected
+    constexpr uint32_t image_byte_order = 0x01020304;
+
+    // The file is this header, then:
+    //   atoms     one word per atom: the offset of its name in the names, with the name's size in the upper 32 bits
+    //   names     the bytes of every name, padded to a multiple of 8
+    //   cells     two words per cell, car then cdr
+    //   bindings  two words per binding, the name then the value
+    // Every word is a uint64_t. Apart from the atoms and a block header's size, each holds a WordKind in its low
+    // three bits and the payload above them.
+    struct ImageHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t atoms;
+        uint64_t name_bytes;
+        uint64_t cells;
+        uint64_t bindings;
+    };
+
+    enum class WordKind : uint64_t
+    {
+        // the index of a pair or block header in the cells
+        Cell = 0,
+        // a fixnum's value
+        Fixnum = 1,
+        // a local reference's depth in the upper 32 bits of the payload, and its index in the lower
+        LocalRef = 2,
+        // the index of an atom
+        Atom = 3,
+        // the index of the atom naming a builtin; see builtin_name
+        Builtin = 4,
+        // the global scope the image is loaded into
+        Globals = 5,
+        // in car only, the header of a block with the Tag in the payload; the cdr is the number of slots as it is
+        Header = 6,
+    };
+    constexpr int kind_bits = 3;
+    constexpr uint64_t kind_mask = 7;
+
+    uint64_t make_word(WordKind kind, uint64_t payload) { return (payload << kind_bits) | static_cast<uint64_t>(kind); }
+    WordKind word_kind(uint64_t word) { return static_cast<WordKind>(word & kind_mask); }
+
+    bool is_block_tag(uint64_t tag)
+    {
+        return tag == static_cast<uint64_t>(Tag::Frame) || tag == static_cast<uint64_t>(Tag::GlobalValues) ||
+               tag == static_cast<uint64_t>(Tag::Closure) || tag == static_cast<uint64_t>(Tag::Vector);
+    }
+
+    struct ImageWriter
+    {
+        explicit ImageWriter(MemPool& pool) : pool(pool) { }
+
+        // numbers the cells and atoms reachable from value
+        bool add(Cons* value);
+        uint64_t word(Cons* value) const;
+        std::string write(const GlobalEnv& globals) const;
+
+        MemPool& pool;
+        std::string error;
+
+    private:
+        uint64_t atom(Cons* a)
+        {
+            auto [it, inserted] = atom_index.try_emplace(a, atoms.size());
+            if (inserted) atoms.push_back(a);
+            return it->second;
+        }
+
+        // pairs and block headers in the order they are laid out, and the index of each
+        std::vector<Cons*> cells;
+        std::unordered_map<Cons*, uint64_t> cell_index;
+        uint64_t num_cells = 0;
+        std::vector<Cons*> atoms;
+        std::unordered_map<Cons*, uint64_t> atom_index;
+    };
+}
+
+// Walks with an explicit stack, so neither long nor deeply nested values recurse.
+bool ImageWriter::add(Cons* value)
+{
+    std::vector<Cons*> pending{value};
+    while (!pending.empty())
+    {
+        auto v = pending.back();
+        pending.pop_back();
+        if (is_immediate(v) || v->is_globals()) continue;
+        if (v->is_atom())
+        {
+            atom(v);
+            continue;
+        }
+        if (v->is_builtin())
+        {
+            auto name = builtin_name(v->builtin, pool);
+            if (!name)
+            {
+                error = "a value holds a builtin that cannot be saved";
+                return false;
+            }
+            atom(name);
+            continue;
+        }
+
+        auto [it, inserted] = cell_index.try_emplace(v, num_cells);
+        if (!inserted) continue;
+        cells.push_back(v);
+        if (v->is_block())
+        {
+            num_cells += Cons::block_cells(v->block_size);
+            for (size_t i = 0; i < v->block_size; ++i)
+                pending.push_back(v->slot(i));
+        }
+        else
+        {
+            ++num_cells;
+            pending.push_back(v->cdr);
+            pending.push_back(v->car);
+        }
+    }
+    return true;
+}
+
+// the writing side of make_word, for every value a cell can hold
+uint64_t ImageWriter::word(Cons* v) const
+{
+    if (is_fixnum(v)) return make_word(WordKind::Fixnum, static_cast<uint64_t>(fixnum_value(v)));
+    if (is_immediate(v))
+    {
+        auto ref = local_ref(v);
+        return make_word(WordKind::LocalRef, (static_cast<uint64_t>(ref.depth) << 32) | ref.index);
+    }
+    if (v->is_atom()) return make_word(WordKind::Atom, atom_index.at(v));
+    if (v->is_builtin()) return make_word(WordKind::Builtin, atom_index.at(builtin_name(v->builtin, pool)));
+    if (v->is_globals()) return make_word(WordKind::Globals, 0);
+    return make_word(WordKind::Cell, cell_index.at(v));
+}
+
+std::string ImageWriter::write(const GlobalEnv& globals) const
+{
+    std::string names;
+    for (auto a : atoms)
+        names += a->atom->view();
+    names.resize((names.size() + 7) & ~size_t(7));
+
+    std::string out;
+    auto put = [&out](uint64_t word) { out.append(reinterpret_cast<const char*>(&word), sizeof(word)); };
+
+    ImageHeader header;
+    memcpy(header.magic, image_magic, sizeof(header.magic));
+    header.version = image_version;
+    header.byte_order = image_byte_order;
+    header.atoms = atoms.size();
+    header.name_bytes = names.size();
+    header.cells = num_cells;
+    header.bindings = globals.size();
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    uint64_t offset = 0;
+    for (auto a : atoms)
+    {
+        auto size = static_cast<uint64_t>(a->atom->size);
+        put((size << 32) | offset);
+        offset += size;
+    }
+    out += names;
+
+    auto nil = word(pool.nil());
+    for (auto c : cells)
+    {
+        if (!c->is_block())
+        {
+            put(word(c->car));
+            put(word(c->cdr));
+            continue;
+        }
+        put(make_word(WordKind::Header, static_cast<uint64_t>(c->tag())));
+        put(c->block_size);
+        // the slots fill the cells after the header, and nil pads the last one out
+        for (size_t i = 0; i < Cons::block_cells(c->block_size) * 2 - 2; ++i)
+            put(i < c->block_size ? word(c->slot(i)) : nil);
+    }
+
+    for (size_t i = 0; i < globals.size(); ++i)
+    {
+        put(word(globals.name_at(i)));
+        put(word(globals.value_at(i)));
+    }
+    return out;
+}
+
+bool rlisp::save_image(const std::string& path, const GlobalEnv& globals, MemPool& pool, std::string& error)
+{
+    ImageWriter writer(pool);
+    // nil pads blocks, so it is always in the atoms
+    writer.add(pool.nil());
+    for (size_t i = 0; i < globals.size(); ++i)
+    {
+        if (!writer.add(globals.name_at(i)) || !writer.add(globals.value_at(i)))
+        {
+            error = "could not save " + path + ": " + writer.error;
+            return false;
+        }
+    }
+    auto image = writer.write(globals);
+
+    auto f = fopen(path.c_str(), "wb");
+    bool ok = f != nullptr;
+    if (ok) ok = fwrite(image.data(), 1, image.size(), f) == image.size();
+    if (f) ok = fclose(f) == 0 && ok;
+    if (!ok) error = "could not write " + path;
+    return ok;
+}
+
+namespace
+{
+    struct ImageReader
+    {
+        ImageReader(GlobalEnv& globals, MemPool& pool) : globals(globals), pool(pool) { }
+
+        // returns nullptr if word is not a valid value
+        Cons* value(uint64_t word);
+
+        GlobalEnv& globals;
+        MemPool& pool;
+        std::vector<Cons*> atoms;
+        // the image's cells, and which of them start a pair or block
+        Cons* cells = nullptr;
+        std::vector<bool> starts;
+        // by atom index, found in globals the first time each is needed
+        std::vector<Cons*> builtins;
+    };
+
+    Cons* ImageReader::value(uint64_t word)
+    {
+        auto payload = word >> kind_bits;
+        switch (word_kind(word))
+        {
+            case WordKind::Cell:
+                if (payload >= starts.size() || !starts[payload]) return nullptr;
+                return &cells[payload];
+            case WordKind::Fixnum:
+            {
+                auto v = static_cast<int64_t>(word) >> kind_bits;
+                if (!fixnum_in_range(v)) return nullptr;
+                return make_fixnum(v);
+            }
+            case WordKind::LocalRef:
+            {
+                auto depth = payload >> 32;
+                auto index = payload & 0xFFFFFFFF;
+                if (depth > max_local_depth || index > max_local_index) return nullptr;
+                return make_local_ref(depth, index);
+            }
+            case WordKind::Atom:
+                if (payload >= atoms.size()) return nullptr;
+                return atoms[payload];
+            case WordKind::Builtin:
+            {
+                if (payload >= atoms.size()) return nullptr;
+                auto& cell = builtins[payload];
+                if (cell) return cell;
+                auto func = find_builtin(atoms[payload], pool);
+                if (!func) return nullptr;
+                // the builtin cells belong to the GlobalEnv, so use the one bound there
+                for (size_t i = 0; i < globals.size() && !cell; ++i)
+                {
+                    auto v = globals.value_at(i);
+                    if (!is_immediate(v) && v->is_builtin() && static_cast<BuiltinFunc>(v->builtin) == func) cell = v;
+                }
+                return cell;
+            }
+            case WordKind::Globals: return globals.scope();
+            default: return nullptr;
+        }
+    }
+}
+
+bool rlisp::load_image(const std::string& path, GlobalEnv& globals, MemPool& pool, std::string& error)
+{
+    MappedFile file;
+    if (!file.open(path, error)) return false;
+    auto invalid = [&](const char* why) {
+        error = path + " is not a valid image: " + why;
+        return false;
+    };
+
+    ImageHeader header;
+    if (file.size() < sizeof(header) || file.size() % 8 != 0) return invalid("its size is wrong");
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, image_magic, sizeof(header.magic)) != 0) return invalid("it has no image header");
+    if (header.version != image_version || header.byte_order != image_byte_order)
+        return invalid("it was saved by another version or on another kind of machine");
+
+    // the counts are checked one at a time against what is left, so that none of the sizes can overflow
+    uint64_t remaining = (file.size() - sizeof(header)) / 8;
+    auto take = [&remaining](uint64_t words) {
+        if (words > remaining) return false;
+        remaining -= words;
+        return true;
+    };
+    if (header.name_bytes % 8 != 0 || !take(header.atoms) || !take(header.name_bytes / 8) ||
+        header.cells > remaining / 2 || !take(header.cells * 2) || header.bindings > remaining / 2 ||
+        !take(header.bindings * 2) || remaining != 0)
+        return invalid("its sections do not match its size");
+
+    // a mapping is page aligned, and every section is a whole number of words
+    auto atom_words = reinterpret_cast<const uint64_t*>(file.data() + sizeof(header));
+    auto names = reinterpret_cast<const char*>(atom_words + header.atoms);
+    auto cell_words = atom_words + header.atoms + header.name_bytes / 8;
+    auto binding_words = cell_words + header.cells * 2;
+
+    ImageReader reader(globals, pool);
+    reader.atoms.reserve(header.atoms);
+    for (uint64_t i = 0; i < header.atoms; ++i)
+    {
+        auto offset = atom_words[i] & 0xFFFFFFFF;
+        auto size = atom_words[i] >> 32;
+        if (offset > header.name_bytes || size > header.name_bytes - offset) return invalid("an atom is out of range");
+        reader.atoms.push_back(pool.intern_atom({names + offset, static_cast<size_t>(size)}));
+    }
+    reader.builtins.resize(header.atoms);
+
+    // find where each pair and block starts, so that references into the middle of a block are caught
+    reader.starts.resize(header.cells);
+    for (uint64_t i = 0; i < header.cells;)
+    {
+        reader.starts[i] = true;
+        auto car = cell_words[i * 2];
+        if (word_kind(car) != WordKind::Header)
+        {
+            ++i;
+            continue;
+        }
+        auto slots = cell_words[i * 2 + 1];
+        // only a vector may have no slots, and the slots must fit in the cells after the header
+        auto is_vector = car >> kind_bits == static_cast<uint64_t>(Tag::Vector);
+        if (!is_block_tag(car >> kind_bits) || (slots == 0 && !is_vector) ||
+            (is_vector && slots > static_cast<uint64_t>(max_vector_length)) ||
+            static_cast<BlockSize>(slots) != slots || slots > 2 * (header.cells - i - 1))
+            return invalid("a block is out of range");
+        // applying a closure trusts its arity, the cdr of its third cell
+        if (car >> kind_bits == static_cast<uint64_t>(Tag::Closure) &&
+            (slots != closure_slots || word_kind(cell_words[i * 2 + 5]) != WordKind::Fixnum ||
+             static_cast<int64_t>(cell_words[i * 2 + 5]) < 0))
+            return invalid("a closure is malformed");
+        i += Cons::block_cells(static_cast<size_t>(slots));
+    }
+
+    if (header.cells != 0)
+    {
+        reader.cells = pool.alloc_segment(static_cast<size_t>(header.cells));
+        if (!reader.cells)
+        {
+            error = "out of memory loading " + path;
+            return false;
+        }
+    }
+
+    // Relocate in one pass. The segment is in use as soon as it is allocated, so if a word turns out to be invalid
+    // every cell is made a pair of nils instead, for the collector to free.
+    auto cells = reader.cells;
+    bool ok = true;
+    for (uint64_t i = 0; i < header.cells && ok; ++i)
+    {
+        auto car = cell_words[i * 2];
+        auto cdr = cell_words[i * 2 + 1];
+        if (reader.starts[i] && word_kind(car) == WordKind::Header)
+        {
+            cells[i].set_tag(static_cast<Tag>(car >> kind_bits));
+            cells[i].block_size = static_cast<BlockSize>(cdr);
+            continue;
+        }
+        auto a = reader.value(car);
+        auto b = reader.value(cdr);
+        ok = a && b;
+        if (!ok) break;
+        cells[i].car = a;
+        cells[i].cdr = b;
+    }
+
+    std::vector<std::pair<Cons*, Cons*>> bindings;
+    bindings.reserve(header.bindings);
+    for (uint64_t i = 0; i < header.bindings && ok; ++i)
+    {
+        auto name = reader.value(binding_words[i * 2]);
+        auto value = reader.value(binding_words[i * 2 + 1]);
+        ok = name && value && word_kind(binding_words[i * 2]) == WordKind::Atom && name != pool.nil() &&
+             name != pool.symbols().t;
+        bindings.emplace_back(name, value);
+    }
+
+    if (!ok)
+    {
+        for (uint64_t i = 0; i < header.cells; ++i)
+            cells[i].car = cells[i].cdr = pool.nil();
+        return invalid("it holds a value this build cannot represent or a builtin it does not have");
+    }
+
+    // a collection made while defining must not free the values still to be bound
+    auto base = pool.num_roots();
+    for (auto&& binding : bindings)
+        pool.push_root(binding.second);
+    for (auto&& binding : bindings)
+    {
+        if (!globals.define(binding.first, binding.second))
+        {
+            pool.truncate_roots(base);
+            error = "out of memory loading " + path;
+            return false;
+        }
+    }
+    pool.truncate_roots(base);
+    return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+
+namespace rlisp
+{
+    struct GlobalEnv;
+    struct MemPool;
+
+    // A heap image holds the bindings of a global scope and everything their values refer to, so that a library can
+    // be parsed and evaluated once and its definitions restored on later starts without doing either again.
+    //
+    // Cells are stored by their index in the image, atoms by name, builtins by the name define_builtins gives them,
+    // and the global scope that closures capture as a marker for whichever scope the image is loaded into. Nothing in
+    // it depends on where the saving process kept its cells, or on its cell layout.
+
+    // Writes the bindings of globals, which lives in pool. Returns false and sets error if a value holds a builtin
+    // define_builtins does not register or the file cannot be written.
+    bool save_image(const std::string& path, const GlobalEnv& globals, MemPool& pool, std::string& error);
+
+    // Defines every binding in the image at path in globals, which lives in pool and must have the builtins the image
+    // refers to. The file is mapped and its cells relocated in one pass into a new heap segment, which joins the old
+    // generation. Returns false and sets error if the file cannot be read, is not a valid image, holds a value out of
+    // this build's fixnum or local reference range, or the pool is out of memory; bindings may have been made by then.
+    bool load_image(const std::string& path, GlobalEnv& globals, MemPool& pool, std::string& error);
+}
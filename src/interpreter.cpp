@@ -0,0 +1,14 @@
+#include "interpreter.h"
+
+using namespace rlisp;
+
+Interpreter::Interpreter(const MemPoolConfig& config) : m_pool(config), m_globals(m_pool)
+{
+    // in a pool too small to hold them the builtins are left unbound, and evaluating anything fails cleanly
+    define_builtins(m_globals, m_pool);
+}
+
+Interpreter::Interpreter(SymbolTable& atoms, const MemPoolConfig& config) : m_pool(config, atoms), m_globals(m_pool)
+{
+    define_builtins(m_globals, m_pool);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "eval.h"
+#include "globals.h"
+#include "mempool.h"
+
+namespace rlisp
+{
+    // Owns a pool and a global scope that persist across evaluations, so a host evaluating many expressions pays
+    // for registering the builtins once and sees the definitions made by earlier ones.
+    struct Interpreter
+    {
+        explicit Interpreter(const MemPoolConfig& config = MemPoolConfig());
+        // interns atoms in a table shared with other interpreters, which must outlive this one
+        explicit Interpreter(SymbolTable& atoms, const MemPoolConfig& config = MemPoolConfig());
+
+        Cons* eval(Cons* expr, Engine engine = Engine::TreeWalker)
+        {
+            return rlisp::eval(expr, m_globals, m_pool, engine);
+        }
+
+        MemPool& pool() { return m_pool; }
+        GlobalEnv& globals() { return m_globals; }
+
+    private:
+        MemPool m_pool;
+        // declared after m_pool: it holds a root slot in it
+        GlobalEnv m_globals;
+    };
+}
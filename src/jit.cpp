@@ -0,0 +1,839 @@
+#include "jit.h"
+
+#include "bytecode.h"
+
+#if defined(RLISP_JIT)
+#include "callcache.h"
+#include "cons.h"
+#include "mempool.h"
+#include "profiler.h"
+#include "scope.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#endif
+
+using namespace rlisp;
+
+#if defined(RLISP_JIT)
+
+namespace
+{
+    enum Reg : uint8_t
+    {
+        rax,
+        rcx,
+        rdx,
+        rbx,
+        rsp,
+        rbp,
+        rsi,
+        rdi,
+        r8,
+        r9,
+        r10,
+        r11,
+        r12,
+        r13,
+        r14,
+        r15,
+    };
+
+    enum Cond : uint8_t
+    {
+        overflow = 0x0,
+        above_equal = 0x3,
+        equal = 0x4,
+        not_equal = 0x5,
+        below_equal = 0x6,
+        less = 0xC,
+        greater_equal = 0xD,
+        less_equal = 0xE,
+        greater = 0xF,
+    };
+
+    // The few x86-64 instructions the compiler needs, on 64-bit registers. Memory operands are always
+    // [base + disp32].
+    struct Assembler
+    {
+        std::vector<uint8_t> code;
+
+        size_t size() const { return code.size(); }
+        void byte(uint8_t b) { code.push_back(b); }
+        void u32(uint32_t v)
+        {
+            for (int i = 0; i < 4; ++i)
+                byte(static_cast<uint8_t>(v >> (8 * i)));
+        }
+        void u64(uint64_t v)
+        {
+            for (int i = 0; i < 8; ++i)
+                byte(static_cast<uint8_t>(v >> (8 * i)));
+        }
+        void rex_w(int reg, int rm) { byte(static_cast<uint8_t>(0x48 | ((reg >> 3) << 2) | (rm >> 3))); }
+        void modrm_reg(int reg, int rm) { byte(static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7))); }
+        void modrm_mem(int reg, Reg base, int32_t disp)
+        {
+            byte(static_cast<uint8_t>(0x80 | ((reg & 7) << 3) | (base & 7)));
+            // rsp and r12 as a base take a SIB byte
+            if ((base & 7) == rsp) byte(0x24);
+            u32(static_cast<uint32_t>(disp));
+        }
+
+        // mov dst, [base + disp]
+        void load(Reg dst, Reg base, int32_t disp)
+        {
+            rex_w(dst, base);
+            byte(0x8B);
+            modrm_mem(dst, base, disp);
+        }
+        // mov [base + disp], src
+        void store(Reg base, int32_t disp, Reg src)
+        {
+            rex_w(src, base);
+            byte(0x89);
+            modrm_mem(src, base, disp);
+        }
+        void mov(Reg dst, Reg src)
+        {
+            rex_w(src, dst);
+            byte(0x89);
+            modrm_reg(src, dst);
+        }
+        void mov(Reg dst, uint64_t imm)
+        {
+            rex_w(0, dst);
+            byte(static_cast<uint8_t>(0xB8 + (dst & 7)));
+            u64(imm);
+        }
+        void mov32(Reg dst, uint32_t imm)
+        {
+            if (dst >= r8) byte(0x41);
+            byte(static_cast<uint8_t>(0xB8 + (dst & 7)));
+            u32(imm);
+        }
+        void add(Reg dst, Reg src) { alu(0x01, dst, src); }
+        void sub(Reg dst, Reg src) { alu(0x29, dst, src); }
+        void or_(Reg dst, Reg src) { alu(0x09, dst, src); }
+        void cmp(Reg a, Reg b) { alu(0x39, a, b); }
+        // cmp r, imm8
+        void cmp(Reg r, int8_t imm)
+        {
+            rex_w(0, r);
+            byte(0x83);
+            modrm_reg(7, r);
+            byte(static_cast<uint8_t>(imm));
+        }
+        // cmp qword [base + disp], imm32
+        void cmp_mem(Reg base, int32_t disp, int32_t imm)
+        {
+            rex_w(0, base);
+            byte(0x81);
+            modrm_mem(7, base, disp);
+            u32(static_cast<uint32_t>(imm));
+        }
+        // test r, r
+        void test(Reg r)
+        {
+            rex_w(r, r);
+            byte(0x85);
+            modrm_reg(r, r);
+        }
+        void test32(Reg r)
+        {
+            if (r >= r8) byte(0x45);
+            byte(0x85);
+            modrm_reg(r, r);
+        }
+        void imul(Reg dst, Reg src)
+        {
+            rex_w(dst, src);
+            byte(0x0F);
+            byte(0xAF);
+            modrm_reg(dst, src);
+        }
+        void shl(Reg r, uint8_t n) { shift(4, r, n); }
+        void shr(Reg r, uint8_t n) { shift(5, r, n); }
+        void sar(Reg r, uint8_t n) { shift(7, r, n); }
+        void cmov(Cond cond, Reg dst, Reg src)
+        {
+            rex_w(dst, src);
+            byte(0x0F);
+            byte(static_cast<uint8_t>(0x40 + cond));
+            modrm_reg(dst, src);
+        }
+        // the jumps return the position of their rel32 for patch()
+        size_t jcc(Cond cond)
+        {
+            byte(0x0F);
+            byte(static_cast<uint8_t>(0x80 + cond));
+            u32(0);
+            return size() - 4;
+        }
+        size_t jmp()
+        {
+            byte(0xE9);
+            u32(0);
+            return size() - 4;
+        }
+        void patch(size_t at, size_t target)
+        {
+            auto rel = static_cast<uint32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(at + 4));
+            memcpy(&code[at], &rel, 4);
+        }
+        void jmp(Reg r) { indirect(4, r); }
+        void call(Reg r) { indirect(2, r); }
+        void push(Reg r)
+        {
+            if (r >= r8) byte(0x41);
+            byte(static_cast<uint8_t>(0x50 + (r & 7)));
+        }
+        void pop(Reg r)
+        {
+            if (r >= r8) byte(0x41);
+            byte(static_cast<uint8_t>(0x58 + (r & 7)));
+        }
+        void ret() { byte(0xC3); }
+
+    private:
+        void alu(uint8_t op, Reg dst, Reg src)
+        {
+            rex_w(src, dst);
+            byte(op);
+            modrm_reg(src, dst);
+        }
+        void shift(int ext, Reg r, uint8_t n)
+        {
+            rex_w(0, r);
+            byte(0xC1);
+            modrm_reg(ext, r);
+            byte(n);
+        }
+        void indirect(int ext, Reg r)
+        {
+            if (r >= r8) byte(0x41);
+            byte(0xFF);
+            modrm_reg(ext, r);
+        }
+    };
+
+    // Instructions the machine code leaves to C++ run here, in the VM's terms. The root stack is cut back to the
+    // operands live at the instruction for as long as the helper runs, and grown back to the chunk's full depth after.
+    struct Safepoint
+    {
+        Safepoint(NativeFrame& frame, uint32_t depth) : frame(frame), pool(*frame.pool)
+        {
+            pool.truncate_roots(frame.env_slot + 1 + depth);
+        }
+        ~Safepoint()
+        {
+            pool.resize_roots(frame.env_slot + 1 + frame.max_depth);
+            frame.operands = pool.root_data() + frame.env_slot + 1;
+        }
+
+        Cons* pop()
+        {
+            auto v = pool.root(pool.num_roots() - 1);
+            pool.pop_root();
+            return v;
+        }
+
+        NativeFrame& frame;
+        MemPool& pool;
+    };
+
+    // Each helper takes the frame, the instruction's operand and the number of operands live before it, and returns
+    // 0 if the instruction failed.
+    using Helper = uint32_t (*)(NativeFrame*, uint64_t, uint32_t);
+
+    // Lookups never allocate, so they need no safepoint: they return the value, or nullptr if there is none.
+    using Lookup = Cons* (*)(NativeFrame*, uint64_t);
+
+    Cons* lookup_global(NativeFrame* frame, uint64_t name)
+    {
+        return lookup_free(reinterpret_cast<Cons*>(name), frame->env);
+    }
+
+    Cons* lookup_function(NativeFrame* frame, uint64_t form_bits)
+    {
+        auto form = reinterpret_cast<Cons*>(form_bits);
+        auto calls = frame->pool->call_cache();
+        auto v = calls ? calls->find(form) : nullptr;
+        if (!v)
+        {
+            v = lookup_free(form->car, frame->env);
+            if (v && calls) calls->fill(form, frame->env, v);
+        }
+        return v;
+    }
+
+    uint32_t helper_cons(NativeFrame* frame, uint64_t, uint32_t depth)
+    {
+        Safepoint sp(*frame, depth);
+        // both operands stay rooted until the pair exists
+        auto n = sp.pool.num_roots();
+        auto c = sp.pool.cons(sp.pool.root(n - 2), sp.pool.root(n - 1));
+        if (!c) return 0;
+        sp.pool.pop_root();
+        sp.pool.pop_push_root(c);
+        return 1;
+    }
+
+    uint32_t helper_lambda(NativeFrame* frame, uint64_t lambda, uint32_t depth)
+    {
+        Safepoint sp(*frame, depth);
+        auto x = make_closure(reinterpret_cast<Cons*>(lambda), frame->env, sp.pool);
+        if (!x) return 0;
+        sp.pool.push_root(x);
+        return 1;
+    }
+
+    uint32_t helper_let_enter(NativeFrame* frame, uint64_t count, uint32_t depth)
+    {
+        Safepoint sp(*frame, depth);
+        auto env = sp.pool.alloc_block(Tag::Frame, static_cast<size_t>(count) + 1, frame->env);
+        if (!env) return 0;
+        sp.pool.push_root(env);
+        frame->env = env;
+        return 1;
+    }
+
+    uint32_t helper_set_local(NativeFrame* frame, uint64_t i, uint32_t depth)
+    {
+        Safepoint sp(*frame, depth);
+        sp.pool.set_slot(frame->env, static_cast<size_t>(i) + 1, sp.pop());
+        return 1;
+    }
+
+    uint32_t helper_vector_set(NativeFrame* frame, uint64_t, uint32_t depth)
+    {
+        Safepoint sp(*frame, depth);
+        auto x = sp.pop();
+        auto k = sp.pop();
+        auto v = sp.pool.root(sp.pool.num_roots() - 1);
+        size_t i;
+        if (!vector_index(v, k, i)) return 0;
+        sp.pool.set_slot(v, i, x);
+        sp.pool.pop_push_root(x);
+        return 1;
+    }
+
+    // the function on top of the operands is a builtin, whose result replaces it
+    uint32_t helper_call_builtin(NativeFrame* frame, uint64_t form_bits, uint32_t depth)
+    {
+        Safepoint sp(*frame, depth);
+        auto func = sp.pool.root(sp.pool.num_roots() - 1);
+        auto form = reinterpret_cast<Cons*>(form_bits);
+        auto profiler = sp.pool.profiler();
+        if (profiler) profiler->enter_builtin(func, form, sp.pool);
+        auto v = func->builtin(form, frame->env, sp.pool);
+        if (!v) return 0;
+        if (profiler) profiler->leave(sp.pool);
+        sp.pool.pop_push_root(v);
+        return 1;
+    }
+
+    // Registers while the code runs: rbx holds the frame, r12 the first operand slot and r13 the scope. All three are
+    // callee saved, and the code reloads r12 and r13 from the frame after every helper.
+    constexpr Reg frame_reg = rbx;
+    constexpr Reg operands_reg = r12;
+    constexpr Reg env_reg = r13;
+
+    constexpr int32_t operands_offset = offsetof(NativeFrame, operands);
+    constexpr int32_t env_offset = offsetof(NativeFrame, env);
+
+    // byte offsets into cells
+    constexpr int32_t car_offset = offsetof(Cons, car);
+    constexpr int32_t cdr_offset = offsetof(Cons, cdr);
+    constexpr int32_t block_size_offset = offsetof(Cons, block_size);
+    constexpr int32_t slot_offset(size_t i)
+    {
+        return static_cast<int32_t>(sizeof(Cons) * (1 + i / 2) + (i % 2 ? cdr_offset : car_offset));
+    }
+    // so that slot i of a block is at a scaled index from its first slot
+    static_assert(slot_offset(3) == slot_offset(0) + 3 * sizeof(Cons*));
+
+    // fixnums: the payload sits between the kind bits and the four clear low bits
+    constexpr uint8_t fixnum_decode_left = immediate_shift - immediate_payload_bits;
+    constexpr uint8_t fixnum_decode_right = immediate_shift + 4 - immediate_payload_bits;
+    constexpr uint8_t fixnum_range_shift = 64 - immediate_payload_bits;
+    static_assert(fixnum_decode_left == 4 && fixnum_decode_right == 8 && fixnum_range_shift == 8);
+
+    struct CodeGen
+    {
+        CodeGen(const Chunk& chunk, MemPool& pool, const NativeHooks& hooks) : chunk(chunk), pool(pool), hooks(hooks)
+        {
+        }
+
+        // entries must have a slot for each offset in the chunk, which is set for those that get an entry
+        bool run(std::vector<uint32_t>& entries, size_t& max_depth);
+
+        Assembler a;
+
+    private:
+        Cons* constant(uint32_t k) const { return chunk.constants[k]; }
+        static int32_t operand(uint32_t i) { return static_cast<int32_t>(i * sizeof(Cons*)); }
+        uint64_t bits(Cons* c) const { return reinterpret_cast<uint64_t>(c); }
+
+        void load_operand(Reg r, uint32_t i) { a.load(r, operands_reg, operand(i)); }
+        void store_operand(uint32_t i, Reg r) { a.store(operands_reg, operand(i), r); }
+        void fail_if(Cond cond) { fails.push_back(a.jcc(cond)); }
+        void branch(Cond cond, uint32_t target) { jumps.push_back({a.jcc(cond), target}); }
+        // calls a hook whose arguments are in place, and goes on with the code it returns
+        void transfer(uint64_t hook)
+        {
+            a.mov(rdi, frame_reg);
+            a.mov(rax, hook);
+            a.call(rax);
+            a.test(rax);
+            stops.push_back(a.jcc(equal));
+            a.load(operands_reg, frame_reg, operands_offset);
+            a.load(env_reg, frame_reg, env_offset);
+            a.jmp(rax);
+        }
+        void call_helper(Helper fn, uint64_t arg, uint32_t depth)
+        {
+            a.mov(rdi, frame_reg);
+            a.mov(rsi, arg);
+            a.mov32(rdx, depth);
+            a.mov(rax, reinterpret_cast<uint64_t>(fn));
+            a.call(rax);
+            a.load(operands_reg, frame_reg, operands_offset);
+            a.load(env_reg, frame_reg, env_offset);
+        }
+        // a helper that fails by returning 0
+        void helper(Helper fn, uint64_t arg, uint32_t depth)
+        {
+            call_helper(fn, arg, depth);
+            a.test32(rax);
+            fail_if(equal);
+        }
+        // pushes the value of a lookup, failing if there is none; nothing moves, so nothing is reloaded
+        void lookup(Lookup fn, uint64_t arg, uint32_t depth)
+        {
+            a.mov(rdi, frame_reg);
+            a.mov(rsi, arg);
+            a.mov(rax, reinterpret_cast<uint64_t>(fn));
+            a.call(rax);
+            a.test(rax);
+            fail_if(equal);
+            store_operand(depth, rax);
+        }
+        // fails unless r holds a fixnum, and replaces it with its value; scratch is clobbered
+        void decode_fixnum(Reg r, Reg scratch)
+        {
+            a.mov(scratch, r);
+            a.shr(scratch, immediate_shift);
+            a.cmp(scratch, static_cast<int8_t>(Immediate::Fixnum));
+            fail_if(not_equal);
+            a.shl(r, fixnum_decode_left);
+            a.sar(r, fixnum_decode_right);
+        }
+        // fails unless r is in the fixnum range, and replaces it with the fixnum
+        void encode_fixnum(Reg r, Reg scratch)
+        {
+            a.mov(scratch, r);
+            a.shl(scratch, fixnum_range_shift);
+            a.sar(scratch, fixnum_range_shift);
+            a.cmp(scratch, r);
+            fail_if(not_equal);
+            a.shl(r, fixnum_range_shift);
+            a.shr(r, fixnum_range_shift - 4);
+            a.mov(scratch, static_cast<uint64_t>(Immediate::Fixnum) << immediate_shift);
+            a.or_(r, scratch);
+        }
+        // fails unless r holds a pair
+        void check_pair(Reg r, Reg scratch)
+        {
+            a.mov(scratch, r);
+            a.shr(scratch, immediate_shift);
+            fail_if(not_equal);
+            a.load(scratch, r, car_offset);
+            a.cmp(scratch, static_cast<int8_t>(max_tag));
+            fail_if(below_equal);
+        }
+        // fails unless r holds a vector
+        void check_vector(Reg r, Reg scratch)
+        {
+            a.mov(scratch, r);
+            a.shr(scratch, immediate_shift);
+            fail_if(not_equal);
+            a.cmp_mem(r, car_offset, static_cast<int32_t>(Tag::Vector));
+            fail_if(not_equal);
+        }
+        // fails unless r holds a frame
+        void check_frame(Reg r)
+        {
+            a.cmp_mem(r, car_offset, static_cast<int32_t>(Tag::Frame));
+            fail_if(not_equal);
+        }
+        // sets r to t if the flags of the last comparison say cond, and to nil otherwise
+        void select(Cond cond, Reg r, Reg scratch)
+        {
+            a.mov(r, bits(pool.symbols().t));
+            a.mov(scratch, bits(pool.nil()));
+            // cond's inverse is the condition code with the low bit flipped
+            a.cmov(static_cast<Cond>(cond ^ 1), r, scratch);
+        }
+        bool binary(Op op, uint32_t d);
+        // records the depth of the operand stack at a jump target, which must agree with every way of reaching it
+        bool reach(uint32_t target, uint32_t depth)
+        {
+            if (target >= depths.size()) return false;
+            if (depths[target] == unknown) depths[target] = depth;
+            return depths[target] == depth;
+        }
+
+        static constexpr uint32_t unknown = UINT32_MAX;
+        struct Jump
+        {
+            size_t at;
+            uint32_t target;
+        };
+
+        const Chunk& chunk;
+        MemPool& pool;
+        const NativeHooks& hooks;
+        std::vector<uint32_t> depths;
+        std::vector<uint32_t> labels;
+        std::vector<size_t> fails;
+        std::vector<size_t> stops;
+        std::vector<Jump> jumps;
+    };
+}
+
+bool CodeGen::binary(Op op, uint32_t d)
+{
+    load_operand(rax, d - 2);
+    load_operand(rdx, d - 1);
+    if (op == Op::Eq)
+    {
+        a.cmp(rax, rdx);
+        select(equal, rax, rcx);
+        store_operand(d - 2, rax);
+        return true;
+    }
+    decode_fixnum(rax, rcx);
+    decode_fixnum(rdx, rcx);
+    switch (op)
+    {
+        case Op::Add: a.add(rax, rdx); break;
+        case Op::Sub: a.sub(rax, rdx); break;
+        case Op::Mul:
+            // the product of two fixnums can overflow 64 bits before it leaves the fixnum range
+            a.imul(rax, rdx);
+            fail_if(overflow);
+            break;
+        case Op::Lt:
+        case Op::Gt:
+        case Op::NumEq:
+            a.cmp(rax, rdx);
+            select(op == Op::Lt ? less : op == Op::Gt ? greater : equal, rax, rcx);
+            store_operand(d - 2, rax);
+            return true;
+        default: return false;
+    }
+    encode_fixnum(rax, rcx);
+    store_operand(d - 2, rax);
+    return true;
+}
+
+// The chunk is compiled in one pass. The depth of the operand stack is known at every instruction: the compiler only
+// jumps forwards, so the depth at a jump target is recorded before the target is reached, and an instruction no jump
+// or fall through reaches is never run and gets no code.
+bool CodeGen::run(std::vector<uint32_t>& entries, size_t& max_depth)
+{
+    auto& code = chunk.code;
+    depths.assign(code.size() + 1, unknown);
+    labels.assign(code.size() + 1, 0);
+    // the start, and the instruction after each call
+    std::vector<uint32_t> resumes{0};
+    max_depth = 0;
+
+    // bool run(NativeFrame* frame, const uint8_t* entry), which every chunk's code shares the frame of
+    a.push(frame_reg);
+    a.push(operands_reg);
+    a.push(env_reg);
+    a.mov(frame_reg, rdi);
+    a.load(operands_reg, frame_reg, operands_offset);
+    a.load(env_reg, frame_reg, env_offset);
+    a.jmp(rsi);
+
+    depths[0] = 0;
+    size_t pc = 0;
+    while (pc < code.size())
+    {
+        auto offset = static_cast<uint32_t>(pc);
+        auto op = static_cast<Op>(code[pc++]);
+        auto d = depths[offset];
+        labels[offset] = static_cast<uint32_t>(a.size());
+        // an operand of any instruction, read whether or not the instruction gets code
+        auto arg = [&](size_t i) { return code[pc + i]; };
+        size_t operands = 0;
+        switch (op)
+        {
+            case Op::Local:
+            case Op::CallBuiltin: operands = 2; break;
+            case Op::Const:
+            case Op::Global:
+            case Op::Function:
+            case Op::JumpIfNil:
+            case Op::Jump:
+            case Op::Lambda:
+            case Op::LetEnter:
+            case Op::SetLocal:
+            case Op::Call:
+            case Op::TailCall: operands = 1; break;
+            default: break;
+        }
+        if (pc + operands > code.size()) return false;
+        if (d == unknown)
+        {
+            pc += operands;
+            continue;
+        }
+        if (d > max_depth) max_depth = d;
+        // the depth after the instruction, for the one that follows it
+        auto next = unknown;
+        switch (op)
+        {
+            case Op::Const:
+                a.mov(rax, bits(constant(arg(0))));
+                store_operand(d, rax);
+                next = d + 1;
+                break;
+            case Op::Local:
+            {
+                a.mov(rax, env_reg);
+                for (uint32_t i = 0; i < arg(0); ++i)
+                {
+                    check_frame(rax);
+                    a.load(rax, rax, slot_offset(0));
+                }
+                check_frame(rax);
+                auto slot = static_cast<size_t>(arg(1)) + 1;
+                if (slot > INT32_MAX / sizeof(Cons)) return false;
+                a.cmp_mem(rax, block_size_offset, static_cast<int32_t>(slot));
+                fail_if(below_equal);
+                a.load(rax, rax, slot_offset(slot));
+                store_operand(d, rax);
+                next = d + 1;
+                break;
+            }
+            case Op::Global:
+                lookup(lookup_global, bits(constant(arg(0))), d);
+                next = d + 1;
+                break;
+            case Op::Function:
+                lookup(lookup_function, bits(constant(arg(0))), d);
+                next = d + 1;
+                break;
+            case Op::Fail: fails.push_back(a.jmp()); break;
+            case Op::JumpIfNil:
+                if (d < 1 || !reach(arg(0), d - 1)) return false;
+                load_operand(rax, d - 1);
+                a.mov(rcx, bits(pool.nil()));
+                a.cmp(rax, rcx);
+                branch(equal, arg(0));
+                next = d - 1;
+                break;
+            case Op::Jump:
+                if (!reach(arg(0), d)) return false;
+                jumps.push_back({a.jmp(), arg(0)});
+                break;
+            case Op::Cons:
+                if (d < 2) return false;
+                helper(helper_cons, 0, d);
+                next = d - 1;
+                break;
+            case Op::Car:
+            case Op::Cdr:
+                if (d < 1) return false;
+                load_operand(rax, d - 1);
+                check_pair(rax, rcx);
+                a.load(rax, rax, op == Op::Car ? car_offset : cdr_offset);
+                store_operand(d - 1, rax);
+                next = d;
+                break;
+            case Op::Eq:
+            case Op::Add:
+            case Op::Sub:
+            case Op::Mul:
+            case Op::Lt:
+            case Op::Gt:
+            case Op::NumEq:
+                if (d < 2 || !binary(op, d)) return false;
+                next = d - 1;
+                break;
+            case Op::VectorRef:
+                if (d < 2) return false;
+                load_operand(rax, d - 2);
+                load_operand(rdx, d - 1);
+                check_vector(rax, rcx);
+                decode_fixnum(rdx, rcx);
+                // unsigned, so that negative indices fail too
+                a.load(rcx, rax, block_size_offset);
+                a.cmp(rdx, rcx);
+                fail_if(above_equal);
+                a.shl(rdx, 3);
+                a.add(rdx, rax);
+                a.load(rax, rdx, slot_offset(0));
+                store_operand(d - 2, rax);
+                next = d - 1;
+                break;
+            case Op::VectorSet:
+                if (d < 3) return false;
+                helper(helper_vector_set, 0, d);
+                next = d - 2;
+                break;
+            case Op::VectorLength:
+                if (d < 1) return false;
+                load_operand(rax, d - 1);
+                check_vector(rax, rcx);
+                // no vector is too long for a fixnum
+                a.load(rax, rax, block_size_offset);
+                a.shl(rax, 4);
+                a.mov(rcx, static_cast<uint64_t>(Immediate::Fixnum) << immediate_shift);
+                a.or_(rax, rcx);
+                store_operand(d - 1, rax);
+                next = d;
+                break;
+            case Op::Lambda:
+                helper(helper_lambda, bits(constant(arg(0))), d);
+                next = d + 1;
+                break;
+            case Op::LetEnter:
+                helper(helper_let_enter, arg(0), d);
+                next = d + 1;
+                break;
+            case Op::SetLocal:
+                if (d < 1) return false;
+                helper(helper_set_local, arg(0), d);
+                next = d - 1;
+                break;
+            case Op::LetLeave:
+                // drop the frame below the value, and leave the let's scope
+                if (d < 2) return false;
+                load_operand(rax, d - 1);
+                store_operand(d - 2, rax);
+                a.load(env_reg, env_reg, slot_offset(0));
+                a.store(frame_reg, env_offset, env_reg);
+                next = d - 1;
+                break;
+            case Op::CallBuiltin:
+            {
+                if (d < 1 || !reach(arg(1), d)) return false;
+                // anything but a builtin is left for the call that follows
+                load_operand(rax, d - 1);
+                a.mov(rcx, rax);
+                a.shr(rcx, immediate_shift);
+                auto immediate = a.jcc(not_equal);
+                a.cmp_mem(rax, car_offset, static_cast<int32_t>(Tag::Builtin));
+                auto not_builtin = a.jcc(not_equal);
+                helper(helper_call_builtin, bits(constant(arg(0))), d);
+                jumps.push_back({a.jmp(), arg(1)});
+                a.patch(immediate, a.size());
+                a.patch(not_builtin, a.size());
+                next = d;
+                break;
+            }
+            case Op::Call:
+            {
+                if (d < arg(0) + 1) return false;
+                // the callee returns to the next instruction, with its result in place of the function and arguments
+                auto resume = static_cast<uint32_t>(pc + operands);
+                a.mov32(rsi, arg(0));
+                a.mov32(rdx, d);
+                a.mov32(rcx, resume);
+                transfer(reinterpret_cast<uint64_t>(hooks.call));
+                next = d - arg(0);
+                resumes.push_back(resume);
+                break;
+            }
+            case Op::TailCall:
+                if (d < arg(0) + 1) return false;
+                a.mov32(rsi, arg(0));
+                a.mov32(rdx, d);
+                transfer(reinterpret_cast<uint64_t>(hooks.tail_call));
+                break;
+            case Op::Return:
+                if (d < 1) return false;
+                a.mov32(rsi, d);
+                transfer(reinterpret_cast<uint64_t>(hooks.ret));
+                break;
+            default: return false;
+        }
+        pc += operands;
+        if (next != unknown && !reach(static_cast<uint32_t>(pc), next)) return false;
+    }
+    if (depths[code.size()] != unknown) return false;
+    for (auto offset : resumes)
+        entries[offset] = labels[offset];
+
+    for (auto&& jump : jumps)
+        a.patch(jump.at, labels[jump.target]);
+    auto fail = a.size();
+    a.mov32(rax, 0);
+    auto done = a.jmp();
+    // a hook's nullptr is in rax already
+    auto stop = a.size();
+    a.mov32(rax, 1);
+    for (auto at : fails)
+        a.patch(at, fail);
+    for (auto at : stops)
+        a.patch(at, stop);
+    a.patch(done, a.size());
+    a.pop(env_reg);
+    a.pop(operands_reg);
+    a.pop(frame_reg);
+    a.ret();
+    return true;
+}
+#endif
+
+NativeCode::~NativeCode()
+{
+#if defined(RLISP_JIT)
+    if (m_code) munmap(m_code, m_mapped);
+#endif
+}
+
+bool NativeCode::run(NativeFrame& frame, const uint8_t* entry) const
+{
+#if defined(RLISP_JIT)
+    using Run = bool (*)(NativeFrame*, const uint8_t*);
+    return reinterpret_cast<Run>(m_code)(&frame, entry);
+#else
+    (void)frame;
+    (void)entry;
+    return false;
+#endif
+}
+
+std::unique_ptr<NativeCode> rlisp::compile_native(const Chunk& chunk, MemPool& pool, const NativeHooks& hooks)
+{
+#if defined(RLISP_JIT)
+    CodeGen gen(chunk, pool, hooks);
+    std::unique_ptr<NativeCode> native(new NativeCode());
+    native->m_entries.assign(chunk.code.size(), NativeCode::no_entry);
+    if (!gen.run(native->m_entries, native->m_max_depth)) return nullptr;
+
+    // written while writable, then made executable instead
+    auto& bytes = gen.a.code;
+    auto size = bytes.size();
+    auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return nullptr;
+    native->m_code = static_cast<uint8_t*>(p);
+    native->m_mapped = size;
+    memcpy(p, bytes.data(), size);
+    if (mprotect(p, size, PROT_READ | PROT_EXEC) != 0) return nullptr;
+    return native;
+#else
+    (void)chunk;
+    (void)pool;
+    (void)hooks;
+    return nullptr;
+#endif
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+// Machine code is generated for x86-64 under the System V calling convention, and only for the default cell layout.
+// Elsewhere the bytecode VM runs every chunk itself.
+#if defined(__x86_64__) && defined(__linux__) && !defined(RLISP_COMPACT_CELLS)
+#define RLISP_JIT
+#endif
+
+namespace rlisp
+{
+    struct Chunk;
+    struct Cons;
+    struct MemPool;
+
+    struct JitStats
+    {
+        // closure bodies compiled to machine code
+        size_t compiled = 0;
+        // times the VM started running machine code, at the start of a body or on returning to one
+        size_t entries = 0;
+        // calls from machine code that went straight on in the callee's machine code
+        size_t native_calls = 0;
+    };
+
+    // Compiles the bodies of closures the bytecode VM calls often to x86-64 machine code, while a pool evaluates with
+    // the JIT attached (see MemPool::set_jit). The tree walker is unaffected. Without RLISP_JIT nothing is compiled.
+    struct Jit
+    {
+        // a body is compiled on its threshold'th call in one run of the VM; 0 compiles nothing
+        explicit Jit(size_t threshold = 256) : threshold(threshold) { }
+
+        size_t threshold;
+        JitStats stats;
+    };
+
+    // What the VM and the machine code of a chunk share. The chunk's operands are the root stack slots above
+    // env_slot, as they are when the VM runs it, but the root stack is kept max_depth operands deep while the machine
+    // code runs, so that it can push and pop without calling back into C++. It only calls back for instructions that
+    // allocate, look something up, call or return, and those first cut the root stack back to the operands live at
+    // that point, so a collection sees exactly what the VM would have.
+    struct NativeFrame
+    {
+        MemPool* pool;
+        // the first operand slot; updated whenever the root stack may have moved
+        Cons** operands;
+        // the current scope, which let forms change
+        Cons* env;
+        size_t env_slot;
+        size_t max_depth;
+        // the VM running the code, for its hooks
+        void* vm;
+    };
+
+    // Calls, tail calls and returns are made by the VM, through these, with depth operands live; a call resumes at
+    // the instruction at offset resume. Each hook returns the machine code to jump to, in whichever chunk the VM has
+    // gone on to, having set the frame up for it, or nullptr to stop the code and leave the VM to go on from there.
+    // Control passes from chunk to chunk by jumps, so nesting calls never grows the C++ stack.
+    struct NativeHooks
+    {
+        const uint8_t* (*call)(NativeFrame* frame, uint32_t count, uint32_t depth, uint32_t resume);
+        const uint8_t* (*tail_call)(NativeFrame* frame, uint32_t count, uint32_t depth);
+        const uint8_t* (*ret)(NativeFrame* frame, uint32_t depth);
+    };
+
+    // Machine code for a chunk. It can be entered at the start of the chunk and after each call.
+    struct NativeCode
+    {
+        NativeCode(const NativeCode&) = delete;
+        NativeCode& operator=(const NativeCode&) = delete;
+        ~NativeCode();
+
+        // returns the code for the instruction at offset, or nullptr if it cannot be entered there
+        const uint8_t* entry(uint32_t offset) const
+        {
+            return offset < m_entries.size() && m_entries[offset] != no_entry ? m_code + m_entries[offset] : nullptr;
+        }
+        size_t max_depth() const { return m_max_depth; }
+        // Runs from entry with frame.operands pointing at max_depth operand slots, until a hook stops it. Returns
+        // false if an instruction failed.
+        bool run(NativeFrame& frame, const uint8_t* entry) const;
+
+    private:
+        friend std::unique_ptr<NativeCode> compile_native(const Chunk& chunk, MemPool& pool, const NativeHooks& hooks);
+        static constexpr uint32_t no_entry = UINT32_MAX;
+
+        NativeCode() = default;
+
+        uint8_t* m_code = nullptr;
+        size_t m_mapped = 0;
+        // where each instruction that can be entered starts in m_code, by its offset in the chunk
+        std::vector<uint32_t> m_entries;
+        size_t m_max_depth = 0;
+    };
+
+    // Returns nullptr if this build has no JIT, or the chunk uses something the compiler does not handle. The
+    // machine code refers to the chunk's constants, which must stay alive as long as it does.
+    std::unique_ptr<NativeCode> compile_native(const Chunk& chunk, MemPool& pool, const NativeHooks& hooks);
+}
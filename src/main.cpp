@@ -1,12 +1,24 @@
 #include <vcpkg/base/expected.h>
-#include <vcpkg/base/files.h>
 #include <vcpkg/base/parse.h>
 #include <vcpkg/base/system.print.h>
 
+#include <image.h>
+#include <interpreter.h>
+#include <jit.h>
+#include <mappedfile.h>
+#include <parsebatch.h>
 #include <parser.h>
+#include <printer.h>
+#include <profiler.h>
+#include <symtab.h>
 
 #include <argparse/argparse.hpp>
 
+#include <stdio.h>
+
+#include <chrono>
+#include <deque>
+
 namespace System = vcpkg::System;
 
 template<class Fn, class T = decltype((std::declval<Fn&>()()))>
@@ -26,11 +38,247 @@ vcpkg::ExpectedS<T> capture(Fn fn)
     }
 }
 
+static std::string format_duration(std::chrono::steady_clock::duration d)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3f ms", std::chrono::duration<double, std::milli>(d).count());
+    return buf;
+}
+
+struct RunOptions
+{
+    bool time = false;
+    bool print = false;
+    bool parse_only = false;
+    bool gc_stats = false;
+    bool call_stats = false;
+    bool profile = false;
+    // where to write the profile's collapsed stacks; empty for nowhere
+    std::string profile_stacks;
+    // an image to load before running the files, and one to save the definitions to after; empty for none
+    std::string image;
+    std::string save_image;
+    rlisp::MemPoolConfig config;
+    rlisp::Engine engine = rlisp::Engine::TreeWalker;
+    // compile hot closures to machine code under the bytecode engine
+    bool jit = true;
+    size_t jobs = 1;
+};
+
+static void print_gc_stats(const rlisp::MemPoolStats& stats, size_t capacity)
+{
+    auto collections = stats.collections();
+    auto average = collections == 0 ? 0 : stats.total_survivors / collections;
+    System::print2("gc: ",
+                   std::to_string(stats.minor_collections),
+                   " minor and ",
+                   std::to_string(stats.major_collections),
+                   " major collections, ",
+                   format_duration(stats.total_pause),
+                   " paused in total, ",
+                   format_duration(stats.max_pause),
+                   " at most\n");
+    if (stats.mark_steps != 0)
+        System::print2("gc: ", std::to_string(stats.mark_steps), " incremental marking steps\n");
+    System::print2("gc: ",
+                   std::to_string(stats.allocations),
+                   " objects allocated in ",
+                   std::to_string(stats.cells_allocated),
+                   " cells; ",
+                   std::to_string(average),
+                   " cells survived each collection on average, ",
+                   std::to_string(stats.last_survivors),
+                   " the last\n");
+    System::print2("gc: heap of ",
+                   std::to_string(capacity),
+                   " cells, root stack high-water mark ",
+                   std::to_string(stats.max_roots),
+                   '\n');
+}
+
+static void print_call_stats(const rlisp::CallCacheStats& stats)
+{
+    auto calls = stats.hits + stats.misses;
+    char rate[32];
+    snprintf(rate, sizeof(rate), "%.1f%%", calls == 0 ? 0.0 : 100.0 * static_cast<double>(stats.hits) / calls);
+    System::print2("calls: ",
+                   std::to_string(calls),
+                   " through global names, ",
+                   std::to_string(stats.hits),
+                   " found in call site caches (",
+                   rate,
+                   ")\n");
+}
+
+static bool write_file(const std::string& path, const std::string& contents)
+{
+    auto f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    auto written = fwrite(contents.data(), 1, contents.size(), f);
+    return fclose(f) == 0 && written == contents.size();
+}
+
+struct InputFile
+{
+    std::string name;
+    rlisp::MappedFile mapped;
+
+    std::string_view text() const { return {mapped.data(), mapped.size()}; }
+};
+
+// Parses and evaluates one top-level form at a time, so only the form being evaluated and whatever it defines are
+// live; memory stays bounded by the program rather than by the size of the file.
+static int run(rlisp::Interpreter& interp, const InputFile& input, const RunOptions& options)
+{
+    auto& pool = interp.pool();
+    auto& file = input.name;
+    vcpkg::Parse::ParserBase parser({input.mapped.data(), input.mapped.size()}, file);
+
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    size_t forms = 0;
+    while (rlisp::parse_more(parser))
+    {
+        ++forms;
+        auto form_start = clock::now();
+        auto e = rlisp::parse(parser, pool);
+        if (auto err = parser.get_error())
+        {
+            System::print2(System::Color::error, err->format());
+            return 1;
+        }
+        auto value = interp.eval(e, options.engine);
+        auto form_end = clock::now();
+        if (value == nullptr)
+        {
+            System::print2(
+                System::Color::error, file, ": error: evaluation of form ", std::to_string(forms), " failed\n");
+            return 1;
+        }
+        if (options.print) System::print2(rlisp::to_string(value, pool), '\n');
+        if (options.time)
+        {
+            System::print2("form ", std::to_string(forms), ": ", format_duration(form_end - form_start), '\n');
+        }
+    }
+    if (options.time)
+    {
+        System::print2(std::to_string(forms), " forms: ", format_duration(clock::now() - start), '\n');
+    }
+    return 0;
+}
+
+// Parses every file without evaluating anything, spreading the work over options.jobs threads. A single file is split
+// between its top-level forms.
+static int parse_only(const std::deque<InputFile>& inputs, const RunOptions& options)
+{
+    rlisp::SymbolTable atoms;
+    auto start = std::chrono::steady_clock::now();
+    rlisp::ParseBatch batch;
+    if (inputs.size() == 1)
+    {
+        batch = rlisp::parse_forms({inputs[0].name, inputs[0].text()}, atoms, options.jobs, options.config);
+    }
+    else
+    {
+        std::vector<rlisp::ParseSource> sources;
+        for (auto&& input : inputs)
+            sources.push_back({input.name, input.text()});
+        batch = rlisp::parse_batch(sources, atoms, options.jobs, options.config);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    size_t forms = 0;
+    for (auto&& source : batch.sources)
+    {
+        forms += source.forms.size();
+        if (!source.error.empty()) System::print2(System::Color::error, source.error);
+        if (options.print)
+        {
+            auto& pool = *batch.pools[0];
+            for (auto&& form : source.forms)
+                System::print2(rlisp::to_string(form, pool), '\n');
+        }
+    }
+    if (options.gc_stats)
+    {
+        rlisp::MemPoolStats stats;
+        size_t capacity = 0;
+        for (auto&& pool : batch.pools)
+        {
+            stats.merge(pool->stats());
+            capacity += pool->capacity();
+        }
+        print_gc_stats(stats, capacity);
+    }
+    if (options.time)
+    {
+        System::print2(std::to_string(inputs.size()),
+                       " files, ",
+                       std::to_string(forms),
+                       " forms, ",
+                       std::to_string(batch.pools.size()),
+                       " threads: ",
+                       format_duration(elapsed),
+                       '\n');
+    }
+    return batch.ok() ? 0 : 1;
+}
+
 int main(int argc, char** argv)
 {
     argparse::ArgumentParser program("rlisp");
 
-    program.add_argument("file").help("parse and run file");
+    program.add_argument("files").help("parse and run each file in order, in one global scope").remaining();
+    program.add_argument("--time")
+        .help("report the time taken to parse and evaluate each top-level form")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--print").help("print the value of each top-level form").default_value(false).implicit_value(
+        true);
+    program.add_argument("--parse-only")
+        .help("parse the files without running them, to measure the parser")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--gc-stats")
+        .help("print a summary of the collector's work at exit")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--gc-step")
+        .help("trace the heap for major collections in steps of at most this many cells, between allocations")
+        .default_value(0)
+        .action([](const std::string& value) { return std::stoi(value); });
+    program.add_argument("--call-stats")
+        .help("print how many calls through global names found their function in the call site caches at exit")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--profile")
+        .help("print the calls, time and allocation of each function at exit")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--profile-stacks")
+        .help("write the time spent in each call stack to a file, in the collapsed format flame graph tools read")
+        .default_value(std::string());
+    program.add_argument("--image")
+        .help("start from the definitions saved in an image file instead of an empty global scope")
+        .default_value(std::string());
+    program.add_argument("--save-image")
+        .help("after running the files, save every definition to an image file for --image")
+        .default_value(std::string());
+    program.add_argument("--hash-cons")
+        .help("share equal pairs: \"quoted\" for the data of quote forms, \"all\" for every pair cons makes as well")
+        .default_value(std::string());
+    program.add_argument("--engine")
+        .help("evaluate with \"tree\", the tree walker, or \"bytecode\", the bytecode VM")
+        .default_value(std::string("tree"));
+    program.add_argument("--no-jit")
+        .help("run every closure in the bytecode VM, without compiling hot ones to machine code")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("-j", "--jobs")
+        .help("threads to parse with under --parse-only")
+        .default_value(1)
+        .action([](const std::string& value) { return std::stoi(value); });
 
     auto parsed = capture([&] {
         program.parse_args(argc, argv);
@@ -44,13 +292,106 @@ int main(int argc, char** argv)
         return 1;
     }
 
-    auto file = program.get<std::string>("file");
-    System::print2("Passed file ", file, "\n");
+    // no files leaves the argument without a value
+    auto files = capture([&] { return program.get<std::vector<std::string>>("files"); });
+    if (!files || files.get()->empty())
+    {
+        System::print2(System::Color::error, "rlisp: no input files\n");
+        program.print_help();
+        return 1;
+    }
 
-    auto& fs = vcpkg::Files::get_real_filesystem();
-    auto contents = fs.read_contents(fs::u8path(file), VCPKG_LINE_INFO);
+    RunOptions options;
+    options.time = program.get<bool>("--time");
+    options.print = program.get<bool>("--print");
+    options.parse_only = program.get<bool>("--parse-only");
+    options.gc_stats = program.get<bool>("--gc-stats");
+    options.call_stats = program.get<bool>("--call-stats");
+    options.profile = program.get<bool>("--profile");
+    options.profile_stacks = program.get<std::string>("--profile-stacks");
+    options.image = program.get<std::string>("--image");
+    options.save_image = program.get<std::string>("--save-image");
+    auto hash_cons = program.get<std::string>("--hash-cons");
+    if (hash_cons == "quoted")
+        options.config.hash_consing = rlisp::HashConsing::Quoted;
+    else if (hash_cons == "all")
+        options.config.hash_consing = rlisp::HashConsing::All;
+    else if (!hash_cons.empty())
+    {
+        System::print2(System::Color::error, "rlisp: --hash-cons must be quoted or all\n");
+        return 1;
+    }
+    auto engine = program.get<std::string>("--engine");
+    if (engine == "bytecode")
+        options.engine = rlisp::Engine::Bytecode;
+    else if (engine != "tree")
+    {
+        System::print2(System::Color::error, "rlisp: --engine must be tree or bytecode\n");
+        return 1;
+    }
+    options.jit = !program.get<bool>("--no-jit");
+    auto gc_step = program.get<int>("--gc-step");
+    options.config.incremental_step = gc_step < 0 ? 0 : static_cast<size_t>(gc_step);
+    auto jobs = program.get<int>("--jobs");
+    options.jobs = jobs < 1 ? 1 : static_cast<size_t>(jobs);
+
+    // a deque so that each mapping stays where it was opened
+    std::deque<InputFile> inputs;
+    for (auto&& file : *files.get())
+    {
+        auto& input = inputs.emplace_back();
+        input.name = file;
+        std::string error;
+        if (!input.mapped.open(file, error))
+        {
+            System::print2(System::Color::error, "rlisp: ", error, '\n');
+            return 1;
+        }
+    }
 
-    vcpkg::Parse::ParserBase parser(contents, file);
+    if (options.parse_only) return parse_only(inputs, options);
 
-    return 0;
-}
\ No newline at end of file
+    // declared first, so that they outlive the pool using them
+    rlisp::Profiler profiler;
+    rlisp::Jit jit;
+    rlisp::Interpreter interp(options.config);
+    if (options.profile || !options.profile_stacks.empty()) interp.pool().set_profiler(&profiler);
+    if (options.jit) interp.pool().set_jit(&jit);
+    std::string error;
+    if (!options.image.empty())
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (!rlisp::load_image(options.image, interp.globals(), interp.pool(), error))
+        {
+            System::print2(System::Color::error, "rlisp: ", error, '\n');
+            return 1;
+        }
+        if (options.time)
+        {
+            System::print2(
+                "image ", options.image, ": ", format_duration(std::chrono::steady_clock::now() - start), '\n');
+        }
+    }
+    int rc = 0;
+    for (auto&& input : inputs)
+    {
+        rc = run(interp, input, options);
+        if (rc != 0) break;
+    }
+    if (rc == 0 && !options.save_image.empty() &&
+        !rlisp::save_image(options.save_image, interp.globals(), interp.pool(), error))
+    {
+        System::print2(System::Color::error, "rlisp: ", error, '\n');
+        rc = 1;
+    }
+    if (options.gc_stats) print_gc_stats(interp.pool().stats(), interp.pool().capacity());
+    if (options.call_stats) print_call_stats(interp.globals().calls().stats());
+    if (options.profile) System::print2(profiler.report());
+    if (!options.profile_stacks.empty() &&
+        !write_file(options.profile_stacks, profiler.collapsed_stacks(rlisp::ProfileMetric::Time)))
+    {
+        System::print2(System::Color::error, "rlisp: could not write ", options.profile_stacks, '\n');
+        return 1;
+    }
+    return rc;
+}
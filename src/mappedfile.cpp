@@ -0,0 +1,107 @@
+#include "mappedfile.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace rlisp;
+
+#if defined(_WIN32)
+
+MappedFile::~MappedFile()
+{
+    if (m_data) UnmapViewOfFile(m_data);
+    if (m_mapping) CloseHandle(m_mapping);
+    if (m_file) CloseHandle(m_file);
+}
+
+bool MappedFile::open(const std::string& path, std::string& error)
+{
+    auto file = CreateFileA(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        error = "could not open " + path;
+        return false;
+    }
+    m_file = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        error = "could not get the size of " + path;
+        return false;
+    }
+    // an empty file cannot be mapped, but there is nothing to read either
+    if (size.QuadPart == 0) return true;
+
+    m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping)
+    {
+        error = "could not map " + path;
+        return false;
+    }
+    m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_data)
+    {
+        error = "could not map " + path;
+        return false;
+    }
+    m_size = static_cast<size_t>(size.QuadPart);
+    return true;
+}
+
+#else
+
+MappedFile::~MappedFile()
+{
+    if (m_data) munmap(const_cast<char*>(m_data), m_size);
+}
+
+bool MappedFile::open(const std::string& path, std::string& error)
+{
+    auto fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        error = "could not open " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        error = "could not get the size of " + path + ": " + strerror(errno);
+        close(fd);
+        return false;
+    }
+    // an empty file cannot be mapped, but there is nothing to read either
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return true;
+    }
+
+    auto p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        error = "could not map " + path + ": " + strerror(errno);
+        return false;
+    }
+    // the parser reads front to back
+    madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    m_data = static_cast<const char*>(p);
+    m_size = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+#endif
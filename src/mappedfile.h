@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <string>
+
+namespace rlisp
+{
+    // A read-only view of a whole file mapped into memory, so large inputs are paged in as the parser reaches them
+    // instead of being copied into a buffer up front.
+    struct MappedFile
+    {
+        MappedFile() = default;
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        // returns false and sets error if the file cannot be opened or mapped
+        bool open(const std::string& path, std::string& error);
+
+        const char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+
+    private:
+        const char* m_data = nullptr;
+        size_t m_size = 0;
+#if defined(_WIN32)
+        void* m_file = nullptr;
+        void* m_mapping = nullptr;
+#endif
+    };
+}
@@ -0,0 +1,677 @@
+#include <cons.h>
+#include <mempool.h>
+
+#include <algorithm>
+#include <bit>
+
+using namespace rlisp;
+
+static MemPoolConfig config_with_size(size_t sz)
+{
+    MemPoolConfig config;
+    config.initial_cells = sz;
+    return config;
+}
+
+MemPool::MemPool(size_t sz) : MemPool(config_with_size(sz)) { }
+
+MemPool::MemPool(const MemPoolConfig& config)
+    : m_config(config), m_own_atoms(std::make_unique<SymbolTable>()), m_atoms(m_own_atoms.get())
+{
+    init();
+}
+
+MemPool::MemPool(const MemPoolConfig& config, SymbolTable& atoms) : m_config(config), m_atoms(&atoms) { init(); }
+
+void MemPool::init()
+{
+    grow();
+    m_symbols.t = intern_atom("t");
+    m_symbols.quote = intern_atom("quote");
+    m_symbols.closure = intern_atom("closure");
+    m_symbols.lambda = intern_atom("lambda");
+    m_symbols.cond = intern_atom("cond");
+    m_symbols.let = intern_atom("let");
+    m_symbols.cons = intern_atom("cons");
+    m_symbols.car = intern_atom("car");
+    m_symbols.cdr = intern_atom("cdr");
+    m_symbols.eq = intern_atom("eq");
+    m_symbols.define = intern_atom("define");
+    m_symbols.add = intern_atom("+");
+    m_symbols.sub = intern_atom("-");
+    m_symbols.mul = intern_atom("*");
+    m_symbols.lt = intern_atom("<");
+    m_symbols.gt = intern_atom(">");
+    m_symbols.num_eq = intern_atom("=");
+    m_symbols.make_vector = intern_atom("make-vector");
+    m_symbols.vector_ref = intern_atom("vector-ref");
+    m_symbols.vector_set = intern_atom("vector-set!");
+    m_symbols.vector_length = intern_atom("vector-length");
+}
+
+void MemPoolStats::merge(const MemPoolStats& other)
+{
+    minor_collections += other.minor_collections;
+    major_collections += other.major_collections;
+    total_pause += other.total_pause;
+    max_pause = std::max(max_pause, other.max_pause);
+    allocations += other.allocations;
+    cells_allocated += other.cells_allocated;
+    last_survivors += other.last_survivors;
+    total_survivors += other.total_survivors;
+    max_roots = std::max(max_roots, other.max_roots);
+    mark_steps += other.mark_steps;
+}
+
+static void clear_bits(uint64_t* bits, size_t words, size_t size)
+{
+    std::fill_n(bits, words, 0);
+    bits[words - 1] = ~uint64_t(0) << (size % 64);
+}
+
+void MemPool::Segment::clear_marks() { clear_bits(marks.get(), words(), size); }
+
+void MemPool::Segment::clear_live() { clear_bits(live.get(), words(), size); }
+
+bool MemPool::grow(size_t min_cells)
+{
+    size_t sz = m_config.initial_cells;
+    if (m_capacity != 0)
+    {
+        sz = static_cast<size_t>(m_capacity * (m_config.growth_factor - 1.0));
+        sz = std::max(sz, m_config.min_segment_cells);
+    }
+    sz = std::max(sz, min_cells);
+    if (m_config.max_cells != 0) sz = std::min(sz, m_config.max_cells - m_capacity);
+    if (sz == 0 || sz < min_cells) return false;
+
+    auto cells = static_cast<Cons*>(allocate_cells(sz * sizeof(Cons)));
+    if (!cells) return false;
+    insert_segment(cells, sz).clear_marks();
+    return true;
+}
+
+MemPool::Segment& MemPool::insert_segment(Cons* cells, size_t size)
+{
+    Segment seg{std::unique_ptr<Cons[], FreeCells>(cells), size, nullptr, nullptr, nullptr};
+    seg.marks.reset(new uint64_t[seg.words()]);
+    seg.remembered.reset(new uint64_t[seg.words()]());
+    if (m_config.incremental_step != 0)
+    {
+        seg.live.reset(new uint64_t[seg.words()]);
+        seg.clear_live();
+    }
+    m_capacity += size;
+
+    auto it = std::upper_bound(m_segments.begin(), m_segments.end(), cells, [](Cons* c, const Segment& s) {
+        return c < s.cells.get();
+    });
+    // keep the allocation cursor on the segment it was part way through
+    auto index = static_cast<size_t>(it - m_segments.begin());
+    if (index < m_cursor_segment || (index == m_cursor_segment && m_cursor != 0)) ++m_cursor_segment;
+    return *m_segments.insert(it, std::move(seg));
+}
+
+Cons* MemPool::alloc_segment(size_t n)
+{
+    if (n == 0 || (m_config.max_cells != 0 && n > m_config.max_cells - m_capacity)) return nullptr;
+    auto cells = static_cast<Cons*>(allocate_cells(n * sizeof(Cons)));
+    if (!cells) return nullptr;
+    auto& seg = insert_segment(cells, n);
+    // marked like the survivors of a collection, including the padding bits past the end
+    std::fill_n(seg.marks.get(), seg.words(), ~uint64_t(0));
+    m_live += n;
+    ++m_stats.allocations;
+    m_stats.cells_allocated += n;
+    return cells;
+}
+
+MemPool::Segment* MemPool::find_segment(const Cons* c)
+{
+    auto it = std::upper_bound(m_segments.begin(), m_segments.end(), c, [](const Cons* c, const Segment& s) {
+        return c < s.cells.get();
+    });
+    if (it == m_segments.begin()) return nullptr;
+    --it;
+    if (c >= it->cells.get() + it->size) return nullptr;
+    return &*it;
+}
+
+const MemPool::Segment* MemPool::find_segment(const Cons* c) const
+{
+    return const_cast<MemPool*>(this)->find_segment(c);
+}
+
+bool MemPool::is_old(const Cons* c) const
+{
+    auto seg = find_segment(c);
+    if (!seg) return false;
+    auto i = static_cast<size_t>(c - seg->cells.get());
+    return (seg->marks[i / 64] >> (i % 64)) & 1;
+}
+
+// returns true if c is a heap cell that had not been marked yet
+bool MemPool::try_mark(Cons* c)
+{
+    // atoms, builtins, and nil live outside the heap
+    auto seg = find_segment(c);
+    if (!seg) return false;
+    auto i = static_cast<size_t>(c - seg->cells.get());
+    auto& word = mark_bits(*seg)[i / 64];
+    auto bit = uint64_t(1) << (i % 64);
+    // already marked in this collection, or promoted by an earlier one
+    if (word & bit) return false;
+    word |= bit;
+    ++(m_marking ? m_marked : m_live);
+    return true;
+}
+
+void MemPool::push_grey(Cons* c)
+{
+    if (m_mark_stack.size() < m_config.mark_stack_limit)
+        m_mark_stack.push_back(c);
+    else
+        m_mark_stack_overflowed = true;
+}
+
+void MemPool::mark(Cons* c)
+{
+    if (try_mark(c)) push_grey(c);
+}
+
+void MemPool::mark_block(Cons* c)
+{
+    // the payload cells are marked along with the header so that allocation skips them
+    auto seg = find_segment(c);
+    auto first = static_cast<size_t>(c - seg->cells.get());
+    auto cells = Cons::block_cells(c->block_size);
+    auto bits = mark_bits(*seg);
+    for (auto i = first + 1; i < first + cells; ++i)
+    {
+        auto& word = bits[i / 64];
+        auto bit = uint64_t(1) << (i % 64);
+        if (word & bit) continue;
+        word |= bit;
+        ++(m_marking ? m_marked : m_live);
+    }
+    for (size_t i = 0; i < c->block_size; ++i)
+        mark(c->slot(i));
+}
+
+void MemPool::drain_mark_stack()
+{
+    size_t unlimited = SIZE_MAX;
+    drain_mark_stack(unlimited);
+}
+
+bool MemPool::drain_mark_stack(size_t& budget)
+{
+    do
+    {
+        while (!m_mark_stack.empty())
+        {
+            auto c = m_mark_stack.back();
+            m_mark_stack.pop_back();
+            // scan car later and follow cdr now, so proper lists need only one stack slot per nested list
+            do
+            {
+                if (budget == 0)
+                {
+                    // c is marked but not scanned: leave it grey for the next step
+                    push_grey(c);
+                    return false;
+                }
+                --budget;
+                if (c->is_block())
+                {
+                    mark_block(c);
+                    break;
+                }
+                // non-cons are all separately allocated
+                if (!c->is_cons()) abort();
+                mark(c->car);
+                c = c->cdr;
+            } while (try_mark(c));
+        }
+        if (!m_mark_stack_overflowed) return true;
+
+        // some cells were marked but dropped from the stack before their children were scanned
+        m_mark_stack_overflowed = false;
+        rescan_marked();
+    } while (true);
+}
+
+void MemPool::rescan_marked()
+{
+    // Scanning every marked cell also revisits old cells during a minor collection. That is harmless: the children
+    // of an old cell are old themselves unless it is in the remembered set, which has been scanned already.
+    for (auto&& seg : m_segments)
+    {
+        auto bits = mark_bits(seg);
+        size_t i = 0;
+        while (true)
+        {
+            // the padding bits guarantee that a set bit is found
+            auto k = i / 64;
+            auto word = bits[k] & (~uint64_t(0) << (i % 64));
+            while (word == 0)
+                word = bits[++k];
+            i = k * 64 + std::countr_zero(word);
+            if (i >= seg.size) break;
+
+            auto& c = seg.cells[i];
+            if (c.is_block())
+            {
+                // skip the payload: its cells hold slot values, not a car and cdr
+                mark_block(&c);
+                i += Cons::block_cells(c.block_size);
+            }
+            else
+            {
+                mark(c.car);
+                mark(c.cdr);
+                ++i;
+            }
+        }
+    }
+}
+
+void MemPool::mark_roots()
+{
+    // Drain after each root rather than once at the end: with many roots, such as the forms of a parsed file, pushing
+    // them all first would overflow the mark stack and force a rescan of the heap.
+    for (auto&& root : m_roots)
+    {
+        mark(root);
+        drain_mark_stack();
+    }
+}
+
+void MemPool::collect(Cons* a, Cons* b)
+{
+    auto start = std::chrono::steady_clock::now();
+    if (m_marking)
+    {
+        // the heap filled before the incremental collection was done
+        finish_marking(a, b);
+        return end_collection(true, start);
+    }
+    bool major = !m_config.generational;
+    if (!major)
+    {
+        // minor collection: only young cells are unmarked, so marking stops at the old generation and the work is
+        // proportional to the number of survivors
+        mark(a);
+        mark(b);
+        mark_roots();
+        for (auto&& old : m_remembered)
+        {
+            if (old->is_block())
+            {
+                for (size_t i = 0; i < old->block_size; ++i)
+                    mark(old->slot(i));
+            }
+            else
+            {
+                mark(old->car);
+                mark(old->cdr);
+            }
+        }
+        drain_mark_stack();
+        // dead old cells are only reclaimed by a major collection
+        major = m_live > m_capacity * m_config.grow_live_ratio;
+        if (major && m_config.incremental_step != 0)
+        {
+            start_marking(a, b);
+            major = false;
+        }
+    }
+    if (major)
+    {
+        for (auto&& seg : m_segments)
+            seg.clear_marks();
+        m_live = 0;
+        mark(a);
+        mark(b);
+        mark_roots();
+        drain_mark_stack();
+    }
+    end_collection(major, start);
+}
+
+void MemPool::end_collection(bool major, std::chrono::steady_clock::time_point start)
+{
+    // the table of shared pairs holds them weakly
+    if (m_shared_count != 0) sweep_shared();
+    // every young cell reachable from an old one has now been promoted
+    for (auto&& old : m_remembered)
+    {
+        auto seg = find_segment(old);
+        auto i = static_cast<size_t>(old - seg->cells.get());
+        seg->remembered[i / 64] &= ~(uint64_t(1) << (i % 64));
+    }
+    m_remembered.clear();
+
+    if (m_live == m_capacity || m_live > m_capacity * m_config.grow_live_ratio)
+    {
+        // either nothing was freed or we would be collecting again almost immediately
+        grow();
+    }
+
+    // there is no sweep: unmarked cells are free, and allocation finds them lazily
+    reset_cursor();
+
+    // a minor collection that went on to trace the whole heap counts only as major
+    ++(major ? m_stats.major_collections : m_stats.minor_collections);
+    auto pause = std::chrono::steady_clock::now() - start;
+    m_stats.total_pause += pause;
+    m_stats.max_pause = std::max(m_stats.max_pause, pause);
+    m_stats.last_survivors = m_live;
+    m_stats.total_survivors += m_live;
+    if (m_gc_callback) m_gc_callback(GcEvent{major, pause, m_live, m_capacity});
+}
+
+// Called by a minor collection that found the old generation too big, once it has promoted the young survivors.
+// Until the trace finishes, the old generation keeps the cells it has, so the minor collection's growth is what the
+// allocations that carry the trace on use.
+void MemPool::start_marking(Cons* a, Cons* b)
+{
+    for (auto&& seg : m_segments)
+        seg.clear_live();
+    m_marking = true;
+    m_marked = 0;
+    m_root_cursor = 0;
+    m_step_countdown = std::max<size_t>(1, m_config.incremental_step / 2);
+    mark(a);
+    mark(b);
+}
+
+void MemPool::step_marking(Cons* a, Cons* b, size_t cells)
+{
+    if (m_step_countdown > cells)
+    {
+        m_step_countdown -= cells;
+        return;
+    }
+    m_step_countdown = std::max<size_t>(1, m_config.incremental_step / 2);
+
+    auto start = std::chrono::steady_clock::now();
+    ++m_stats.mark_steps;
+    // the roots are scanned a few at a time as well, each along with what it reaches
+    auto budget = m_config.incremental_step;
+    auto done = drain_mark_stack(budget);
+    while (done && budget != 0 && m_root_cursor < m_roots.size())
+    {
+        mark(m_roots[m_root_cursor++]);
+        done = drain_mark_stack(budget);
+    }
+    if (done && m_root_cursor >= m_roots.size())
+    {
+        finish_marking(a, b);
+        return end_collection(true, start);
+    }
+    auto pause = std::chrono::steady_clock::now() - start;
+    m_stats.total_pause += pause;
+    m_stats.max_pause = std::max(m_stats.max_pause, pause);
+}
+
+void MemPool::finish_marking(Cons* a, Cons* b)
+{
+    // Stores into marked cells are caught by the write barrier, but nothing catches changes to the roots, so they
+    // are scanned again. Cells allocated since the trace started are only marked if this reaches them.
+    mark(a);
+    mark(b);
+    mark_roots();
+    // mark_roots only drains after a root, and a and b and the cells the write barrier greyed still need scanning
+    drain_mark_stack();
+    m_marking = false;
+    for (auto&& seg : m_segments)
+        std::swap(seg.marks, seg.live);
+    m_live = m_marked;
+}
+
+void MemPool::reset_cursor()
+{
+    m_cursor_segment = 0;
+    m_cursor = 0;
+    m_run = m_run_end = nullptr;
+}
+
+bool MemPool::find_free_run()
+{
+    while (m_cursor_segment < m_segments.size())
+    {
+        auto& seg = m_segments[m_cursor_segment];
+        auto n = seg.words();
+        for (auto k = m_cursor / 64; k < n; ++k)
+        {
+            // ignore cells before the cursor; they have been handed out already
+            auto free = ~seg.marks[k];
+            if (k == m_cursor / 64) free &= ~uint64_t(0) << (m_cursor % 64);
+            if (free == 0) continue;
+
+            auto begin = k * 64 + std::countr_zero(free);
+            // the padding bits guarantee that a set bit ends the run
+            auto end = begin;
+            for (auto j = k;; ++j)
+            {
+                auto used = seg.marks[j];
+                if (j == k) used &= ~uint64_t(0) << (begin % 64);
+                if (used != 0)
+                {
+                    end = j * 64 + std::countr_zero(used);
+                    break;
+                }
+            }
+            m_run = &seg.cells[begin];
+            m_run_end = &seg.cells[end];
+            m_cursor = end;
+            return true;
+        }
+        ++m_cursor_segment;
+        m_cursor = 0;
+    }
+    return false;
+}
+
+Cons* MemPool::next_free(size_t n)
+{
+    // blocks must be contiguous; runs too short for one are left for the next collection
+    while (static_cast<size_t>(m_run_end - m_run) < n)
+    {
+        if (!find_free_run()) return nullptr;
+    }
+    auto c = m_run;
+    m_run += n;
+    return c;
+}
+
+Cons* MemPool::alloc(Cons* a, Cons* b)
+{
+    if (m_marking) step_marking(a, b, 1);
+    auto c = next_free(1);
+    if (c == nullptr)
+    {
+        // entire memory is allocated
+
+        // gc time
+        collect(a, b);
+        c = next_free(1);
+        if (c == nullptr)
+        {
+            // oom
+            return nullptr;
+        }
+    }
+    ++m_stats.allocations;
+    ++m_stats.cells_allocated;
+    c->car = a;
+    c->cdr = b;
+    return c;
+}
+
+Cons* MemPool::alloc_block(Tag tag, size_t slots, Cons* first)
+{
+    auto n = Cons::block_cells(slots);
+    if (m_marking) step_marking(first, nullptr, n);
+    auto c = next_free(n);
+    if (c == nullptr)
+    {
+        collect(first, nullptr);
+        c = next_free(n);
+        // The free cells may all be in runs that are too short. Nothing has been handed out since the collection, so
+        // the cursor can restart at the first segment, wherever the new segment was inserted.
+        if (c == nullptr && grow(n))
+        {
+            reset_cursor();
+            c = next_free(n);
+        }
+        if (c == nullptr) return nullptr;
+    }
+    ++m_stats.allocations;
+    m_stats.cells_allocated += n;
+    c->set_tag(tag);
+    c->block_size = static_cast<BlockSize>(slots);
+    if (slots != 0) c->slot(0) = first;
+    for (size_t i = 1; i < slots; ++i)
+        c->slot(i) = nil();
+    return c;
+}
+
+void MemPool::write_barrier(Cons* c, Cons* v)
+{
+    auto seg = find_segment(c);
+    if (!seg) return;
+    auto i = static_cast<size_t>(c - seg->cells.get());
+    // a cell an incremental collection has marked may already have been scanned, and must not be left pointing at
+    // one it has not marked
+    if (m_marking && ((seg->live[i / 64] >> (i % 64)) & 1)) mark(v);
+    // only pointers from promoted cells to young cells need remembering
+    if (((seg->marks[i / 64] >> (i % 64)) & 1) == 0) return;
+    if (!find_segment(v) || is_old(v)) return;
+    // a cell written many times between collections, such as the block of global values, is scanned once
+    auto& word = seg->remembered[i / 64];
+    auto bit = uint64_t(1) << (i % 64);
+    if (word & bit) return;
+    word |= bit;
+    m_remembered.push_back(c);
+}
+
+void MemPool::set_car(Cons* c, Cons* v)
+{
+    write_barrier(c, v);
+    c->car = v;
+}
+
+void MemPool::set_cdr(Cons* c, Cons* v)
+{
+    write_barrier(c, v);
+    c->cdr = v;
+}
+
+void MemPool::set_slot(Cons* block, size_t i, Cons* v)
+{
+    write_barrier(block, v);
+    block->slot(i) = v;
+}
+
+size_t MemPool::find_shared(Cons* a, Cons* b) const
+{
+    auto mask = m_shared.size() - 1;
+    uint64_t h = (reinterpret_cast<uintptr_t>(a) >> 4) * 0x9E3779B97F4A7C15ull + (reinterpret_cast<uintptr_t>(b) >> 4);
+    h *= 0xC2B2AE3D27D4EB4Full;
+    auto i = static_cast<size_t>(h >> 32) & mask;
+    while (m_shared[i] != nullptr && (m_shared[i]->car != a || m_shared[i]->cdr != b))
+        i = (i + 1) & mask;
+    return i;
+}
+
+bool MemPool::is_shared(Cons* c) const { return !m_shared.empty() && m_shared[find_shared(c->car, c->cdr)] == c; }
+
+void MemPool::rehash_shared(const std::vector<Cons*>& pairs, size_t size)
+{
+    m_shared.assign(size, nullptr);
+    m_shared_count = 0;
+    for (auto c : pairs)
+    {
+        if (c == nullptr) continue;
+        m_shared[find_shared(c->car, c->cdr)] = c;
+        ++m_shared_count;
+    }
+}
+
+void MemPool::insert_shared(Cons* c)
+{
+    // keep the table at most half full so probe sequences stay short
+    if ((m_shared_count + 1) * 2 > m_shared.size())
+    {
+        auto pairs = std::move(m_shared);
+        rehash_shared(pairs, std::max<size_t>(64, pairs.size() * 2));
+    }
+    m_shared[find_shared(c->car, c->cdr)] = c;
+    ++m_shared_count;
+}
+
+// Called once a collection has marked: shared pairs left unmarked have been freed, and the table shrinks along with
+// the pairs that survive.
+void MemPool::sweep_shared()
+{
+    std::vector<Cons*> live;
+    for (auto c : m_shared)
+    {
+        if (c != nullptr && is_old(c)) live.push_back(c);
+    }
+    auto size = m_shared.size();
+    while (size > 64 && live.size() * 8 < size)
+        size /= 2;
+    rehash_shared(live, size);
+}
+
+Cons* MemPool::alloc_shared(Cons* a, Cons* b)
+{
+    if (!m_shared.empty())
+    {
+        if (auto c = m_shared[find_shared(a, b)]) return c;
+    }
+    // a collection may drop pairs from the table, but not one equal to (a . b), which it does not hold
+    auto c = alloc(a, b);
+    if (c) insert_shared(c);
+    return c;
+}
+
+// Children are shared before their parents, using an explicit stack so that neither long nor deeply nested values
+// recurse. Only pairs that are not shared yet are entered, so shared pairs are never modified.
+Cons* MemPool::share(Cons* value)
+{
+    if (!value->is_cons() || is_shared(value)) return value;
+    std::vector<Cons*> stack{value};
+    while (true)
+    {
+        auto c = stack.back();
+        Cons* a = c->car;
+        if (a->is_cons() && !is_shared(a))
+        {
+            stack.push_back(a);
+            continue;
+        }
+        Cons* b = c->cdr;
+        if (b->is_cons() && !is_shared(b))
+        {
+            stack.push_back(b);
+            continue;
+        }
+        stack.pop_back();
+
+        Cons* shared = m_shared.empty() ? nullptr : m_shared[find_shared(a, b)];
+        if (shared == nullptr)
+        {
+            insert_shared(c);
+            shared = c;
+        }
+        if (stack.empty()) return shared;
+        if (shared == c) continue;
+        auto parent = stack.back();
+        if (parent->car == c) set_car(parent, shared);
+        if (parent->cdr == c) set_cdr(parent, shared);
+    }
+}
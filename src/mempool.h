@@ -2,38 +2,306 @@
 
 #include <stdlib.h>
 
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
 #include <memory>
-#include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
 
+#include "cellspace.h"
 #include "cons.h"
+#include "symtab.h"
 
 namespace rlisp
 {
+    struct CallCache;
+    struct Jit;
+    struct Profiler;
+
+    // which pairs a pool shares through its table of pairs by car and cdr (see MemPool::alloc_shared)
+    enum class HashConsing
+    {
+        // none: every pair is a new cell
+        None,
+        // the data of quote forms the parser reads
+        Quoted,
+        // those, and every pair made by cons
+        All,
+    };
+
+    struct MemPoolConfig
+    {
+        // cells in the first segment
+        size_t initial_cells = 512;
+        // each new segment grows the heap to capacity * growth_factor...
+        double growth_factor = 2.0;
+        // ...but never by fewer than this many cells
+        size_t min_segment_cells = 512;
+        // hard limit on the total number of cells; 0 means unlimited
+        size_t max_cells = 0;
+        // grow instead of collecting again when a collection leaves more than this fraction of the heap live
+        double grow_live_ratio = 0.5;
+        // collect only cells allocated since the last collection unless the old generation fills the heap
+        bool generational = true;
+        // cells waiting to be scanned during marking; past this the heap is rescanned for unscanned cells instead
+        size_t mark_stack_limit = 4096;
+        // Incremental major collections. 0 traces the whole heap in the pause of the collection that finds the old
+        // generation too big. Otherwise that collection only starts the trace, and the allocations that follow carry
+        // it on in steps that scan at most this many cells, one step for every incremental_step / 2 cells allocated.
+        // Dead old cells are freed when a step finds nothing left to scan, after a last scan of the roots, or by the
+        // next collection if the heap fills first. Only generational pools collect incrementally.
+        size_t incremental_step = 0;
+        HashConsing hash_consing = HashConsing::None;
+    };
+
+    // what one collection did, as passed to the callback set with MemPool::set_gc_callback
+    struct GcEvent
+    {
+        bool major;
+        std::chrono::steady_clock::duration pause;
+        // cells marked live, including the old generation a minor collection leaves alone
+        size_t survivors;
+        // heap cells after any growth; those not surviving are free for allocation
+        size_t capacity;
+    };
+
+    struct MemPoolStats
+    {
+        // each collection counts once: a minor one that goes on to trace the whole heap is major
+        size_t minor_collections = 0;
+        size_t major_collections = 0;
+        std::chrono::steady_clock::duration total_pause{};
+        std::chrono::steady_clock::duration max_pause{};
+        // calls to alloc and alloc_block that returned an object, and the cells they took
+        size_t allocations = 0;
+        size_t cells_allocated = 0;
+        // survivors of the latest collection, and summed over every collection
+        size_t last_survivors = 0;
+        size_t total_survivors = 0;
+        // the most roots held at once
+        size_t max_roots = 0;
+        // Steps of incremental major collections. Their pauses count towards total_pause and max_pause, but only a
+        // step that finishes a collection is reported to the gc callback.
+        size_t mark_steps = 0;
+
+        size_t collections() const { return minor_collections + major_collections; }
+        // adds the counts of another pool, such as another worker's
+        void merge(const MemPoolStats& other);
+    };
+
+    // Symbols the evaluator and parser compare against. They are interned when the pool is constructed, so checking
+    // for one is a pointer compare rather than a string compare or a hash lookup.
+    struct Symbols
+    {
+        Cons* t;
+        Cons* quote;
+        Cons* closure;
+        Cons* lambda;
+        Cons* cond;
+        Cons* let;
+        Cons* cons;
+        Cons* car;
+        Cons* cdr;
+        Cons* eq;
+        Cons* define;
+        Cons* add;
+        Cons* sub;
+        Cons* mul;
+        Cons* lt;
+        Cons* gt;
+        Cons* num_eq;
+        Cons* make_vector;
+        Cons* vector_ref;
+        Cons* vector_set;
+        Cons* vector_length;
+    };
+
     struct MemPool
     {
-        explicit MemPool(size_t sz = 512) : m_cells_size(sz), m_cells(new Cons[sz]) { }
+        explicit MemPool(size_t sz = 512);
+        explicit MemPool(const MemPoolConfig& config);
+        // interns atoms in a table shared with other pools, which must outlive this one; atoms from every pool sharing
+        // the table compare by pointer
+        MemPool(const MemPoolConfig& config, SymbolTable& atoms);
 
         Cons* alloc(Cons* a, Cons* b);
-        Cons* intern_atom(std::string atom);
+        // allocates a block with the given number of slots; slot 0, if there is one, is set to first and the rest to
+        // nil
+        Cons* alloc_block(Tag tag, size_t slots, Cons* first);
+        // Adds a segment of n cells that are all in use and returns its first cell, or nullptr if it would take the
+        // heap past max_cells. The caller lays out pairs and blocks in it before the pool allocates again. The cells
+        // join the old generation: a major collection frees those no longer reachable.
+        Cons* alloc_segment(size_t n);
+        Cons* intern_atom(std::string_view name) { return m_atoms->intern(name); }
 
-        void push_root(Cons* a);
-        void pop_root();
-        void pop_push_root(Cons* a);
+        // Hash-consing. A shared pair is the only one in its pool with its car and cdr, so data built from shared
+        // pairs, atoms and fixnums is equal exactly when it is eq. Shared pairs must never be modified. The table
+        // holding them is weak: a collection drops the pairs it frees.
+        // returns the shared pair (a . b), allocating it if there is none; nullptr if the pool is out of memory
+        Cons* alloc_shared(Cons* a, Cons* b);
+        // Returns value with each of its pairs replaced by the shared pair equal to it. Pairs of value that have no
+        // shared equal become shared themselves, modified to point at their shared children, so this never allocates;
+        // nothing else may be relying on their identity.
+        Cons* share(Cons* value);
+        // the pair cons makes: shared under HashConsing::All
+        Cons* cons(Cons* a, Cons* b)
+        {
+            return m_config.hash_consing == HashConsing::All ? alloc_shared(a, b) : alloc(a, b);
+        }
+        HashConsing hash_consing() const { return m_config.hash_consing; }
+        size_t num_shared() const { return m_shared_count; }
 
-        Cons* nil();
+        void push_root(Cons* a)
+        {
+            m_roots.push_back(a);
+            if (m_roots.size() > m_stats.max_roots) m_stats.max_roots = m_roots.size();
+        }
+        void pop_root() { m_roots.pop_back(); }
+        void pop_push_root(Cons* a) { m_roots.back() = a; }
+        // random access to the root stack, for engines that keep their operand stack on it
+        Cons* root(size_t i) const { return m_roots[i]; }
+        void set_root(size_t i, Cons* a) { m_roots[i] = a; }
+        void truncate_roots(size_t n) { m_roots.resize(n); }
+        // sets the number of roots to n, filling any new slots with nil
+        void resize_roots(size_t n)
+        {
+            if (n <= m_roots.size()) return truncate_roots(n);
+            // a few slots at a time, which push_root does without calling out
+            while (m_roots.size() < n)
+                push_root(m_nil);
+        }
+        // the root stack's slots, for machine code that keeps its operands on them; valid until the stack grows
+        Cons** root_data() { return m_roots.data(); }
+
+        // Cells may only be modified after allocation through these, so that the collector sees pointers from
+        // promoted cells to young ones.
+        void set_car(Cons* c, Cons* v);
+        void set_cdr(Cons* c, Cons* v);
+        void set_slot(Cons* block, size_t i, Cons* v);
+
+        Cons* nil() { return m_nil; }
+        const Symbols& symbols() const { return m_symbols; }
 
         size_t num_roots() const { return m_roots.size(); }
+        size_t capacity() const { return m_capacity; }
+        size_t num_segments() const { return m_segments.size(); }
+        size_t num_minor_collections() const { return m_stats.minor_collections; }
+        size_t num_major_collections() const { return m_stats.major_collections; }
+        size_t num_allocations() const { return m_stats.allocations; }
+        const MemPoolStats& stats() const { return m_stats; }
+
+        // Called at the end of every collection, from inside the allocation that triggered it, so the callback must
+        // not use this pool. An empty function removes it.
+        void set_gc_callback(std::function<void(const GcEvent&)> callback) { m_gc_callback = std::move(callback); }
+
+        // Evaluation in this pool reports calls to the profiler, which must outlive the evaluations; nullptr (the
+        // default) turns profiling off. Must not be changed while an evaluation is running.
+        void set_profiler(Profiler* profiler) { m_profiler = profiler; }
+        Profiler* profiler() const { return m_profiler; }
+
+        // Evaluation in this pool looks up the functions of calls through the cache, which rlisp::eval sets to the
+        // GlobalEnv's for as long as it runs; nullptr (the default) looks every one up.
+        void set_call_cache(CallCache* calls) { m_call_cache = calls; }
+        CallCache* call_cache() const { return m_call_cache; }
+
+        // The bytecode VM compiles the closures it calls often to machine code while a JIT is attached; nullptr (the
+        // default) leaves everything to the VM. The JIT must outlive the evaluations using it.
+        void set_jit(Jit* jit) { m_jit = jit; }
+        Jit* jit() const { return m_jit; }
 
     private:
-        size_t m_cells_size;
-        std::unique_ptr<Cons[]> m_cells;
-        std::unordered_map<std::string, Cons> atoms;
-        Cons m_nil{0, nullptr};
-        std::string m_nil_str;
-        int cur_value = 0;
+        struct Segment
+        {
+            std::unique_ptr<Cons[], FreeCells> cells;
+            size_t size;
+            // One bit per cell, persistent across collections. There is always at least one bit past the end of the
+            // segment and those are kept set, so a scan for the end of a run of free cells needs no bounds check.
+            std::unique_ptr<uint64_t[]> marks;
+            // one bit per cell, set while the cell is in m_remembered so that it is only added once
+            std::unique_ptr<uint64_t[]> remembered;
+            // The marks of an incremental major collection while it runs, padded like marks; they replace marks when
+            // it finishes. Allocated only if the pool collects incrementally.
+            std::unique_ptr<uint64_t[]> live;
+
+            size_t words() const { return size / 64 + 1; }
+            void clear_marks();
+            void clear_live();
+        };
+
+        void init();
+        bool grow(size_t min_cells = 0);
+        Segment& insert_segment(Cons* cells, size_t size);
+        Cons* next_free(size_t n);
+        bool find_free_run();
+        void reset_cursor();
+        void collect(Cons* a, Cons* b);
+        void end_collection(bool major, std::chrono::steady_clock::time_point start);
+        void start_marking(Cons* a, Cons* b);
+        void step_marking(Cons* a, Cons* b, size_t cells);
+        void finish_marking(Cons* a, Cons* b);
+        // the bits marking sets: an incremental collection's while it runs, and otherwise the marks
+        uint64_t* mark_bits(Segment& seg) { return m_marking ? seg.live.get() : seg.marks.get(); }
+        bool try_mark(Cons* c);
+        void mark(Cons* c);
+        void mark_block(Cons* c);
+        void mark_roots();
+        void push_grey(Cons* c);
+        void drain_mark_stack();
+        // scans at most budget cells, taking them off it; returns true if no grey cells are left
+        bool drain_mark_stack(size_t& budget);
+        void rescan_marked();
+        Segment* find_segment(const Cons* c);
+        const Segment* find_segment(const Cons* c) const;
+        bool is_old(const Cons* c) const;
+        void write_barrier(Cons* c, Cons* v);
+        size_t find_shared(Cons* a, Cons* b) const;
+        bool is_shared(Cons* c) const;
+        void insert_shared(Cons* c);
+        void rehash_shared(const std::vector<Cons*>& pairs, size_t size);
+        void sweep_shared();
+
+        MemPoolConfig m_config;
+        // sorted by address so that find_segment() can binary search
+        std::vector<Segment> m_segments;
+        size_t m_capacity = 0;
+        // Mark bits are sticky: a cell that survives a collection stays marked and is treated as part of the old
+        // generation until the next major collection clears every bit. Unmarked cells are either free or young.
+        size_t m_live = 0;
+        // marked cells whose children have not been scanned yet
+        std::vector<Cons*> m_mark_stack;
+        bool m_mark_stack_overflowed = false;
+        // promoted cells that were modified to point at young cells since the last collection
+        std::vector<Cons*> m_remembered;
+        // Set while an incremental major collection is marking. Its marks are kept apart from the marks allocation
+        // goes by, and cells allocated meanwhile start unmarked in both; nothing is freed until it finishes. Cells
+        // it has marked are black or grey, so the write barrier marks what is stored into them.
+        bool m_marking = false;
+        // the cells the incremental collection has marked, and the roots it has scanned, so far
+        size_t m_marked = 0;
+        size_t m_root_cursor = 0;
+        // cells left to allocate before the next step
+        size_t m_step_countdown = 0;
+        // Open addressing with linear probing over a power of two sized table of shared pairs, keyed by their car and
+        // cdr; nullptr marks an empty entry. Empty until the first pair is shared.
+        std::vector<Cons*> m_shared;
+        size_t m_shared_count = 0;
+        // allocation bumps through runs of unmarked cells, found segment by segment in address order
+        size_t m_cursor_segment = 0;
+        size_t m_cursor = 0;
+        Cons* m_run = nullptr;
+        Cons* m_run_end = nullptr;
+        MemPoolStats m_stats;
+        std::function<void(const GcEvent&)> m_gc_callback;
+        Profiler* m_profiler = nullptr;
+        CallCache* m_call_cache = nullptr;
+        Jit* m_jit = nullptr;
+        // set when the pool has a table of its own rather than a shared one
+        std::unique_ptr<SymbolTable> m_own_atoms;
+        SymbolTable* m_atoms;
+        Cons* m_nil = m_atoms->intern("nil");
+        Symbols m_symbols;
         std::vector<Cons*> m_roots;
-        Cons* m_free_list = nullptr;
     };
 }
@@ -0,0 +1,153 @@
+#include "parsebatch.h"
+
+#include "cons.h"
+#include "parser.h"
+#include "vcpkgparser.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+using namespace rlisp;
+
+// Runs fn(worker, task) for every task, spread over up to `threads` threads; the calling thread is worker 0. Tasks
+// are handed out one at a time, so uneven tasks still balance.
+template<class Fn>
+static void run_workers(size_t threads, size_t tasks, Fn fn)
+{
+    std::atomic<size_t> next{0};
+    auto work = [&](size_t worker) {
+        for (size_t task; (task = next.fetch_add(1, std::memory_order_relaxed)) < tasks;)
+            fn(worker, task);
+    };
+    std::vector<std::thread> workers;
+    for (size_t worker = 1; worker < threads; ++worker)
+        workers.emplace_back(work, worker);
+    work(0);
+    for (auto&& t : workers)
+        t.join();
+}
+
+static void parse_source(MemPool& pool, const ParseSource& source, ParsedSource& out)
+{
+    vcpkg::Parse::ParserBase parser({source.text.data(), source.text.size()},
+                                    {source.origin.data(), source.origin.size()});
+    while (parse_more(parser))
+    {
+        auto e = parse(parser, pool);
+        if (auto err = parser.get_error())
+        {
+            out.error = err->format();
+            return;
+        }
+        // keeps the form alive while the rest of the batch is parsed into the same pool
+        pool.push_root(e);
+        out.forms.push_back(e);
+    }
+}
+
+static ParseBatch make_batch(SymbolTable& atoms, size_t workers, const MemPoolConfig& config)
+{
+    ParseBatch batch;
+    for (size_t i = 0; i < workers; ++i)
+        batch.pools.push_back(std::make_unique<MemPool>(config, atoms));
+    return batch;
+}
+
+ParseBatch rlisp::parse_batch(const std::vector<ParseSource>& sources,
+                              SymbolTable& atoms,
+                              size_t threads,
+                              const MemPoolConfig& config)
+{
+    auto workers = std::max<size_t>(1, std::min(threads, sources.size()));
+    auto batch = make_batch(atoms, workers, config);
+    batch.sources.resize(sources.size());
+    run_workers(workers, sources.size(), [&](size_t worker, size_t i) {
+        parse_source(*batch.pools[worker], sources[i], batch.sources[i]);
+    });
+    return batch;
+}
+
+static bool is_space(char ch) { return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r'; }
+
+// Splits text into pieces of about `target` bytes, cutting only at whitespace between top-level forms. The scan
+// tokenizes the way the parser does: "#(" opens a vector like '(' opens a list, and any other atom runs until
+// whitespace or ')', so a '(' inside one does not open a list. Unbalanced input is left in one piece for the parser to
+// report.
+static std::vector<std::string_view> split_forms(std::string_view text, size_t target)
+{
+    std::vector<std::string_view> pieces;
+    size_t start = 0;
+    size_t depth = 0;
+    size_t i = 0;
+    while (i < text.size())
+    {
+        auto ch = text[i];
+        if (is_space(ch))
+        {
+            if (depth == 0 && i - start >= target)
+            {
+                pieces.push_back(text.substr(start, i - start));
+                start = i;
+            }
+            ++i;
+        }
+        else if (ch == '(' || (ch == '#' && i + 1 < text.size() && text[i + 1] == '('))
+        {
+            ++depth;
+            i += ch == '#' ? 2 : 1;
+        }
+        else if (ch == ')')
+        {
+            if (depth == 0) break;
+            --depth;
+            ++i;
+        }
+        else if (ch == '\'' || ch == '.')
+        {
+            ++i;
+        }
+        else
+        {
+            while (i < text.size() && !is_space(text[i]) && text[i] != ')')
+                ++i;
+        }
+    }
+    pieces.push_back(text.substr(start));
+    return pieces;
+}
+
+// pieces smaller than this are not worth a task of their own
+static constexpr size_t min_piece_bytes = 16384;
+
+ParseBatch rlisp::parse_forms(const ParseSource& source,
+                              SymbolTable& atoms,
+                              size_t threads,
+                              const MemPoolConfig& config)
+{
+    // several pieces per thread, so that one piece of unusually expensive forms does not hold up the rest
+    threads = std::max<size_t>(1, threads);
+    auto target = std::max(min_piece_bytes, source.text.size() / (threads * 4));
+    std::vector<ParseSource> pieces;
+    for (auto piece : split_forms(source.text, target))
+        pieces.push_back({source.origin, piece});
+
+    auto batch = parse_batch(pieces, atoms, threads, config);
+    ParsedSource whole;
+    for (auto&& piece : batch.sources)
+    {
+        if (!piece.error.empty())
+        {
+            // The piece's error has a position relative to the piece, so reparse the whole source for the right one.
+            // Errors are rare enough that it is not worth tracking where each piece starts.
+            whole = ParsedSource();
+            batch.pools.push_back(std::make_unique<MemPool>(config, atoms));
+            parse_source(*batch.pools.back(), source, whole);
+            break;
+        }
+        whole.forms.insert(whole.forms.end(), piece.forms.begin(), piece.forms.end());
+    }
+    batch.sources.clear();
+    batch.sources.push_back(std::move(whole));
+    return batch;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mempool.h"
+
+namespace rlisp
+{
+    struct Cons;
+    struct SymbolTable;
+
+    struct ParseSource
+    {
+        // the file name used in error messages
+        std::string origin;
+        std::string_view text;
+    };
+
+    struct ParsedSource
+    {
+        // the top-level forms, in order; on error, the forms before it
+        std::vector<Cons*> forms;
+        // the formatted parse error, or empty
+        std::string error;
+    };
+
+    // The forms of a batch live in pools owned by the batch, one per worker thread, and are held in those pools'
+    // root stacks, so they stay valid for as long as the batch does. Forms from different pools may share atoms
+    // but never cells.
+    struct ParseBatch
+    {
+        std::vector<ParsedSource> sources;
+        std::vector<std::unique_ptr<MemPool>> pools;
+
+        bool ok() const
+        {
+            for (auto&& source : sources)
+            {
+                if (!source.error.empty()) return false;
+            }
+            return true;
+        }
+    };
+
+    // Parses each source on up to `threads` threads, each with a pool of its own. Atoms are interned in the shared
+    // table, so they compare by pointer across every source.
+    ParseBatch parse_batch(const std::vector<ParseSource>& sources,
+                           SymbolTable& atoms,
+                           size_t threads,
+                           const MemPoolConfig& config = MemPoolConfig());
+
+    // Parses a single buffer of many top-level forms the same way, by splitting it between top-level forms. The
+    // batch has one source holding every form.
+    ParseBatch parse_forms(const ParseSource& source,
+                           SymbolTable& atoms,
+                           size_t threads,
+                           const MemPoolConfig& config = MemPoolConfig());
+}
@@ -3,196 +3,260 @@
 #include <parser.h>
 #include <vcpkgparser.h>
 
+#include <string>
+#include <vector>
+
 using namespace rlisp;
 
-static void mark(Cons* c, std::vector<bool>& flags, Cons* pool_base)
+static void skip_whitespace(vcpkg::Parse::ParserBase& parser)
 {
-    do
-    {
-        auto i = c - pool_base;
-        if (i < 0 || static_cast<size_t>(i) >= flags.size() || flags[i]) return;
-        flags[i] = true;
-
-        // non-cons are all separately allocated
-        if (!c->is_cons()) abort();
-        mark(c->car, flags, pool_base);
-        c = c->cdr;
-    } while (1);
+    parser.match_zero_or_more([](char32_t ch) { return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r'; });
 }
 
-Cons* MemPool::alloc(Cons* a, Cons* b)
+// returns false if sv is not an integer literal; in_range is cleared if it is one but does not fit in a fixnum
+static bool parse_fixnum(vcpkg::StringView sv, bool& in_range, int64_t& value)
 {
-    if (m_free_list != nullptr)
+    auto it = sv.begin();
+    bool negative = false;
+    if (it != sv.end() && (*it == '-' || *it == '+'))
     {
-        auto c = m_free_list;
-        m_free_list = c->cdr;
-        c->car = a;
-        c->cdr = b;
-        return c;
+        negative = *it == '-';
+        ++it;
     }
-    else if (cur_value < m_cells_size)
+    if (it == sv.end()) return false;
+
+    value = 0;
+    in_range = true;
+    for (; it != sv.end(); ++it)
     {
-        auto& c = m_cells[cur_value++];
-        c.car = a;
-        c.cdr = b;
-        return &c;
+        if (*it < '0' || *it > '9') return false;
+        // accumulate negated so that fixnum_min is reachable
+        auto digit = *it - '0';
+        if (value < (fixnum_min + digit) / 10) in_range = false;
+        if (in_range) value = value * 10 - digit;
     }
-    else
+    if (!negative)
     {
-        // no free list and entire memory is allocated
-
-        // gc time
-        std::vector<bool> flags(m_cells_size, false);
-        mark(a, flags, m_cells.get());
-        mark(b, flags, m_cells.get());
-        for (auto&& root : m_roots)
-            mark(root, flags, m_cells.get());
-
-        // sweep
-        for (size_t i = flags.size(); i > 0; --i)
-        {
-            if (!flags[i - 1])
-            {
-                m_cells[i - 1].cdr = m_free_list;
-                // flood car with CC to improve debugging
-                memset(&m_cells[i - 1].car, 0xCC, sizeof(m_cells[i - 1].car));
-                m_free_list = &m_cells[i - 1];
-            }
-        }
-        if (m_free_list == nullptr)
-        {
-            // oom
-            return nullptr;
-        }
-        else
-        {
-            auto c = m_free_list;
-            m_free_list = c->cdr;
-            c->car = a;
-            c->cdr = b;
-            return c;
-        }
+        if (value < -fixnum_max) in_range = false;
+        value = -value;
     }
+    return true;
 }
 
-Cons* MemPool::nil()
+// prefix is the start of the atom, when the parser had to read past it to tell it was one
+static Cons* parse_atom(vcpkg::Parse::ParserBase& parser, MemPool& pool, std::string_view prefix = {})
 {
-    if (!m_nil.atom)
+    auto sv = parser.match_until(
+        [](char32_t ch) { return ch == ')' || ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r'; });
+    if (!prefix.empty()) return pool.intern_atom(std::string(prefix) + std::string(sv.data(), sv.size()));
+    if (sv.size() == 0)
     {
-        m_nil.atom = &m_nil_str;
-        m_nil_str = "nil";
+        parser.add_error("expected expr");
+        return nullptr;
     }
-    return &m_nil;
-}
-
-Cons* MemPool::intern_atom(std::string sv)
-{
-    if (sv == "nil") return nil();
-
-    auto [it, b] = atoms.emplace(std::move(sv), Cons{0, nullptr});
-    if (b)
+    bool in_range;
+    int64_t value;
+    if (parse_fixnum(sv, in_range, value))
     {
-        it->second.atom = &it->first;
+        if (!in_range)
+        {
+            parser.add_error("integer literal out of range");
+            return nullptr;
+        }
+        return make_fixnum(value);
     }
-    return &it->second;
+    return pool.intern_atom({sv.data(), sv.size()});
 }
 
-void MemPool::push_root(Cons* a) { m_roots.push_back(a); }
-void MemPool::pop_root() { m_roots.pop_back(); }
-void MemPool::pop_push_root(Cons* a) { m_roots.back() = a; }
-
-Cons* parse_expr(vcpkg::Parse::ParserBase& parser, MemPool& pool);
+// shares the data of a (quote x) form written out as a list, as a ' does for its expression
+static void share_quoted(Cons* list, MemPool& pool)
+{
+    if (pool.hash_consing() == HashConsing::None || !list->is_cons() || list->car != pool.symbols().quote) return;
+    auto rest = list->cdr;
+    if (rest->is_cons() && rest->cdr == pool.nil()) pool.set_car(rest, pool.share(rest->car));
+}
 
-static void skip_whitespace(vcpkg::Parse::ParserBase& parser)
+static Cons* list_to_vector(Cons* list, MemPool& pool)
 {
-    parser.match_zero_or_more([](char32_t ch) { return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r'; });
+    size_t n = 0;
+    for (auto p = list; p != pool.nil(); p = p->cdr)
+        ++n;
+    auto v = pool.alloc_block(Tag::Vector, n, n == 0 ? pool.nil() : static_cast<Cons*>(list->car));
+    if (!v) return nullptr;
+    size_t i = 0;
+    for (auto p = list; p != pool.nil(); p = p->cdr)
+        pool.set_slot(v, i++, p->car);
+    return v;
 }
 
-static Cons* parse_list_tail(vcpkg::Parse::ParserBase& parser, MemPool& pool)
+namespace
 {
-    if (parser.at_eof())
+    // an expression that has been started but not finished
+    struct Open
     {
-        parser.add_error("unexpected eof");
-
-        return nullptr;
-    }
+        enum Kind
+        {
+            // inside a list, expecting an element, a '.', or ')'
+            List,
+            // inside a vector, expecting an element or ')'
+            Vector,
+            // after the '.' of a dotted list, expecting its last cdr
+            DottedTail,
+            // after a quote, expecting the quoted expression
+            Quote,
+        };
+        Kind kind;
+        // the last pair of the list so far, or nullptr while it is empty; the first pair is kept in a root slot
+        Cons* tail;
+    };
 
-    if (parser.cur() == ')')
+    // Each open expression holds one root slot, so the roots used are bounded by the nesting depth rather than by
+    // the length of any list.
+    struct OpenStack
     {
-        parser.next();
-        return pool.intern_atom("nil");
-    }
-    auto e1 = parse_expr(parser, pool);
-    if (!e1) return nullptr;
+        OpenStack(MemPool& pool) : pool(pool), base(pool.num_roots()) { }
+        ~OpenStack() { pool.truncate_roots(base); }
 
-    pool.push_root(e1);
-
-    skip_whitespace(parser);
+        bool empty() const { return open.empty(); }
+        size_t depth() const { return open.size(); }
+        Open& top() { return open.back(); }
+        Cons* head() const { return pool.root(base + open.size() - 1); }
+        void set_head(Cons* c) { pool.set_root(base + open.size() - 1, c); }
 
-    if (parser.cur() == '.')
-    {
-        parser.next();
-        skip_whitespace(parser);
-        auto e2 = parse_expr(parser, pool);
-        pool.pop_root();
-        if (!e2) return nullptr;
-        skip_whitespace(parser);
-        if (parser.cur() != ')')
+        void push(Open::Kind kind)
         {
-            return nullptr;
+            open.push_back({kind, nullptr});
+            pool.push_root(pool.nil());
+        }
+        void pop()
+        {
+            open.pop_back();
+            pool.pop_root();
         }
-        parser.next();
-        return pool.alloc(e1, e2);
-    }
-
-    auto e2 = parse_list_tail(parser, pool);
-    pool.pop_root();
-    if (!e2) return nullptr;
 
-    return pool.alloc(e1, e2);
+        MemPool& pool;
+        size_t base;
+        std::vector<Open> open;
+    };
 }
 
+// Lists are built front to back through a tail pointer, and nesting is tracked on an explicit stack, so neither long
+// nor deeply nested input recurses.
 static Cons* parse_expr(vcpkg::Parse::ParserBase& parser, MemPool& pool)
 {
-    if (parser.at_eof())
+    OpenStack stack(pool);
+    while (true)
     {
-        parser.add_error("unexpected eof");
-
-        return nullptr;
-    }
+        // the start of an expression
+        if (parser.at_eof())
+        {
+            parser.add_error("unexpected eof");
+            return nullptr;
+        }
 
-    if (parser.cur() == '(')
-    {
-        parser.next();
-        skip_whitespace(parser);
-        return parse_list_tail(parser, pool);
-    }
-    else if (parser.cur() == '.')
-    {
-        parser.add_error("unexpected '.' list concatenator");
-        return nullptr;
-    }
-    else if (parser.cur() == '\'')
-    {
-        parser.next();
-        auto inner_expr = parse_expr(parser, pool);
-        if (!inner_expr) return nullptr;
-        auto e2 = pool.alloc(inner_expr, pool.nil());
-        pool.push_root(e2);
-        auto quot = pool.intern_atom("quote");
-        pool.pop_root();
-        return pool.alloc(quot, e2);
-    }
-    else
-    {
-        auto sv = parser.match_until(
-            [](char32_t ch) { return ch == ')' || ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r'; });
-        if (sv.size() == 0)
+        Cons* value = nullptr;
+        auto ch = parser.cur();
+        // #( opens a vector; any other # starts an atom
+        bool vector = ch == '#' && parser.next() == '(';
+        if (vector || ch == '(' || ch == '\'')
+        {
+            if (stack.depth() == max_parse_depth)
+            {
+                parser.add_error("expression nested too deeply");
+                return nullptr;
+            }
+            parser.next();
+            if (ch == '\'')
+            {
+                stack.push(Open::Quote);
+                continue;
+            }
+            skip_whitespace(parser);
+            stack.push(vector ? Open::Vector : Open::List);
+        }
+        else if (ch == '.')
         {
-            parser.add_error("expected expr");
+            parser.add_error("unexpected '.' list concatenator");
             return nullptr;
         }
-        return pool.intern_atom(sv.to_string());
+        else
+        {
+            value = parse_atom(parser, pool, ch == '#' ? "#" : "");
+            if (!value) return nullptr;
+        }
+
+        // hand completed values to the expressions that contain them until one needs another expression
+        while (true)
+        {
+            if (value)
+            {
+                if (stack.empty()) return value;
+
+                auto& top = stack.top();
+                if (top.kind == Open::Quote)
+                {
+                    if (pool.hash_consing() != HashConsing::None) value = pool.share(value);
+                    value = pool.alloc(value, pool.nil());
+                    if (value) value = pool.alloc(pool.symbols().quote, value);
+                    if (!value) return nullptr;
+                    stack.pop();
+                    continue;
+                }
+                if (top.kind == Open::DottedTail)
+                {
+                    pool.set_cdr(top.tail, value);
+                    skip_whitespace(parser);
+                    if (parser.cur() != ')')
+                    {
+                        parser.add_error("expected ')' after the last element of a dotted list");
+                        return nullptr;
+                    }
+                    parser.next();
+                    value = stack.head();
+                    stack.pop();
+                    continue;
+                }
+
+                auto cell = pool.alloc(value, pool.nil());
+                if (!cell) return nullptr;
+                // the tail may have been promoted by a collection since it was allocated
+                if (top.tail)
+                    pool.set_cdr(top.tail, cell);
+                else
+                    stack.set_head(cell);
+                top.tail = cell;
+                value = nullptr;
+                skip_whitespace(parser);
+            }
+
+            if (parser.at_eof())
+            {
+                parser.add_error("unexpected eof");
+                return nullptr;
+            }
+            if (parser.cur() == ')')
+            {
+                parser.next();
+                value = stack.head();
+                if (stack.top().kind == Open::Vector)
+                {
+                    // the elements stay rooted by the list until they are in the vector
+                    value = list_to_vector(value, pool);
+                    if (!value) return nullptr;
+                }
+                else
+                    share_quoted(value, pool);
+                stack.pop();
+                continue;
+            }
+            if (parser.cur() == '.' && stack.top().kind == Open::List && stack.top().tail)
+            {
+                parser.next();
+                skip_whitespace(parser);
+                stack.top().kind = Open::DottedTail;
+            }
+            break;
+        }
     }
 }
 
@@ -202,6 +266,12 @@ Cons* rlisp::parse(vcpkg::Parse::ParserBase& parser, MemPool& pool)
     return parse_expr(parser, pool);
 }
 
+bool rlisp::parse_more(vcpkg::Parse::ParserBase& parser)
+{
+    skip_whitespace(parser);
+    return !parser.at_eof();
+}
+
 Cons* rlisp::parse(const char* data, const char* origin, MemPool& pool)
 {
     vcpkg::Parse::ParserBase parser({data, strlen(data)}, {origin, strlen(origin)});
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 namespace vcpkg::Parse
 {
     struct ParserBase;
@@ -10,7 +12,12 @@ namespace rlisp
     struct MemPool;
     struct Cons;
 
+    // lists and quotes nested deeper than this are a parse error
+    constexpr size_t max_parse_depth = 100000;
+
     Cons* parse(vcpkg::Parse::ParserBase& parser, MemPool& pool);
+    // skips whitespace; returns false if the input has no more expressions to parse
+    bool parse_more(vcpkg::Parse::ParserBase& parser);
     Cons* parse(const char* data, const char* origin, MemPool& pool);
     Cons* parse(const char* data, MemPool& pool);
 }
@@ -0,0 +1,104 @@
+#include "printer.h"
+
+#include "cons.h"
+#include "mempool.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace rlisp;
+
+// open holds the vectors being printed, outermost first
+static void print_value(Cons* c, MemPool& pool, std::string& out, std::vector<Cons*>& open)
+{
+    if (is_fixnum(c))
+    {
+        out += std::to_string(fixnum_value(c));
+        return;
+    }
+    if (is_immediate(c))
+    {
+        out += "#<ref>";
+        return;
+    }
+    if (c->is_atom())
+    {
+        out += c->atom->view();
+        return;
+    }
+    if (c->is_builtin())
+    {
+        out += "#<builtin>";
+        return;
+    }
+    if (c->is_closure())
+    {
+        out += "#<closure>";
+        return;
+    }
+    if (c->is_frame())
+    {
+        // closures capture their scope, which may refer back to the closure
+        out += "#<frame>";
+        return;
+    }
+    if (c->is_globals())
+    {
+        out += "#<globals>";
+        return;
+    }
+    if (c->is_vector())
+    {
+        // vector-set! can put a vector inside itself
+        if (std::find(open.begin(), open.end(), c) != open.end())
+        {
+            out += "#<cycle>";
+            return;
+        }
+        open.push_back(c);
+        out += "#(";
+        for (size_t i = 0; i < c->block_size; ++i)
+        {
+            if (i != 0) out += ' ';
+            print_value(c->slot(i), pool, out, open);
+        }
+        out += ')';
+        open.pop_back();
+        return;
+    }
+    if (!c->is_cons())
+    {
+        out += "#<object>";
+        return;
+    }
+
+    // recurse into car, loop along cdr so long lists print in constant stack
+    out += '(';
+    while (true)
+    {
+        print_value(c->car, pool, out, open);
+        c = c->cdr;
+        if (c == pool.nil()) break;
+        if (!c->is_cons())
+        {
+            out += " . ";
+            print_value(c, pool, out, open);
+            break;
+        }
+        out += ' ';
+    }
+    out += ')';
+}
+
+void rlisp::print(Cons* c, MemPool& pool, std::string& out)
+{
+    std::vector<Cons*> open;
+    print_value(c, pool, out, open);
+}
+
+std::string rlisp::to_string(Cons* c, MemPool& pool)
+{
+    std::string out;
+    print(c, pool, out);
+    return out;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+
+namespace rlisp
+{
+    struct Cons;
+    struct MemPool;
+
+    // Appends the printed form of c to out. Objects without a readable form, such as builtins and frames, print as
+    // #<...>, and a vector inside itself prints as #<cycle> there.
+    void print(Cons* c, MemPool& pool, std::string& out);
+    std::string to_string(Cons* c, MemPool& pool);
+}
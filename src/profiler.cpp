@@ -0,0 +1,188 @@
+#include "profiler.h"
+
+#include "cons.h"
+#include "mempool.h"
+#include "printer.h"
+#include "scope.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+using namespace rlisp;
+
+size_t Profiler::find_function(Cons* key, bool& added)
+{
+    auto [it, inserted] = m_function_index.try_emplace(key, m_functions.size());
+    if (!inserted)
+    {
+        auto& f = m_functions[it->second];
+        if (f.car == key->car && f.cdr == key->cdr)
+        {
+            added = false;
+            return it->second;
+        }
+        it->second = m_functions.size();
+    }
+    auto& f = m_functions.emplace_back();
+    f.car = key->car;
+    f.cdr = key->cdr;
+    added = true;
+    return it->second;
+}
+
+void Profiler::enter(size_t function, const MemPool& pool)
+{
+    auto parent = m_stack.empty() ? 0 : m_stack.back().node;
+    auto [it, inserted] = m_children.try_emplace((uint64_t(parent) << 32) | function, m_nodes.size());
+    if (inserted) m_nodes.push_back({parent, function});
+    auto& f = m_functions[function];
+    ++f.stats.calls;
+    ++f.active;
+    m_stack.push_back({it->second, clock::now(), pool.stats().cells_allocated});
+}
+
+void Profiler::enter_closure(Cons* lambda, MemPool& pool)
+{
+    bool added;
+    auto function = find_function(lambda, added);
+    if (added)
+    {
+        auto& name = m_functions[function].stats.name;
+        name = "(lambda ";
+        if (lambda->car == pool.nil())
+            name += "()";
+        else
+            print(lambda->car, pool, name);
+        name += ')';
+    }
+    enter(function, pool);
+}
+
+void Profiler::enter_builtin(Cons* builtin, Cons* form, MemPool& pool)
+{
+    bool added;
+    auto function = find_function(builtin, added);
+    if (added)
+    {
+        auto head = form->car;
+        m_functions[function].stats.name = head->is_atom() ? std::string(head->atom->view()) : "#<builtin>";
+    }
+    enter(function, pool);
+}
+
+void Profiler::leave(const MemPool& pool)
+{
+    auto frame = m_stack.back();
+    m_stack.pop_back();
+    auto elapsed = clock::now() - frame.start;
+    auto cells = pool.stats().cells_allocated - frame.start_cells;
+
+    auto& node = m_nodes[frame.node];
+    node.exclusive += elapsed - frame.children;
+    node.exclusive_cells += cells - frame.children_cells;
+    auto& f = m_functions[node.function];
+    f.stats.exclusive += elapsed - frame.children;
+    f.stats.exclusive_cells += cells - frame.children_cells;
+    if (--f.active == 0)
+    {
+        f.stats.inclusive += elapsed;
+        f.stats.inclusive_cells += cells;
+    }
+    if (!m_stack.empty())
+    {
+        m_stack.back().children += elapsed;
+        m_stack.back().children_cells += cells;
+    }
+}
+
+void Profiler::unwind(size_t depth, const MemPool& pool)
+{
+    while (m_stack.size() > depth)
+        leave(pool);
+}
+
+void Profiler::name(Cons* value, Cons* name)
+{
+    if (!value->is_closure()) return;
+    bool added;
+    auto& f = m_functions[find_function(closure_lambda(value), added)];
+    if (f.named) return;
+    f.stats.name = name->atom->view();
+    f.named = true;
+}
+
+std::vector<Profiler::Function> Profiler::functions() const
+{
+    std::vector<Function> result;
+    for (auto&& f : m_functions)
+    {
+        if (f.stats.calls != 0) result.push_back(f.stats);
+    }
+    std::stable_sort(result.begin(), result.end(), [](const Function& a, const Function& b) {
+        return a.exclusive > b.exclusive;
+    });
+    return result;
+}
+
+std::string Profiler::collapsed_stacks(ProfileMetric metric) const
+{
+    std::string out;
+    std::vector<size_t> path;
+    for (size_t i = 1; i < m_nodes.size(); ++i)
+    {
+        auto& node = m_nodes[i];
+        auto weight = metric == ProfileMetric::Time
+                          ? static_cast<uint64_t>(std::chrono::nanoseconds(node.exclusive).count())
+                          : static_cast<uint64_t>(node.exclusive_cells);
+        if (weight == 0) continue;
+
+        path.clear();
+        for (auto n = i; n != 0; n = m_nodes[n].parent)
+            path.push_back(m_nodes[n].function);
+        for (auto it = path.rbegin(); it != path.rend(); ++it)
+        {
+            // ';' separates frames, so it cannot appear in a name
+            auto start = out.size();
+            out += m_functions[*it].stats.name;
+            std::replace(out.begin() + start, out.end(), ';', ':');
+            out += ';';
+        }
+        out.back() = ' ';
+        out += std::to_string(weight);
+        out += '\n';
+    }
+    return out;
+}
+
+std::string Profiler::report() const
+{
+    auto ms = [](clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    std::string out;
+    char buf[160];
+    snprintf(buf,
+             sizeof(buf),
+             "%10s %12s %12s %12s %12s  %s\n",
+             "calls",
+             "incl ms",
+             "excl ms",
+             "incl cells",
+             "excl cells",
+             "function");
+    out += buf;
+    for (auto&& f : functions())
+    {
+        snprintf(buf,
+                 sizeof(buf),
+                 "%10zu %12.3f %12.3f %12zu %12zu  ",
+                 f.calls,
+                 ms(f.inclusive),
+                 ms(f.exclusive),
+                 f.inclusive_cells,
+                 f.exclusive_cells);
+        out += buf;
+        out += f.name;
+        out += '\n';
+    }
+    return out;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace rlisp
+{
+    struct Cons;
+    struct MemPool;
+
+    // what a collapsed stack line is weighted by
+    enum class ProfileMetric
+    {
+        // nanoseconds spent in the innermost function, not counting its callees
+        Time,
+        // cells allocated by the innermost function, not counting its callees
+        Cells,
+    };
+
+    // Counts calls, time and allocation per function while a pool evaluates with the profiler attached (see
+    // MemPool::set_profiler). A closure is identified by its lambda form, so every closure made from one lambda counts
+    // as one function; it is named after the global it was first defined as, or printed as (lambda (args)). A builtin
+    // is named after the atom it was called through.
+    //
+    // Only applications are counted. cond and let run as part of the function evaluating them, and under the bytecode
+    // engine so do car, cdr, cons, eq and arithmetic, which it runs as instructions. Allocating a closure's frame is
+    // charged to its caller. A tail call replaces the caller on the profiler's stack as it does on the evaluator's.
+    struct Profiler
+    {
+        using clock = std::chrono::steady_clock;
+
+        struct Function
+        {
+            std::string name;
+            size_t calls = 0;
+            // Inclusive figures count a recursive function once for its outermost call, so they never exceed the
+            // time spent evaluating.
+            clock::duration inclusive{};
+            clock::duration exclusive{};
+            size_t inclusive_cells = 0;
+            size_t exclusive_cells = 0;
+        };
+
+        // Called by the engines. Entries nest: each enter is matched by a leave, or by an unwind back past it when
+        // evaluation fails.
+        // lambda is the called closure's (args body), which every closure made from one lambda form shares
+        void enter_closure(Cons* lambda, MemPool& pool);
+        void enter_builtin(Cons* builtin, Cons* form, MemPool& pool);
+        void leave(const MemPool& pool);
+        size_t depth() const { return m_stack.size(); }
+        void unwind(size_t depth, const MemPool& pool);
+        // records that value was bound to the global name, to name its function if it is a closure
+        void name(Cons* value, Cons* name);
+
+        // every function called so far, most exclusive time first
+        std::vector<Function> functions() const;
+        // One line per distinct call stack, as "outer;inner <weight>", the input format of flame graph tools. Stacks
+        // with no weight are left out.
+        std::string collapsed_stacks(ProfileMetric metric = ProfileMetric::Time) const;
+        // a table of functions(), for people
+        std::string report() const;
+
+    private:
+        struct FunctionEntry
+        {
+            Function stats;
+            // the key's cell contents when it was first seen; a different pair means the cell was collected and
+            // reused for another lambda
+            Cons* car;
+            Cons* cdr;
+            bool named = false;
+            // calls of this function on the stack, so recursion is only counted once in the inclusive figures
+            size_t active = 0;
+        };
+        // a node of the call tree, one per distinct stack
+        struct Node
+        {
+            size_t parent;
+            size_t function;
+            clock::duration exclusive{};
+            size_t exclusive_cells = 0;
+        };
+        struct Frame
+        {
+            size_t node;
+            clock::time_point start;
+            size_t start_cells;
+            // spent in callees, to subtract from this call's inclusive figures
+            clock::duration children{};
+            size_t children_cells = 0;
+        };
+
+        // the function keyed by the cell key, added unnamed if it is new
+        size_t find_function(Cons* key, bool& added);
+        void enter(size_t function, const MemPool& pool);
+
+        std::vector<FunctionEntry> m_functions;
+        std::unordered_map<const Cons*, size_t> m_function_index;
+        // node 0 is the root, above the outermost call
+        std::vector<Node> m_nodes{Node{0, SIZE_MAX}};
+        // keyed by parent node and function, packed into one integer
+        std::unordered_map<uint64_t, size_t> m_children;
+        std::vector<Frame> m_stack;
+    };
+}
@@ -0,0 +1,232 @@
+#include "resolve.h"
+
+#include "cons.h"
+#include "mempool.h"
+
+using namespace rlisp;
+
+namespace
+{
+    // The names bound by an enclosing lambda or let, read straight from its source so resolving allocates nothing
+    // for them. Frames live on the C++ stack for the duration of the body they scope.
+    struct Frame
+    {
+        Frame* parent;
+        // the lambda's argument list, or the let's list of (name value) pairs
+        Cons* bindings;
+        bool is_let;
+        // how many of the bindings are visible: a let's values only see the names bound before them
+        size_t visible;
+
+        Cons* name(Cons* binding) const { return is_let ? binding->car->car : binding->car; }
+    };
+
+    struct Resolver
+    {
+        explicit Resolver(MemPool& pool) : pool(pool), syms(pool.symbols()) { }
+
+        Cons* expr(Cons* e);
+
+    private:
+        // a LocalRef to name, nullptr if name is not bound locally, or nil if it is bound where no LocalRef can reach
+        Cons* lookup(Cons* name) const;
+        Cons* map(Cons* e, Cons* (Resolver::*f)(Cons*));
+        Cons* list(Cons* e) { return map(e, &Resolver::expr); }
+        Cons* rebuild(Cons* e, Cons* tail)
+        {
+            if (!tail) return nullptr;
+            return tail == e->cdr ? e : pool.alloc(e->car, tail);
+        }
+        Cons* lambda(Cons* e);
+        Cons* let(Cons* e);
+        Cons* let_bindings(Cons* pairs);
+        Cons* define(Cons* e);
+
+        MemPool& pool;
+        const Symbols& syms;
+        Frame* frame = nullptr;
+    };
+}
+
+Cons* Resolver::lookup(Cons* name) const
+{
+    size_t depth = 0;
+    for (auto f = frame; f; f = f->parent, ++depth)
+    {
+        // later bindings shadow earlier ones in the same frame
+        size_t found = SIZE_MAX;
+        auto b = f->bindings;
+        for (size_t i = 0; i < f->visible; ++i, b = b->cdr)
+        {
+            if (f->name(b) == name) found = i;
+        }
+        if (found != SIZE_MAX)
+        {
+            if (depth > max_local_depth || found > max_local_index) return pool.nil();
+            return make_local_ref(depth, found);
+        }
+    }
+    return nullptr;
+}
+
+// resolves each element of a (possibly improper) list with f
+Cons* Resolver::map(Cons* e, Cons* (Resolver::*f)(Cons*))
+{
+    if (!e->is_cons()) return e;
+    auto head = (this->*f)(e->car);
+    if (!head) return nullptr;
+    // an unchanged head is still reachable from e
+    if (head == e->car) return rebuild(e, map(e->cdr, f));
+    pool.push_root(head);
+    auto tail = map(e->cdr, f);
+    pool.pop_root();
+    if (!tail) return nullptr;
+    return pool.alloc(head, tail);
+}
+
+Cons* Resolver::lambda(Cons* e)
+{
+    // (lambda (a b) e)
+    // malformed lambdas are left unresolved; applying them fails anyway
+    auto rest = e->cdr;
+    if (!rest->is_cons()) return e;
+    if (!rest->cdr->is_cons()) return e;
+    if (rest->cdr->cdr != pool.nil()) return e;
+
+    size_t count = 0;
+    auto args = rest->car;
+    for (; args->is_cons(); args = args->cdr, ++count)
+    {
+        if (!args->car->is_atom()) return e;
+    }
+    if (args != pool.nil()) return e;
+
+    Frame f{frame, rest->car, false, count};
+    frame = &f;
+    auto body = expr(rest->cdr->car);
+    frame = f.parent;
+    if (!body) return nullptr;
+    if (body == rest->cdr->car) return e;
+
+    auto x = pool.alloc(body, pool.nil());
+    if (!x) return nullptr;
+    x = pool.alloc(rest->car, x);
+    if (!x) return nullptr;
+    return pool.alloc(e->car, x);
+}
+
+Cons* Resolver::let(Cons* e)
+{
+    // (let ((a b) (c d)) e)
+    // must accept exactly the forms builtin_let accepts, since that is what creates the frame
+    auto rest = e->cdr;
+    if (!rest->is_cons()) return e;
+    if (!rest->cdr->is_cons()) return e;
+    if (rest->cdr->cdr != pool.nil()) return e;
+    auto pairs = rest->car;
+    for (; pairs->is_cons(); pairs = pairs->cdr)
+    {
+        auto pair = pairs->car;
+        if (!pair->is_cons()) return e;
+        if (!pair->cdr->is_cons()) return e;
+        if (pair->cdr->cdr != pool.nil()) return e;
+        if (!pair->car->is_atom()) return e;
+    }
+    if (pairs != pool.nil()) return e;
+
+    Frame f{frame, rest->car, true, 0};
+    frame = &f;
+    auto bindings = let_bindings(rest->car);
+    if (!bindings)
+    {
+        frame = f.parent;
+        return nullptr;
+    }
+    pool.push_root(bindings);
+    auto body = expr(rest->cdr->car);
+    frame = f.parent;
+    if (!body)
+    {
+        pool.pop_root();
+        return nullptr;
+    }
+    Cons* x = rest;
+    if (bindings != rest->car || body != rest->cdr->car)
+    {
+        x = pool.alloc(body, pool.nil());
+        if (x) x = pool.alloc(bindings, x);
+    }
+    pool.pop_root();
+    if (!x) return nullptr;
+    return rebuild(e, x);
+}
+
+// each binding's value sees the names bound before it
+Cons* Resolver::let_bindings(Cons* pairs)
+{
+    if (pairs == pool.nil()) return pairs;
+    auto pair = pairs->car;
+    auto value = expr(pair->cdr->car);
+    if (!value) return nullptr;
+    ++frame->visible;
+
+    pool.push_root(value);
+    auto tail = let_bindings(pairs->cdr);
+    if (!tail)
+    {
+        pool.pop_root();
+        return nullptr;
+    }
+    auto new_pair = pair;
+    if (value != pair->cdr->car)
+    {
+        pool.push_root(tail);
+        new_pair = pool.alloc(value, pool.nil());
+        if (new_pair) new_pair = pool.alloc(pair->car, new_pair);
+        pool.pop_root();
+    }
+    pool.pop_root();
+    if (!new_pair) return nullptr;
+    if (new_pair == pair && tail == pairs->cdr) return pairs;
+    return pool.alloc(new_pair, tail);
+}
+
+Cons* Resolver::define(Cons* e)
+{
+    // (define name e)
+    // the name is bound rather than referenced, so only the value is resolved
+    auto rest = e->cdr;
+    if (!rest->is_cons()) return e;
+    return rebuild(e, rebuild(rest, list(rest->cdr)));
+}
+
+Cons* Resolver::expr(Cons* e)
+{
+    if (is_immediate(e) || e == pool.nil() || e == syms.t) return e;
+    if (e->is_atom())
+    {
+        if (auto ref = lookup(e)) return ref == pool.nil() ? nullptr : ref;
+        return e;
+    }
+    if (!e->is_cons()) return e;
+
+    // special forms are only recognized when their name is not shadowed by a local binding
+    auto head = e->car;
+    if (!is_immediate(head) && head->is_atom() && !lookup(head))
+    {
+        if (head == syms.quote) return e;
+        if (head == syms.lambda) return lambda(e);
+        if (head == syms.let) return let(e);
+        if (head == syms.cond) return rebuild(e, map(e->cdr, &Resolver::list));
+        if (head == syms.define) return define(e);
+    }
+    return list(e);
+}
+
+Cons* rlisp::resolve(Cons* e, MemPool& pool)
+{
+    pool.push_root(e);
+    auto r = Resolver(pool).expr(e);
+    pool.pop_root();
+    return r;
+}
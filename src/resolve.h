@@ -0,0 +1,13 @@
+#pragma once
+
+namespace rlisp
+{
+    struct Cons;
+    struct MemPool;
+
+    // Rewrites each reference to a variable bound by an enclosing lambda or let form into a LocalRef immediate
+    // holding its (frame depth, slot) address, so the evaluator can index the frame directly instead of searching
+    // the scope. Free references and quoted data are left alone, and subtrees without local references are shared
+    // with the input rather than copied.
+    Cons* resolve(Cons* expr, MemPool& pool);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "cons.h"
+#include "globals.h"
+
+namespace rlisp
+{
+    // Runtime scopes are a chain of frames (see Tag::Frame) ending in the cell of a GlobalEnv.
+    // These are shared by every evaluation engine so that closures created by one can be applied by another.
+
+    // returns nullptr if the reference does not fit the scope
+    inline Cons* lookup_local(size_t depth, size_t index, Cons* scope)
+    {
+        for (size_t i = 0; i < depth; ++i)
+        {
+            if (!scope->is_frame()) return nullptr;
+            scope = scope->slot(0);
+        }
+        if (!scope->is_frame() || index + 1 >= scope->block_size) return nullptr;
+        return scope->slot(index + 1);
+    }
+
+    inline Cons* lookup_local(Cons* ref_immediate, Cons* scope)
+    {
+        auto ref = local_ref(ref_immediate);
+        return lookup_local(ref.depth, ref.index, scope);
+    }
+
+    // free references skip the frames, which only hold resolved locals; returns nullptr if name is unbound
+    inline Cons* lookup_free(Cons* name, Cons* scope)
+    {
+        while (scope->is_frame())
+            scope = scope->slot(0);
+        if (!scope->is_globals()) return nullptr;
+        return scope->globals->lookup(name);
+    }
+
+    inline GlobalEnv* global_env(Cons* scope)
+    {
+        while (scope->is_frame())
+            scope = scope->slot(0);
+        if (!scope->is_globals()) return nullptr;
+        return scope->globals;
+    }
+
+    // A closure is a block whose slots are checked and filled in once, when its lambda is evaluated, so applying it
+    // needs neither a walk of the argument list nor any test of its shape. The slots are:
+    //   0  the scope the lambda was evaluated in, the parent of every frame the closure binds
+    //   1  the lambda's (args body), by which the profiler identifies the closure
+    //   2  the body
+    //   3  the number of arguments, as a fixnum
+    constexpr size_t closure_slots = 4;
+
+    // returns nullptr if lambda, the (args body) of a lambda form, is malformed or the closure cannot be allocated
+    inline Cons* make_closure(Cons* lambda, Cons* scope, MemPool& pool)
+    {
+        // (lambda (x y) (+ x y))
+        if (!lambda->is_cons() || !lambda->cdr->is_cons() || lambda->cdr->cdr != pool.nil()) return nullptr;
+        int64_t arity = 0;
+        auto arglist = lambda->car;
+        for (; arglist->is_cons(); arglist = arglist->cdr, ++arity)
+        {
+            if (!arglist->car->is_atom()) return nullptr;
+        }
+        if (arglist != pool.nil()) return nullptr;
+
+        // lambda is part of the code being run, which the caller keeps reachable
+        auto closure = pool.alloc_block(Tag::Closure, closure_slots, scope);
+        if (closure == nullptr) return nullptr;
+        closure->slot(1) = lambda;
+        closure->slot(2) = lambda->cdr->car;
+        closure->slot(3) = make_fixnum(arity);
+        return closure;
+    }
+
+    inline Cons* closure_scope(Cons* closure) { return closure->slot(0); }
+    inline Cons* closure_lambda(Cons* closure) { return closure->slot(1); }
+    inline Cons* closure_body(Cons* closure) { return closure->slot(2); }
+    inline size_t closure_arity(Cons* closure) { return static_cast<size_t>(fixnum_value(closure->slot(3))); }
+}
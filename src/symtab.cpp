@@ -0,0 +1,83 @@
+#include "symtab.h"
+
+#include <string.h>
+
+#include <new>
+
+using namespace rlisp;
+
+SymbolTable::SymbolTable()
+{
+    m_indexes.push_back(std::make_unique<Index>(256));
+    m_index.store(m_indexes.back().get(), std::memory_order_release);
+}
+
+size_t SymbolTable::size()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_size;
+}
+
+uint64_t SymbolTable::hash(std::string_view name)
+{
+    // FNV-1a, then a final multiply so that the low bits used to index the table depend on every byte
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (auto ch : name)
+        h = (h ^ static_cast<unsigned char>(ch)) * 0x100000001b3ull;
+    return h * 0x9E3779B97F4A7C15ull;
+}
+
+void SymbolTable::rehash()
+{
+    auto& old = *m_indexes.back();
+    auto index = std::make_unique<Index>((old.mask + 1) * 2);
+    for (size_t i = 0; i <= old.mask; ++i)
+    {
+        auto atom = old.entries[i].atom.load(std::memory_order_relaxed);
+        if (atom == nullptr) continue;
+        // names are unique, so there is no need to compare them
+        auto hash = old.entries[i].hash.load(std::memory_order_relaxed);
+        auto j = static_cast<size_t>(hash) & index->mask;
+        while (index->entries[j].atom.load(std::memory_order_relaxed) != nullptr)
+            j = (j + 1) & index->mask;
+        index->entries[j].hash.store(hash, std::memory_order_relaxed);
+        index->entries[j].atom.store(atom, std::memory_order_relaxed);
+    }
+    // publishing the index also publishes its entries
+    m_index.store(index.get(), std::memory_order_release);
+    m_indexes.push_back(std::move(index));
+}
+
+Cons* SymbolTable::insert(Entry& entry, std::string_view name, uint64_t hash)
+{
+    auto memory = m_records.allocate(sizeof(Record) + name.size() + 1, alignof(Record));
+    if (!memory) throw std::bad_alloc();
+    auto record = new (memory) Record;
+    auto data = reinterpret_cast<char*>(record + 1);
+    memcpy(data, name.data(), name.size());
+    data[name.size()] = '\0';
+    record->name = {data, name.size()};
+    record->cell.set_tag(Tag::Atom);
+    record->cell.atom = &record->name;
+
+    // readers see the atom only once the hash and the record are in place
+    entry.hash.store(hash, std::memory_order_relaxed);
+    entry.atom.store(&record->cell, std::memory_order_release);
+    ++m_size;
+    // keep the table at most half full so probe sequences stay short
+    if (m_size * 2 > m_indexes.back()->mask + 1) rehash();
+    return &record->cell;
+}
+
+Cons* SymbolTable::intern(std::string_view name)
+{
+    auto h = hash(name);
+    Entry* empty;
+    // most names have been interned already, so look before taking the lock
+    if (auto atom = m_index.load(std::memory_order_acquire)->find(name, h, empty)) return atom;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // another thread may have added the name, or replaced the index, since
+    if (auto atom = m_indexes.back()->find(name, h, empty)) return atom;
+    return insert(*empty, name, h);
+}
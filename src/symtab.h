@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "cellspace.h"
+#include "cons.h"
+
+namespace rlisp
+{
+    // Interns atoms by name. An atom's cell, its AtomName and the name's bytes are stored together in an arena that
+    // lives as long as the table, so atoms have stable addresses and compare by pointer. Interning a name that is
+    // already present allocates nothing.
+    //
+    // A table may be shared by pools on different threads. Looking up an existing name takes no lock; adding one
+    // takes a mutex.
+    struct SymbolTable
+    {
+        SymbolTable();
+
+        SymbolTable(const SymbolTable&) = delete;
+        SymbolTable& operator=(const SymbolTable&) = delete;
+
+        Cons* intern(std::string_view name);
+
+        size_t size();
+
+    private:
+        struct Entry
+        {
+            // nullptr marks an empty entry; set once, after hash, and never changed
+            std::atomic<Cons*> atom;
+            // kept beside the atom so that probing past other names rarely touches the arena
+            std::atomic<uint64_t> hash;
+        };
+
+        // Open addressing with linear probing over a power of two sized table. A full index is replaced rather than
+        // resized, and replaced indexes are kept until the table is destroyed, so a lookup without the lock can never
+        // be left reading freed memory. The worst it can do is miss a name added to a newer index and fall back to
+        // the locked path.
+        struct Index
+        {
+            explicit Index(size_t size) : mask(size - 1), entries(new Entry[size]()) { }
+
+            // Returns the atom named name, or nullptr with empty set to the entry where it would be inserted. The
+            // atom is loaded once: another thread may fill the empty entry with a different name at any time.
+            Cons* find(std::string_view name, uint64_t hash, Entry*& empty) const
+            {
+                auto i = static_cast<size_t>(hash) & mask;
+                while (true)
+                {
+                    auto& entry = entries[i];
+                    auto atom = entry.atom.load(std::memory_order_acquire);
+                    if (atom == nullptr)
+                    {
+                        empty = &entry;
+                        return nullptr;
+                    }
+                    if (entry.hash.load(std::memory_order_relaxed) == hash && atom->atom->view() == name) return atom;
+                    i = (i + 1) & mask;
+                }
+            }
+
+            size_t mask;
+            std::unique_ptr<Entry[]> entries;
+        };
+
+        // the layout of each arena allocation; the name's bytes and a NUL follow it
+        struct Record
+        {
+            Cons cell;
+            AtomName name;
+        };
+
+        static uint64_t hash(std::string_view name);
+        Cons* insert(Entry& entry, std::string_view name, uint64_t hash);
+        void rehash();
+
+        std::atomic<Index*> m_index;
+
+        // everything below is guarded by m_mutex
+        std::mutex m_mutex;
+        // the current index and every index it replaced
+        std::vector<std::unique_ptr<Index>> m_indexes;
+        size_t m_size = 0;
+        CellArena m_records;
+    };
+}
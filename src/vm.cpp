@@ -0,0 +1,559 @@
+#include "bytecode.h"
+#include "callcache.h"
+#include "cons.h"
+#include "jit.h"
+#include "mempool.h"
+#include "profiler.h"
+#include "scope.h"
+
+#include <memory>
+#include <unordered_map>
+
+using namespace rlisp;
+
+namespace
+{
+    struct CallFrame
+    {
+        const Chunk* chunk;
+        const NativeCode* native;
+        const uint32_t* pc;
+        Cons* env;
+        size_t env_slot;
+    };
+
+    struct Body
+    {
+        Chunk chunk;
+        // calls so far, until the body is compiled to machine code
+        size_t calls = 0;
+        std::unique_ptr<NativeCode> native;
+    };
+
+    // Closure bodies are compiled the first time they are called and kept for the rest of the run. The bodies are
+    // kept alive by a list in a root slot, since the chunks point into them.
+    struct ChunkCache
+    {
+        ChunkCache(MemPool& pool) : pool(pool), root(pool.num_roots()) { pool.push_root(pool.nil()); }
+
+        Body* get(Cons* body)
+        {
+            auto& entry = bodies[body];
+            if (!entry)
+            {
+                auto pinned = pool.alloc(body, pool.root(root));
+                if (!pinned)
+                {
+                    bodies.erase(body);
+                    return nullptr;
+                }
+                pool.set_root(root, pinned);
+                entry = std::make_unique<Body>();
+                compile(body, entry->chunk, pool);
+            }
+            return entry.get();
+        }
+
+        MemPool& pool;
+        size_t root;
+        std::unordered_map<Cons*, std::unique_ptr<Body>> bodies;
+    };
+
+    // What calls and returns change. The loop in run_bytecode keeps the current call in locals and copies it in and
+    // out around them; machine code reaches it through the hooks below.
+    struct Vm
+    {
+        Vm(MemPool& pool)
+            : pool(pool), cache(pool), profiler(pool.profiler()), profile_base(profiler ? profiler->depth() : 0),
+              jit(pool.jit())
+        {
+            frame.pool = &pool;
+            frame.vm = this;
+        }
+
+        // Calls the closure below the top count operands, replacing the current call if tail, or else returning to
+        // pc. Returns false if the call fails.
+        bool call(size_t count, bool tail);
+        // Returns the value on top of the operands to the caller. Returns false if there is none, and the value is
+        // the result of the run.
+        bool ret();
+        // Sets the frame up for the current chunk's machine code, and returns its entry at pc, or nullptr if it has
+        // none.
+        const uint8_t* native_entry();
+
+        MemPool& pool;
+        ChunkCache cache;
+        std::vector<CallFrame> frames;
+        // Every call below the top chunk has an entry on the profiler's stack, as does the top chunk itself once it
+        // has tail called a closure; leaving unwinds back to where this run started.
+        Profiler* profiler;
+        size_t profile_base;
+        Jit* jit;
+
+        const Chunk* chunk = nullptr;
+        // the machine code of the current chunk, if it has been compiled
+        const NativeCode* native = nullptr;
+        const uint32_t* pc = nullptr;
+        Cons* env = nullptr;
+        // the root slot holding the current call's scope; its operands are above it
+        size_t env_slot = 0;
+        Cons* result = nullptr;
+
+        NativeFrame frame{};
+        // set by the hooks when they stop machine code because a call failed, or the run returned its result
+        bool failed = false;
+        bool done = false;
+    };
+
+    const NativeHooks hooks = {
+        [](NativeFrame* frame, uint32_t count, uint32_t depth, uint32_t resume) -> const uint8_t* {
+            auto& vm = *static_cast<Vm*>(frame->vm);
+            vm.pool.truncate_roots(vm.env_slot + 1 + depth);
+            vm.env = frame->env;
+            vm.pc = vm.chunk->code.data() + resume;
+            vm.failed = !vm.call(count, false);
+            if (vm.failed) return nullptr;
+            auto entry = vm.native_entry();
+            if (entry) ++vm.jit->stats.native_calls;
+            return entry;
+        },
+        [](NativeFrame* frame, uint32_t count, uint32_t depth) -> const uint8_t* {
+            auto& vm = *static_cast<Vm*>(frame->vm);
+            vm.pool.truncate_roots(vm.env_slot + 1 + depth);
+            vm.env = frame->env;
+            vm.failed = !vm.call(count, true);
+            if (vm.failed) return nullptr;
+            auto entry = vm.native_entry();
+            if (entry) ++vm.jit->stats.native_calls;
+            return entry;
+        },
+        [](NativeFrame* frame, uint32_t depth) -> const uint8_t* {
+            auto& vm = *static_cast<Vm*>(frame->vm);
+            vm.pool.truncate_roots(vm.env_slot + 1 + depth);
+            vm.env = frame->env;
+            vm.done = !vm.ret();
+            return vm.done ? nullptr : vm.native_entry();
+        },
+    };
+}
+
+bool Vm::call(size_t count, bool tail)
+{
+    auto func_slot = pool.num_roots() - count - 1;
+    auto func = pool.root(func_slot);
+    if (!func->is_closure() || closure_arity(func) != count) return false;
+
+    auto frame = pool.alloc_block(Tag::Frame, count + 1, closure_scope(func));
+    if (!frame) return false;
+    if (profiler)
+    {
+        if (tail && profiler->depth() > profile_base) profiler->leave(pool);
+        profiler->enter_closure(closure_lambda(func), pool);
+    }
+    for (size_t i = 0; i < count; ++i)
+        frame->slot(i + 1) = pool.root(func_slot + 1 + i);
+    pool.set_root(func_slot, frame);
+    auto body = cache.get(closure_body(func));
+    if (!body) return false;
+    if (jit && !body->native && ++body->calls == jit->threshold)
+    {
+        body->native = compile_native(body->chunk, pool, hooks);
+        if (body->native) ++jit->stats.compiled;
+    }
+
+    if (tail)
+    {
+        // the caller's operands and any let frames it entered are dead
+        pool.set_root(env_slot, frame);
+    }
+    else
+    {
+        frames.push_back({chunk, native, pc, env, env_slot});
+        env_slot = func_slot;
+    }
+    pool.truncate_roots(env_slot + 1);
+    chunk = &body->chunk;
+    native = body->native.get();
+    pc = chunk->code.data();
+    env = frame;
+    return true;
+}
+
+bool Vm::ret()
+{
+    auto v = pool.root(pool.num_roots() - 1);
+    pool.pop_root();
+    if (frames.empty())
+    {
+        result = v;
+        return false;
+    }
+    pool.pop_push_root(v);
+    if (profiler) profiler->leave(pool);
+    chunk = frames.back().chunk;
+    native = frames.back().native;
+    pc = frames.back().pc;
+    env = frames.back().env;
+    env_slot = frames.back().env_slot;
+    frames.pop_back();
+    return true;
+}
+
+const uint8_t* Vm::native_entry()
+{
+    if (!native) return nullptr;
+    auto entry = native->entry(static_cast<uint32_t>(pc - chunk->code.data()));
+    if (!entry) return nullptr;
+    frame.env = env;
+    frame.env_slot = env_slot;
+    frame.max_depth = native->max_depth();
+    pool.resize_roots(env_slot + 1 + frame.max_depth);
+    frame.operands = pool.root_data() + env_slot + 1;
+    return entry;
+}
+
+#if defined(__GNUC__)
+#define VM_DISPATCH() goto* dispatch[*pc++]
+#define VM_CASE(OP) op_##OP:
+#else
+#define VM_DISPATCH() continue
+#define VM_CASE(OP) case Op::OP:
+#endif
+
+// The current frame's scope is kept in a root slot below its operands; every other value the VM holds is on the root
+// stack as well, so allocating can never free anything in use.
+Cons* rlisp::run_bytecode(Cons* code, Cons* scope, MemPool& pool)
+{
+    auto base = pool.num_roots();
+    Vm vm(pool);
+    Chunk top;
+    compile(code, top, pool);
+
+    const Chunk* chunk = &top;
+    const NativeCode* native = nullptr;
+    const uint32_t* pc = top.code.data();
+    Cons* env = scope;
+    size_t env_slot = pool.num_roots();
+    pool.push_root(env);
+    Cons* result = nullptr;
+
+    auto save = [&] {
+        vm.chunk = chunk;
+        vm.native = native;
+        vm.pc = pc;
+        vm.env = env;
+        vm.env_slot = env_slot;
+    };
+    auto load = [&] {
+        chunk = vm.chunk;
+        native = vm.native;
+        pc = vm.pc;
+        env = vm.env;
+        env_slot = vm.env_slot;
+    };
+
+    auto profiler = vm.profiler;
+    auto calls = pool.call_cache();
+
+    auto nil = pool.nil();
+    auto t = pool.symbols().t;
+    auto pop = [&pool] {
+        auto v = pool.root(pool.num_roots() - 1);
+        pool.pop_root();
+        return v;
+    };
+    // pops the right operand and leaves the left one in place for the result to replace
+    auto fixnum_operands = [&](int64_t& a, int64_t& b) {
+        auto y = pop();
+        auto x = pool.root(pool.num_roots() - 1);
+        if (!is_fixnum(x) || !is_fixnum(y)) return false;
+        a = fixnum_value(x);
+        b = fixnum_value(y);
+        return true;
+    };
+
+#if defined(__GNUC__)
+    // must match the order of Op
+    static const void* const dispatch[] = {
+        &&op_Const,
+        &&op_Local,
+        &&op_Global,
+        &&op_Function,
+        &&op_Fail,
+        &&op_JumpIfNil,
+        &&op_Jump,
+        &&op_Cons,
+        &&op_Car,
+        &&op_Cdr,
+        &&op_Eq,
+        &&op_Add,
+        &&op_Sub,
+        &&op_Mul,
+        &&op_Lt,
+        &&op_Gt,
+        &&op_NumEq,
+        &&op_VectorRef,
+        &&op_VectorSet,
+        &&op_VectorLength,
+        &&op_Lambda,
+        &&op_LetEnter,
+        &&op_SetLocal,
+        &&op_LetLeave,
+        &&op_CallBuiltin,
+        &&op_Call,
+        &&op_TailCall,
+        &&op_Return,
+    };
+    VM_DISPATCH();
+#else
+    for (;;)
+        switch (static_cast<Op>(*pc++))
+        {
+#endif
+    VM_CASE(Const)
+    {
+        pool.push_root(chunk->constants[*pc++]);
+        VM_DISPATCH();
+    }
+    VM_CASE(Local)
+    {
+        auto v = lookup_local(pc[0], pc[1], env);
+        pc += 2;
+        if (!v) goto fail;
+        pool.push_root(v);
+        VM_DISPATCH();
+    }
+    VM_CASE(Global)
+    {
+        auto v = lookup_free(chunk->constants[*pc++], env);
+        if (!v) goto fail;
+        pool.push_root(v);
+        VM_DISPATCH();
+    }
+    VM_CASE(Function)
+    {
+        auto form = chunk->constants[*pc++];
+        auto v = calls ? calls->find(form) : nullptr;
+        if (!v)
+        {
+            v = lookup_free(form->car, env);
+            if (!v) goto fail;
+            if (calls) calls->fill(form, env, v);
+        }
+        pool.push_root(v);
+        VM_DISPATCH();
+    }
+    VM_CASE(Fail) { goto fail; }
+    VM_CASE(JumpIfNil)
+    {
+        auto target = *pc++;
+        if (pop() == nil) pc = chunk->code.data() + target;
+        VM_DISPATCH();
+    }
+    VM_CASE(Jump)
+    {
+        pc = chunk->code.data() + *pc;
+        VM_DISPATCH();
+    }
+    VM_CASE(Cons)
+    {
+        // both operands stay rooted until the pair exists
+        auto n = pool.num_roots();
+        auto c = pool.cons(pool.root(n - 2), pool.root(n - 1));
+        if (!c) goto fail;
+        pool.pop_root();
+        pool.pop_push_root(c);
+        VM_DISPATCH();
+    }
+    VM_CASE(Car)
+    {
+        auto x = pool.root(pool.num_roots() - 1);
+        if (!x->is_cons()) goto fail;
+        pool.pop_push_root(x->car);
+        VM_DISPATCH();
+    }
+    VM_CASE(Cdr)
+    {
+        auto x = pool.root(pool.num_roots() - 1);
+        if (!x->is_cons()) goto fail;
+        pool.pop_push_root(x->cdr);
+        VM_DISPATCH();
+    }
+    VM_CASE(Eq)
+    {
+        auto b = pop();
+        auto a = pool.root(pool.num_roots() - 1);
+        pool.pop_push_root(a == b ? t : nil);
+        VM_DISPATCH();
+    }
+    VM_CASE(Add)
+    {
+        int64_t a, b;
+        if (!fixnum_operands(a, b) || !fixnum_in_range(a + b)) goto fail;
+        pool.pop_push_root(make_fixnum(a + b));
+        VM_DISPATCH();
+    }
+    VM_CASE(Sub)
+    {
+        int64_t a, b;
+        if (!fixnum_operands(a, b) || !fixnum_in_range(a - b)) goto fail;
+        pool.pop_push_root(make_fixnum(a - b));
+        VM_DISPATCH();
+    }
+    VM_CASE(Mul)
+    {
+        int64_t a, b, r;
+        if (!fixnum_operands(a, b) || !fixnum_mul(a, b, r)) goto fail;
+        pool.pop_push_root(make_fixnum(r));
+        VM_DISPATCH();
+    }
+    VM_CASE(Lt)
+    {
+        int64_t a, b;
+        if (!fixnum_operands(a, b)) goto fail;
+        pool.pop_push_root(a < b ? t : nil);
+        VM_DISPATCH();
+    }
+    VM_CASE(Gt)
+    {
+        int64_t a, b;
+        if (!fixnum_operands(a, b)) goto fail;
+        pool.pop_push_root(a > b ? t : nil);
+        VM_DISPATCH();
+    }
+    VM_CASE(NumEq)
+    {
+        int64_t a, b;
+        if (!fixnum_operands(a, b)) goto fail;
+        pool.pop_push_root(a == b ? t : nil);
+        VM_DISPATCH();
+    }
+    VM_CASE(VectorRef)
+    {
+        auto k = pop();
+        auto v = pool.root(pool.num_roots() - 1);
+        size_t i;
+        if (!vector_index(v, k, i)) goto fail;
+        pool.pop_push_root(v->slot(i));
+        VM_DISPATCH();
+    }
+    VM_CASE(VectorSet)
+    {
+        auto x = pop();
+        auto k = pop();
+        auto v = pool.root(pool.num_roots() - 1);
+        size_t i;
+        if (!vector_index(v, k, i)) goto fail;
+        pool.set_slot(v, i, x);
+        pool.pop_push_root(x);
+        VM_DISPATCH();
+    }
+    VM_CASE(VectorLength)
+    {
+        auto v = pool.root(pool.num_roots() - 1);
+        if (!v->is_vector()) goto fail;
+        pool.pop_push_root(make_fixnum(static_cast<int64_t>(v->block_size)));
+        VM_DISPATCH();
+    }
+    VM_CASE(Lambda)
+    {
+        auto x = make_closure(chunk->constants[*pc++], env, pool);
+        if (!x) goto fail;
+        pool.push_root(x);
+        VM_DISPATCH();
+    }
+    VM_CASE(LetEnter)
+    {
+        auto frame = pool.alloc_block(Tag::Frame, *pc++ + 1, env);
+        if (!frame) goto fail;
+        pool.push_root(frame);
+        env = frame;
+        VM_DISPATCH();
+    }
+    VM_CASE(SetLocal)
+    {
+        pool.set_slot(env, *pc++ + 1, pop());
+        VM_DISPATCH();
+    }
+    VM_CASE(LetLeave)
+    {
+        auto v = pop();
+        env = env->slot(0);
+        pool.pop_push_root(v);
+        VM_DISPATCH();
+    }
+    VM_CASE(CallBuiltin)
+    {
+        auto func = pool.root(pool.num_roots() - 1);
+        if (func->is_builtin())
+        {
+            // builtins take the form unevaluated and evaluate what they need with the tree walker
+            auto form = chunk->constants[pc[0]];
+            if (profiler) profiler->enter_builtin(func, form, pool);
+            auto v = func->builtin(form, env, pool);
+            if (!v) goto fail;
+            if (profiler) profiler->leave(pool);
+            pool.pop_push_root(v);
+            pc = chunk->code.data() + pc[1];
+        }
+        else
+            pc += 2;
+        VM_DISPATCH();
+    }
+    VM_CASE(Call)
+    VM_CASE(TailCall)
+    {
+        bool tail = static_cast<Op>(pc[-1]) == Op::TailCall;
+        size_t count = *pc++;
+        save();
+        if (!vm.call(count, tail)) goto fail;
+        load();
+#if defined(RLISP_JIT)
+        if (native) goto run_native;
+#endif
+        VM_DISPATCH();
+    }
+    VM_CASE(Return)
+    {
+        save();
+        if (!vm.ret())
+        {
+            result = vm.result;
+            goto done;
+        }
+        load();
+#if defined(RLISP_JIT)
+        if (native) goto run_native;
+#endif
+        VM_DISPATCH();
+    }
+#if defined(RLISP_JIT)
+    // The current chunk has machine code, which runs from pc if it can be entered there. Its calls and returns go
+    // on in machine code as long as the chunks they reach have it, and when it stops the VM takes over from wherever
+    // they left off.
+run_native:
+    save();
+    if (auto entry = vm.native_entry())
+    {
+        ++vm.jit->stats.entries;
+        if (!native->run(vm.frame, entry) || vm.failed) goto fail;
+        if (vm.done)
+        {
+            result = vm.result;
+            goto done;
+        }
+        load();
+    }
+    VM_DISPATCH();
+#endif
+#if !defined(__GNUC__)
+        }
+#endif
+
+fail:
+    result = nullptr;
+done:
+    if (profiler) profiler->unwind(vm.profile_base, pool);
+    pool.truncate_roots(base);
+    return result;
+}
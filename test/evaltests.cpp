@@ -1,50 +1,87 @@
 #include "cons.h"
 #include "eval.h"
+#include "jit.h"
 #include "mempool.h"
 #include "parser.h"
+#include "printer.h"
 #include "testutil.h"
 #include "vcpkgparser.h"
 #include <gtest/gtest.h>
 
 using namespace rlisp;
 
+namespace
+{
+    struct EngineRun
+    {
+        rlisp::Engine engine;
+        // compile every closure body to machine code the first time the VM calls it
+        bool jit;
+        const char* name;
+    };
+}
+
+// every expression is evaluated by each engine, which must agree
+static const EngineRun engines[] = {
+    {rlisp::Engine::TreeWalker, false, "tree walker"},
+    {rlisp::Engine::Bytecode, false, "bytecode"},
+    {rlisp::Engine::Bytecode, true, "native"},
+};
+
+static rlisp::Cons* eval_with(rlisp::Cons* e, rlisp::MemPool& pool, const EngineRun& run)
+{
+    rlisp::Jit jit(1);
+    if (run.jit) pool.set_jit(&jit);
+    auto v = rlisp::eval(e, pool, run.engine);
+    pool.set_jit(nullptr);
+    return v;
+}
+
 static void expect_eval(
     const char* e1, const char* e2, rlisp::MemPool& pool, const char* filename, unsigned long lineno)
 {
-    auto expect_eval_e1 = rlisp::parse(e1, pool);
-    if (expect_eval_e1 == nullptr)
-    {
-        ADD_FAILURE_AT(filename, lineno) << "Parse of e1 failed";
-        return;
-    }
-    auto expect_eval_e2 = rlisp::parse(e2, pool);
-    if (expect_eval_e2 == nullptr)
+    for (auto engine : engines)
     {
-        ADD_FAILURE_AT(filename, lineno) << "Parse of e2 failed";
-        return;
+        auto expect_eval_e1 = rlisp::parse(e1, pool);
+        if (expect_eval_e1 == nullptr)
+        {
+            ADD_FAILURE_AT(filename, lineno) << "Parse of e1 failed";
+            return;
+        }
+        auto expect_eval_e2 = rlisp::parse(e2, pool);
+        if (expect_eval_e2 == nullptr)
+        {
+            ADD_FAILURE_AT(filename, lineno) << "Parse of e2 failed";
+            return;
+        }
+        pool.push_root(expect_eval_e2);
+        auto expect_eval_e3 = eval_with(expect_eval_e1, pool, engine);
+        pool.pop_root();
+        if (expect_eval_e3 == nullptr)
+        {
+            ADD_FAILURE_AT(filename, lineno) << "Eval of e1 failed (" << engine.name << ")";
+            continue;
+        }
+        SCOPED_TRACE(engine.name);
+        expect_structural_eq(expect_eval_e3, expect_eval_e2, filename, lineno);
     }
-    auto expect_eval_e3 = rlisp::eval(expect_eval_e1, pool);
-    if (expect_eval_e3 == nullptr)
-    {
-        ADD_FAILURE_AT(filename, lineno) << "Eval of e1 failed";
-        return;
-    }
-    expect_structural_eq(expect_eval_e3, expect_eval_e2, filename, lineno);
 }
 
 static void expect_eval_fail(const char* e1, rlisp::MemPool& pool, const char* filename, unsigned long lineno)
 {
-    auto expect_eval_e1 = rlisp::parse(e1, pool);
-    if (expect_eval_e1 == nullptr)
-    {
-        ADD_FAILURE_AT(filename, lineno) << "Parse of e1 failed";
-        return;
-    }
-    auto expect_eval_e3 = rlisp::eval(expect_eval_e1, pool);
-    if (expect_eval_e3 != nullptr)
+    for (auto engine : engines)
     {
-        ADD_FAILURE_AT(filename, lineno) << "Eval of e1 succeded in error";
-        return;
+        auto expect_eval_e1 = rlisp::parse(e1, pool);
+        if (expect_eval_e1 == nullptr)
+        {
+            ADD_FAILURE_AT(filename, lineno) << "Parse of e1 failed";
+            return;
+        }
+        auto expect_eval_e3 = eval_with(expect_eval_e1, pool, engine);
+        if (expect_eval_e3 != nullptr)
+        {
+            ADD_FAILURE_AT(filename, lineno) << "Eval of e1 succeded in error (" << engine.name << ")";
+        }
     }
 }
 
@@ -127,6 +164,313 @@ TEST(Eval, Eval)
     EXPECT_EQ(mempool.num_roots(), 0);
 }
 
+TEST(Eval, LexicalScope)
+{
+    rlisp::MemPool mempool;
+    EXPECT_EVAL("((lambda (x) ((lambda (y) (cons x y)) 'b)) 'a)", "(a . b)", mempool);
+    EXPECT_EVAL("((lambda (x) ((lambda (x) x) 'b)) 'a)", "b", mempool);
+    EXPECT_EVAL("(let ((a 'x)) (let ((a 'y) (b a)) (cons a b)))", "(y . y)", mempool);
+    EXPECT_EVAL("(let ((a 'x) (a (cons a a))) a)", "(x . x)", mempool);
+    EXPECT_EVAL("(let ((f (let ((a 'x)) (lambda () a)))) (f))", "x", mempool);
+    EXPECT_EVAL("(let () 'a)", "a", mempool);
+
+    // locals shadow special forms and builtins
+    EXPECT_EVAL("(let ((car cdr)) (car '(a b)))", "(b)", mempool);
+    EXPECT_EVAL("((lambda (cond) (cond (cons t nil))) car)", "t", mempool);
+
+    // a binding is not visible to the values bound before it
+    EXPECT_EVAL_FAIL("(let ((a b) (b 'x)) a)", mempool);
+    EXPECT_EVAL_FAIL("((lambda (a) a))", mempool);
+    EXPECT_EVAL_FAIL("((lambda (a) a) 'x 'y)", mempool);
+
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Eval, Closures)
+{
+    rlisp::MemPool mempool;
+    EXPECT_EVAL("((lambda () 'a))", "a", mempool);
+    EXPECT_EVAL("((lambda (a b c d e) (cons e (cons d (cons c (cons b a))))) 1 2 3 4 5)", "(5 4 3 2 . 1)", mempool);
+    // a closure is an object of its own, not a list
+    EXPECT_EVAL_FAIL("(car (lambda (x) x))", mempool);
+    EXPECT_EVAL("(eq (lambda (x) x) (lambda (x) x))", "nil", mempool);
+    EXPECT_EVAL("(let ((f (lambda (x) x))) (eq f f))", "t", mempool);
+    // a one-shot eval cannot return a closure or builtin, whose global scope it destroys
+    EXPECT_EVAL_FAIL("(lambda (x) x)", mempool);
+    EXPECT_EVAL_FAIL("car", mempool);
+    EXPECT_EVAL_FAIL("((lambda (f) f) (lambda (x) x))", mempool);
+
+    // the shape of a lambda is checked when it is evaluated rather than each time it is applied
+    EXPECT_EVAL_FAIL("(cond ((lambda (x)) 'a))", mempool);
+    EXPECT_EVAL_FAIL("(cond ((lambda (x) x x) 'a))", mempool);
+    EXPECT_EVAL_FAIL("(cond ((lambda ('x) x) 'a))", mempool);
+    EXPECT_EVAL_FAIL("(cond ((lambda (x . y) x) 'a))", mempool);
+    EXPECT_EVAL("(cond ((lambda (x) (car)) 'a))", "a", mempool);
+
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Eval, SmallPool)
+{
+    rlisp::MemPool mempool(32);
+    for (int x = 0; x < 10; ++x)
+    {
+        EXPECT_EVAL(R"(
+        (let
+         ((rev (lambda
+                (rev xs acc)
+                (cond
+                 (xs (rev rev (cdr xs) (cons (car xs) acc)))
+                 (t acc)))))
+         (rev rev '(1 2 3 4 5 6 7 8) nil))
+        )",
+                    "(8 7 6 5 4 3 2 1)",
+                    mempool);
+    }
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Eval, Engines)
+{
+    rlisp::MemPool mempool;
+    // builtins passed around as values still take their arguments unevaluated
+    EXPECT_EVAL("(((lambda (f) f) car) '(a b))", "a", mempool);
+    EXPECT_EVAL("((lambda (f) (f 'x)) quote)", "(quote x)", mempool);
+
+    // malformed forms only fail when they are evaluated
+    EXPECT_EVAL("(cond (t 'a) (cons))", "a", mempool);
+    EXPECT_EVAL("(cond (nil (car)) (t 'b))", "b", mempool);
+    EXPECT_EVAL_FAIL("(cond (nil 'a))", mempool);
+    EXPECT_EVAL_FAIL("(cond (nil 'a) . b)", mempool);
+    EXPECT_EVAL_FAIL("(let ((a 'x)) (a))", mempool);
+    EXPECT_EVAL_FAIL("((lambda (x) x) . a)", mempool);
+    EXPECT_EVAL_FAIL("(car (cdr (cons 'a 'b)))", mempool);
+
+    // builtins and special forms cannot be redefined, which the engines that compile them inline rely on
+    EXPECT_EVAL_FAIL("(let ((x (define car cdr))) (car '(a b)))", mempool);
+    EXPECT_EVAL_FAIL("(let ((x (define cons (lambda (a b) a)))) (cons 'x 'y))", mempool);
+    EXPECT_EVAL_FAIL("(let ((x (define let (lambda (a b) b)))) (let 'x 'y))", mempool);
+    EXPECT_EVAL_FAIL("(define define 'a)", mempool);
+    EXPECT_EVAL_FAIL("(define vector-ref 'a)", mempool);
+    EXPECT_EVAL("(let ((x (define first car))) (cons (first '(a b)) (car '(c d))))", "(a . c)", mempool);
+
+    // a closure made by one call is applied by another
+    EXPECT_EVAL(R"(
+    (let
+     ((compose (lambda (f g) (lambda (x) (f (g x)))))
+      (second (compose (lambda (x) (car x)) (lambda (x) (cdr x)))))
+     (cons (second '(a b c)) (second '(d e f))))
+    )",
+                "(b . e)",
+                mempool);
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Eval, EnginesUnderCollection)
+{
+    // values stored into a frame after it has been promoted must survive later collections
+    rlisp::MemPool mempool(16);
+    for (int x = 0; x < 4; ++x)
+    {
+        EXPECT_EVAL(R"(
+        (let
+         ((build (lambda (build n acc)
+                  (cond
+                   (n (build build (cdr n) (cons (cons (car n) acc) acc)))
+                   (t acc))))
+          (a (build build '(1 2 3 4 5 6) nil))
+          (b (build build '(u v w x y z) nil)))
+         (cons (car (car a)) (car (car b))))
+        )",
+                    "(6 . z)",
+                    mempool);
+    }
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Eval, Fixnums)
+{
+    rlisp::MemPool mempool;
+    EXPECT_EVAL("42", "42", mempool);
+    EXPECT_EVAL("'(1 . 2)", "(1 . 2)", mempool);
+    EXPECT_EVAL("(+ 1 2)", "3", mempool);
+    EXPECT_EVAL("(+)", "0", mempool);
+    EXPECT_EVAL("(+ 1 2 3 4)", "10", mempool);
+    EXPECT_EVAL("(- 5)", "-5", mempool);
+    EXPECT_EVAL("(- 5 7)", "-2", mempool);
+    EXPECT_EVAL("(- 10 1 2)", "7", mempool);
+    EXPECT_EVAL("(* 6 7)", "42", mempool);
+    EXPECT_EVAL("(* -2 3 4)", "-24", mempool);
+    EXPECT_EVAL("(< 1 2)", "t", mempool);
+    EXPECT_EVAL("(< 2 1)", "nil", mempool);
+    EXPECT_EVAL("(> 2 1)", "t", mempool);
+    EXPECT_EVAL("(= 3 3)", "t", mempool);
+    EXPECT_EVAL("(= 3 4)", "nil", mempool);
+    EXPECT_EVAL("(eq 3 3)", "t", mempool);
+    EXPECT_EVAL("(let ((x 5)) (* x (+ x 1)))", "30", mempool);
+    EXPECT_EVAL("((lambda (f) (f 2 3)) +)", "5", mempool);
+
+    EXPECT_EVAL_FAIL("(+ 1 'a)", mempool);
+    EXPECT_EVAL_FAIL("(< 1)", mempool);
+    EXPECT_EVAL_FAIL("(- 1 2 . 3)", mempool);
+    EXPECT_EVAL_FAIL("(-)", mempool);
+    EXPECT_EVAL_FAIL("(car 1)", mempool);
+    EXPECT_EVAL_FAIL("(1 2)", mempool);
+    EXPECT_EVAL_FAIL("((lambda (1) 1) 2)", mempool);
+    EXPECT_EVAL_FAIL("(let ((1 2)) 1)", mempool);
+
+    // results outside the fixnum range fail instead of wrapping
+    auto max = std::to_string(rlisp::fixnum_max);
+    auto min = std::to_string(rlisp::fixnum_min);
+    auto half = std::to_string(rlisp::fixnum_max / 2 + 1);
+    EXPECT_EVAL(("(+ " + std::to_string(rlisp::fixnum_max - 1) + " 1)").c_str(), max.c_str(), mempool);
+    EXPECT_EVAL_FAIL(("(+ " + max + " 1)").c_str(), mempool);
+    EXPECT_EVAL_FAIL(("(- " + min + " 1)").c_str(), mempool);
+    EXPECT_EVAL_FAIL(("(- " + min + ")").c_str(), mempool);
+    EXPECT_EVAL_FAIL(("(* " + half + " " + half + " " + half + ")").c_str(), mempool);
+    EXPECT_EVAL_FAIL(("(* " + half + " 2)").c_str(), mempool);
+    // products are checked exactly, so the ends of the range are reached but not passed
+    EXPECT_EVAL(("(* " + min + " 1)").c_str(), min.c_str(), mempool);
+    EXPECT_EVAL(("(* 1 " + min + ")").c_str(), min.c_str(), mempool);
+    EXPECT_EVAL(("(* " + half + " -2)").c_str(), min.c_str(), mempool);
+    EXPECT_EVAL(("(* " + max + " -1)").c_str(), ("-" + max).c_str(), mempool);
+    EXPECT_EVAL_FAIL(("(* " + min + " -1)").c_str(), mempool);
+    EXPECT_EVAL_FAIL(("(* -1 " + min + ")").c_str(), mempool);
+    EXPECT_EVAL_FAIL(("(* " + min + " " + min + ")").c_str(), mempool);
+    // the same inside closures, which the native engine compiles
+    EXPECT_EVAL(("((lambda (x y) (* x y)) " + min + " 1)").c_str(), min.c_str(), mempool);
+    EXPECT_EVAL(("((lambda (x y) (* x y)) 1 " + min + ")").c_str(), min.c_str(), mempool);
+    EXPECT_EVAL_FAIL(("((lambda (x y) (* x y)) " + min + " -1)").c_str(), mempool);
+    EXPECT_EVAL_FAIL(("((lambda (x y) (* x y)) -1 " + min + ")").c_str(), mempool);
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Eval, Vectors)
+{
+    rlisp::MemPool mempool;
+    // literals evaluate to themselves, without evaluating their elements
+    EXPECT_EVAL("#(1 2 3)", "#(1 2 3)", mempool);
+    EXPECT_EVAL("#(a (car b) #())", "#(a (car b) #())", mempool);
+    EXPECT_EVAL("'#(a)", "#(a)", mempool);
+    EXPECT_EVAL("(make-vector 3)", "#(nil nil nil)", mempool);
+    EXPECT_EVAL("(make-vector 2 (cons 'a 'b))", "#((a . b) (a . b))", mempool);
+    EXPECT_EVAL("(make-vector 0 'x)", "#()", mempool);
+    EXPECT_EVAL("(vector-length (make-vector 5 0))", "5", mempool);
+    EXPECT_EVAL("(vector-length #())", "0", mempool);
+    EXPECT_EVAL("(vector-ref #(a b c) 2)", "c", mempool);
+    EXPECT_EVAL("(let ((v (make-vector 3 0))) (cons (vector-set! v 1 'x) v))", "(x . #(0 x 0))", mempool);
+    // the elements of one vector are the same objects
+    EXPECT_EVAL("(let ((v (make-vector 2 (cons 1 2)))) (eq (vector-ref v 0) (vector-ref v 1)))", "t", mempool);
+
+    EXPECT_EVAL_FAIL("(make-vector)", mempool);
+    EXPECT_EVAL_FAIL("(make-vector -1)", mempool);
+    EXPECT_EVAL_FAIL("(make-vector 'a)", mempool);
+    EXPECT_EVAL_FAIL("(make-vector 1 2 3)", mempool);
+    // compact cells have no fixnum that large
+    if (rlisp::max_vector_length < rlisp::fixnum_max)
+        EXPECT_EVAL_FAIL(("(make-vector " + std::to_string(rlisp::max_vector_length + 1) + ")").c_str(), mempool);
+    EXPECT_EVAL_FAIL("(vector-ref #(a))", mempool);
+    EXPECT_EVAL_FAIL("(vector-ref #(a) 1)", mempool);
+    EXPECT_EVAL_FAIL("(vector-ref #(a) -1)", mempool);
+    EXPECT_EVAL_FAIL("(vector-ref #(a) 'a)", mempool);
+    EXPECT_EVAL_FAIL("(vector-ref '(a) 0)", mempool);
+    EXPECT_EVAL_FAIL("(vector-set! #(a) 1 'b)", mempool);
+    EXPECT_EVAL_FAIL("(vector-set! #(a) 0)", mempool);
+    EXPECT_EVAL_FAIL("(vector-length '(a))", mempool);
+    EXPECT_EVAL_FAIL("(vector-length #() #())", mempool);
+    EXPECT_EVAL_FAIL("(car #(a))", mempool);
+
+    // the same inside closures, which the native engine compiles
+    EXPECT_EVAL("((lambda (v i) (vector-ref v i)) #(a b c) 1)", "b", mempool);
+    EXPECT_EVAL("((lambda (v) (vector-length v)) (make-vector 7))", "7", mempool);
+    EXPECT_EVAL("((lambda (v i x) (cons (vector-set! v i x) v)) #(a b) 0 'c)", "(c . #(c b))", mempool);
+    EXPECT_EVAL_FAIL("((lambda (v i) (vector-ref v i)) #(a) 1)", mempool);
+    EXPECT_EVAL_FAIL("((lambda (v i) (vector-ref v i)) #(a) -1)", mempool);
+    EXPECT_EVAL_FAIL("((lambda (v i) (vector-ref v i)) '(a) 0)", mempool);
+    EXPECT_EVAL_FAIL("((lambda (v i) (vector-ref v i)) 5 0)", mempool);
+    EXPECT_EVAL_FAIL("((lambda (v) (vector-length v)) 'a)", mempool);
+    EXPECT_EVAL_FAIL("((lambda (v i x) (vector-set! v i x)) #(a) 2 'b)", mempool);
+    EXPECT_EVAL(R"(
+    (let
+     ((fill (lambda (fill v i)
+             (cond
+              ((= i (vector-length v)) v)
+              (t (let ((x (vector-set! v i (* i i)))) (fill fill v (+ i 1)))))))
+      (sum (lambda (sum v i acc)
+            (cond
+             ((= i (vector-length v)) acc)
+             (t (sum sum v (+ i 1) (+ acc (vector-ref v i))))))))
+     (cons (sum sum (fill fill (make-vector 5) 0) 0 0) (fill fill (make-vector 3) 0)))
+    )",
+                "(30 . #(0 1 4))",
+                mempool);
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Eval, VectorsUnderCollection)
+{
+    // the vector outlives many collections, and is promoted, while each round stores new pairs into it
+    for (size_t incremental_step : {0, 16})
+    {
+        rlisp::MemPoolConfig config;
+        config.initial_cells = 256;
+        config.incremental_step = incremental_step;
+        rlisp::MemPool mempool(config);
+        EXPECT_EVAL(R"(
+        (let
+         ((fill (lambda (fill v i)
+                 (cond
+                  ((= i (vector-length v)) v)
+                  (t (let ((x (vector-set! v i (cons i (cons i nil))))) (fill fill v (+ i 1)))))))
+          (sum (lambda (sum v i acc)
+                (cond
+                 ((= i (vector-length v)) acc)
+                 (t (sum sum v (+ i 1) (+ acc (car (cdr (vector-ref v i)))))))))
+          (go (lambda (go k v acc)
+               (cond
+                ((= k 0) acc)
+                (t (go go (- k 1) v (+ acc (sum sum (fill fill v 0) 0 0))))))))
+         (go go 20 (make-vector 100) 0))
+        )",
+                    "99000",
+                    mempool);
+        EXPECT_GT(mempool.num_minor_collections(), 0);
+        EXPECT_EQ(mempool.num_roots(), 0);
+    }
+}
+
+TEST(Eval, TailCalls)
+{
+    // far more iterations than would fit on the C++ stack if each took a native frame
+    rlisp::MemPool mempool;
+    EXPECT_EVAL(R"(
+    (let
+     ((dup (lambda
+            (dup xs acc)
+            (cond
+             (xs (dup dup (cdr xs) (cons (car xs) (cons (car xs) acc))))
+             (t acc))))
+      (rev (lambda
+            (rev xs acc)
+            (cond
+             (xs (rev rev (cdr xs) (cons (car xs) acc)))
+             (t acc))))
+      (last (lambda
+             (last xs)
+             (let ((rest (cdr xs)))
+              (cond
+               (rest (last last rest))
+               (t (car xs))))))
+      (big (dup dup (dup dup (dup dup (dup dup (dup dup (dup dup (dup dup (dup dup (dup dup
+            (dup dup (dup dup (dup dup (dup dup (dup dup (dup dup (dup dup (dup dup (dup dup
+             '(a) nil) nil) nil) nil) nil) nil) nil) nil) nil) nil) nil) nil) nil) nil) nil) nil) nil) nil)))
+     (cons (last last big) (last last (rev rev big '(end)))))
+    )",
+                "(a . end)",
+                mempool);
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
 static Cons* parse_eval(const char* src, MemPool& pool)
 {
     auto e = parse(src, pool);
@@ -156,3 +500,414 @@ TEST(MemoryPool, GarbageCollect)
     mempool.pop_root();
     EXPECT_EQ(mempool.num_roots(), 0);
 }
+
+TEST(MemoryPool, GrowsWhenLive)
+{
+    rlisp::MemPool mempool(16);
+    EXPECT_EQ(mempool.num_segments(), 1);
+
+    auto pinned = parse("(a b c d e f g h i j k l m n o p q r s t u v w x y z)", mempool);
+    ASSERT_NE(pinned, nullptr);
+    mempool.push_root(pinned);
+    EXPECT_GT(mempool.num_segments(), 1);
+    EXPECT_GE(mempool.capacity(), 26);
+
+    for (int x = 0; x < 30; ++x)
+    {
+        EXPECT_NE(parse_eval("'(a a a a a a a a a a a a a a a a a a)", mempool), nullptr);
+    }
+    EXPECT_STRUCTURAL_EQ(pinned, parse("(a b c d e f g h i j k l m n o p q r s t u v w x y z)", mempool));
+    mempool.pop_root();
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(MemoryPool, MaxCells)
+{
+    rlisp::MemPoolConfig config;
+    config.initial_cells = 8;
+    config.min_segment_cells = 8;
+    config.max_cells = 24;
+    rlisp::MemPool mempool(config);
+
+    auto pinned = parse("(a b c d e f g h i j k l m n o p q r s t)", mempool);
+    ASSERT_NE(pinned, nullptr);
+    mempool.push_root(pinned);
+    EXPECT_EQ(parse("(a b c d e f g h i j)", mempool), nullptr);
+    EXPECT_EQ(mempool.capacity(), 24);
+    mempool.pop_root();
+
+    EXPECT_NE(parse("(a b c d e f g h i j)", mempool), nullptr);
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(MemoryPool, MinorCollection)
+{
+    rlisp::MemPool mempool(64);
+    auto pinned = parse("(a b c (d e f))", mempool);
+    mempool.push_root(pinned);
+
+    for (int x = 0; x < 100; ++x)
+    {
+        EXPECT_NE(parse_eval("'(a a a a a a a a a a a a a a a a a a)", mempool), nullptr);
+    }
+    EXPECT_GT(mempool.num_minor_collections(), 0);
+    EXPECT_STRUCTURAL_EQ(pinned, parse("(a b c (d e f))", mempool));
+    mempool.pop_root();
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(MemoryPool, WriteBarrier)
+{
+    rlisp::MemPool mempool(64);
+    auto old = mempool.alloc(mempool.intern_atom("x"), mempool.nil());
+    mempool.push_root(old);
+
+    // promote old
+    while (mempool.num_minor_collections() == 0)
+        mempool.alloc(mempool.nil(), mempool.nil());
+    auto minor_collections = mempool.num_minor_collections();
+
+    auto expected = parse("(x y z)", mempool);
+    mempool.push_root(expected);
+    mempool.set_cdr(old, parse("(y z)", mempool));
+    while (mempool.num_minor_collections() < minor_collections + 3)
+        mempool.alloc(mempool.intern_atom("w"), mempool.nil());
+
+    EXPECT_STRUCTURAL_EQ(old, expected);
+    mempool.pop_root();
+    mempool.pop_root();
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(MemoryPool, WriteBarrierBlock)
+{
+    rlisp::MemPool mempool(64);
+    auto frame = mempool.alloc_block(rlisp::Tag::Frame, 3, mempool.nil());
+    mempool.push_root(frame);
+
+    while (mempool.num_minor_collections() == 0)
+        mempool.alloc(mempool.nil(), mempool.nil());
+    auto minor_collections = mempool.num_minor_collections();
+
+    auto expected = parse("(x y z)", mempool);
+    mempool.push_root(expected);
+    mempool.set_slot(frame, 2, parse("(x y z)", mempool));
+    while (mempool.num_minor_collections() < minor_collections + 3)
+        mempool.alloc(mempool.intern_atom("w"), mempool.nil());
+
+    EXPECT_STRUCTURAL_EQ(frame->slot(2), expected);
+    mempool.pop_root();
+    mempool.pop_root();
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(MemoryPool, InternAtoms)
+{
+    rlisp::MemPool mempool;
+    EXPECT_EQ(mempool.intern_atom("nil"), mempool.nil());
+    EXPECT_EQ(mempool.intern_atom("quote"), mempool.symbols().quote);
+
+    // enough names to rehash the table several times
+    std::vector<Cons*> atoms;
+    for (int i = 0; i < 10000; ++i)
+        atoms.push_back(mempool.intern_atom("atom-" + std::to_string(i)));
+    for (int i = 0; i < 10000; ++i)
+    {
+        auto name = "atom-" + std::to_string(i);
+        auto atom = atoms[i];
+        ASSERT_TRUE(atom->is_atom(name.c_str()));
+        ASSERT_EQ(atom->atom->data[name.size()], '\0');
+        ASSERT_EQ(mempool.intern_atom(name), atom);
+    }
+
+    // names are compared by their bytes, not as C strings
+    auto with_nul = mempool.intern_atom(std::string_view("a\0b", 3));
+    EXPECT_NE(with_nul, mempool.intern_atom("a"));
+    EXPECT_EQ(with_nul->atom->size, 3);
+    EXPECT_EQ(mempool.intern_atom(std::string(4096, 'x'))->atom->size, 4096);
+}
+
+TEST(MemoryPool, Stats)
+{
+    rlisp::MemPool mempool(64);
+    std::vector<GcEvent> events;
+    mempool.set_gc_callback([&](const GcEvent& event) { events.push_back(event); });
+
+    auto live = mempool.nil();
+    mempool.push_root(live);
+    mempool.push_root(mempool.nil());
+    mempool.pop_root();
+    for (int i = 0; i < 1000; ++i)
+    {
+        // one cell in ten stays live
+        auto c = mempool.alloc(mempool.nil(), mempool.nil());
+        if (i % 10 == 0)
+        {
+            live = mempool.alloc(c, live);
+            mempool.pop_push_root(live);
+        }
+    }
+    mempool.alloc_block(Tag::Frame, 3, mempool.nil());
+
+    auto& stats = mempool.stats();
+    EXPECT_EQ(stats.allocations, 1101);
+    EXPECT_EQ(stats.cells_allocated, 1100 + Cons::block_cells(3));
+    EXPECT_EQ(stats.max_roots, 2);
+    ASSERT_GT(stats.collections(), 0);
+    // a collection that starts as a minor one and has to trace the whole heap is counted once, as major
+    ASSERT_EQ(events.size(), stats.collections());
+
+    size_t survivors = 0;
+    size_t major = 0;
+    std::chrono::steady_clock::duration pause{};
+    for (auto&& event : events)
+    {
+        survivors += event.survivors;
+        major += event.major;
+        pause += event.pause;
+        EXPECT_LE(event.pause, stats.max_pause);
+        EXPECT_LE(event.survivors, event.capacity);
+    }
+    EXPECT_EQ(survivors, stats.total_survivors);
+    EXPECT_EQ(events.back().survivors, stats.last_survivors);
+    EXPECT_EQ(major, stats.major_collections);
+    EXPECT_EQ(pause, stats.total_pause);
+    EXPECT_GT(stats.last_survivors, 0);
+    mempool.pop_root();
+}
+
+TEST(MemoryPool, DeepCarChain)
+{
+    rlisp::MemPoolConfig config;
+    config.initial_cells = 64;
+    config.generational = false;
+    rlisp::MemPool mempool(config);
+
+    auto deep = mempool.nil();
+    mempool.push_root(deep);
+    for (int x = 0; x < 1000000; ++x)
+    {
+        deep = mempool.alloc(deep, mempool.nil());
+        ASSERT_NE(deep, nullptr);
+        mempool.pop_push_root(deep);
+    }
+    EXPECT_GT(mempool.num_major_collections(), 0);
+
+    int depth = 0;
+    for (auto c = deep; c != mempool.nil(); c = c->car)
+    {
+        ASSERT_TRUE(c->is_cons());
+        ++depth;
+    }
+    EXPECT_EQ(depth, 1000000);
+    mempool.pop_root();
+}
+
+TEST(MemoryPool, MarkStackOverflow)
+{
+    rlisp::MemPoolConfig config;
+    config.initial_cells = 64;
+    config.mark_stack_limit = 2;
+    config.generational = false;
+    rlisp::MemPool mempool(config);
+
+    auto pinned = parse("((a b) ((c d) (e (f (g)))) (h i) j (k (l)))", mempool);
+    mempool.push_root(pinned);
+    for (int x = 0; x < 30; ++x)
+    {
+        EXPECT_NE(parse_eval("'(a a a a a a a a a a a a a a a a a a)", mempool), nullptr);
+    }
+    EXPECT_GT(mempool.num_major_collections(), 0);
+    auto expected = parse("((a b) ((c d) (e (f (g)))) (h i) j (k (l)))", mempool);
+    mempool.push_root(expected);
+    for (int x = 0; x < 30; ++x)
+    {
+        EXPECT_NE(parse_eval("'(a a a a a a a a a a a a a a a a a a)", mempool), nullptr);
+    }
+    EXPECT_STRUCTURAL_EQ(pinned, expected);
+    mempool.pop_root();
+    mempool.pop_root();
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(MemoryPool, IncrementalMarking)
+{
+    for (size_t step : {1, 32, 1000})
+    {
+        for (size_t mark_stack_limit : {2, 4096})
+        {
+            rlisp::MemPoolConfig config;
+            config.initial_cells = 256;
+            config.incremental_step = step;
+            config.mark_stack_limit = mark_stack_limit;
+            rlisp::MemPool mempool(config);
+            const int n = 4000;
+
+            auto list = mempool.nil();
+            mempool.push_root(list);
+            for (int i = 0; i < n; ++i)
+            {
+                list = mempool.alloc(make_fixnum(i), list);
+                ASSERT_NE(list, nullptr);
+                mempool.pop_push_root(list);
+            }
+            // New cells are stored only in old cells, which a trace running meanwhile may have scanned already; the
+            // allocations in between carry the trace on, and the garbage makes them finish some.
+            for (int round = 0; round < 50; ++round)
+            {
+                int k = 0;
+                for (auto c = list; c != mempool.nil(); c = c->cdr, ++k)
+                {
+                    if (k % 7 != round % 7) continue;
+                    auto cell = mempool.alloc(make_fixnum(n - 1 - k), mempool.nil());
+                    ASSERT_NE(cell, nullptr);
+                    mempool.set_car(c, cell);
+                    for (int g = 0; g < 3; ++g)
+                        mempool.alloc(mempool.nil(), mempool.nil());
+                }
+                // a cell lost to a trace is freed by the next major, and later allocations overwrite it
+                int i = 0;
+                for (auto c = list; c != mempool.nil(); c = c->cdr, ++i)
+                {
+                    if (!c->car->is_cons()) continue;
+                    ASSERT_EQ(c->car->car, make_fixnum(n - 1 - i)) << round << ' ' << i;
+                }
+            }
+            EXPECT_GT(mempool.stats().mark_steps, 0);
+            EXPECT_GT(mempool.num_major_collections(), 0);
+
+            int i = 0;
+            for (auto c = list; c != mempool.nil(); c = c->cdr, ++i)
+            {
+                ASSERT_TRUE(c->car->is_cons()) << i;
+                ASSERT_EQ(fixnum_value(c->car->car), n - 1 - i) << i;
+            }
+            EXPECT_EQ(i, n);
+            mempool.pop_root();
+        }
+    }
+
+    // with nothing on the root stack, the end of a trace must still scan what alloc's arguments reach
+    rlisp::MemPoolConfig config;
+    config.initial_cells = 256;
+    config.incremental_step = 4;
+    rlisp::MemPool mempool(config);
+    const int n = 20000;
+    auto list = mempool.nil();
+    for (int i = 0; i < n; ++i)
+    {
+        list = mempool.alloc(make_fixnum(i), list);
+        ASSERT_NE(list, nullptr);
+    }
+    EXPECT_GT(mempool.num_major_collections(), 0);
+    int i = n;
+    for (auto c = list; c != mempool.nil(); c = c->cdr)
+    {
+        ASSERT_TRUE(c->is_cons()) << i;
+        ASSERT_EQ(fixnum_value(c->car), --i);
+    }
+    EXPECT_EQ(i, 0);
+}
+
+TEST(MemoryPool, HashConsing)
+{
+    rlisp::MemPoolConfig config;
+    config.initial_cells = 64;
+    rlisp::MemPool mempool(config);
+    auto a = mempool.intern_atom("a");
+
+    auto shared = mempool.alloc_shared(a, mempool.nil());
+    EXPECT_EQ(mempool.alloc_shared(a, mempool.nil()), shared);
+    EXPECT_NE(mempool.alloc(a, mempool.nil()), shared);
+    EXPECT_EQ(mempool.alloc_shared(make_fixnum(1), shared), mempool.alloc_shared(make_fixnum(1), shared));
+
+    // sharing a value reuses its own pairs where it can, so it allocates nothing
+    auto x = parse("((a) (b c) (b c) . (a))", mempool);
+    mempool.push_root(x);
+    auto allocations = mempool.num_allocations();
+    x = mempool.share(x);
+    mempool.pop_push_root(x);
+    EXPECT_EQ(mempool.num_allocations(), allocations);
+    EXPECT_STRUCTURAL_EQ(x, parse("((a) (b c) (b c) a)", mempool));
+    EXPECT_EQ(x->car, shared);
+    EXPECT_EQ(x->cdr->car, x->cdr->cdr->car);
+    EXPECT_EQ(x->cdr->cdr->cdr, shared);
+    EXPECT_EQ(mempool.share(parse("((b c) (b c) a)", mempool)), x->cdr);
+    EXPECT_EQ(mempool.share(x), x);
+
+    // the table is weak: pairs only it holds are freed, and dropped from it
+    for (int i = 0; i < 1000; ++i)
+        ASSERT_NE(mempool.alloc_shared(make_fixnum(i), mempool.nil()), nullptr);
+    auto count = mempool.num_shared();
+    while (mempool.num_shared() >= count)
+        mempool.alloc(mempool.nil(), mempool.nil());
+    EXPECT_EQ(mempool.share(parse("((a) (b c) (b c) a)", mempool)), x);
+    mempool.pop_root();
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Eval, IncrementalCollection)
+{
+    rlisp::MemPoolConfig config;
+    config.initial_cells = 64;
+    config.incremental_step = 16;
+    rlisp::MemPool mempool(config);
+    for (int x = 0; x < 5; ++x)
+    {
+        EXPECT_EVAL(R"(
+        (let
+         ((build (lambda
+                  (build n acc)
+                  (cond
+                   ((= n 0) acc)
+                   (t (build build (- n 1) (cons n acc))))))
+          (rev (lambda
+                (rev xs acc)
+                (cond
+                 (xs (rev rev (cdr xs) (cons (car xs) acc)))
+                 (t acc)))))
+         (car (rev rev (build build 3000 nil) nil)))
+        )",
+                    "3000",
+                    mempool);
+    }
+    EXPECT_GT(mempool.stats().mark_steps, 0);
+    EXPECT_GT(mempool.num_major_collections(), 0);
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Eval, HashConsing)
+{
+    for (auto hash_consing : {HashConsing::None, HashConsing::Quoted, HashConsing::All})
+    {
+        rlisp::MemPoolConfig config;
+        config.initial_cells = 64;
+        config.hash_consing = hash_consing;
+        rlisp::MemPool mempool(config);
+
+        // quoted constants are the same pairs wherever they are written
+        auto shared = hash_consing == HashConsing::None ? "nil" : "t";
+        EXPECT_EVAL("(eq '(a (b c)) '(a (b c)))", shared, mempool);
+        EXPECT_EVAL("(eq '(a (b c)) (quote (a (b c))))", shared, mempool);
+        EXPECT_EVAL("(eq (car '((b c) d)) (car (cdr '(a (b c)))))", shared, mempool);
+        // and so are pairs from cons under HashConsing::All
+        EXPECT_EVAL("(eq (cons 1 (cons 2 nil)) '(1 2))", hash_consing == HashConsing::All ? "t" : "nil", mempool);
+        EXPECT_EVAL("(cons '(a b) (cons '(a b) nil))", "((a b) (a b))", mempool);
+
+        // sharing survives collections that free the pairs around it
+        EXPECT_EVAL(R"(
+        (let
+         ((build (lambda
+                  (build n acc)
+                  (cond
+                   ((= n 0) acc)
+                   (t (build build (- n 1) (cons (cons 'x (cons n nil)) acc)))))))
+         (car (cdr (build build 2000 nil))))
+        )",
+                    "(x 2)",
+                    mempool);
+        EXPECT_GT(mempool.num_minor_collections(), 0);
+        EXPECT_EVAL("(eq '(a (b c)) '(a (b c)))", shared, mempool);
+        EXPECT_EQ(mempool.num_roots(), 0);
+    }
+}
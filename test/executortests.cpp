@@ -0,0 +1,160 @@
+#include "cons.h"
+#include "copy.h"
+#include "executor.h"
+#include "interpreter.h"
+#include "mempool.h"
+#include "parser.h"
+#include "symtab.h"
+#include "testutil.h"
+#include <gtest/gtest.h>
+
+using namespace rlisp;
+
+TEST(Copy, Values)
+{
+    SymbolTable atoms;
+    MemPool from(MemPoolConfig(), atoms);
+    // a small pool, so that the copies collect it
+    MemPool to(MemPoolConfig{.initial_cells = 64}, atoms);
+
+    const char* sources[] = {"a", "nil", "-12", "(a (b c) . d)", "'((1 2) (3 . 4) ())", "(((((((((x)))))))) . y)"};
+    for (auto src : sources)
+    {
+        auto value = parse(src, from);
+        ASSERT_NE(value, nullptr);
+        from.push_root(value);
+        auto copy = copy_value(value, to);
+        EXPECT_STRUCTURAL_EQ(copy, value);
+        from.pop_root();
+    }
+
+    // a long list, with everything held only by the copy's own root slots while it is built
+    auto list = from.nil();
+    from.push_root(list);
+    for (int i = 0; i < 100000; ++i)
+    {
+        list = from.alloc(make_fixnum(i), list);
+        from.pop_push_root(list);
+    }
+    auto copy = copy_value(list, to);
+    ASSERT_NE(copy, nullptr);
+    to.push_root(copy);
+    for (int i = 0; i < 100000; ++i)
+        to.alloc(to.nil(), to.nil());
+    for (auto c = copy, l = list; l != from.nil(); c = c->cdr, l = l->cdr)
+    {
+        ASSERT_TRUE(c->is_cons());
+        ASSERT_EQ(c->car, l->car);
+    }
+    EXPECT_GT(to.num_minor_collections() + to.num_major_collections(), 0);
+    to.pop_root();
+    from.pop_root();
+    EXPECT_EQ(to.num_roots(), 0);
+}
+
+TEST(Copy, Sharing)
+{
+    SymbolTable atoms;
+    MemPool from(MemPoolConfig(), atoms);
+    MemPool to(MemPoolConfig(), atoms);
+
+    // twenty levels of (x . x) copy as twenty pairs, not a million
+    auto shared = parse("(a b)", from);
+    from.push_root(shared);
+    for (int i = 0; i < 20; ++i)
+    {
+        shared = from.alloc(shared, shared);
+        from.pop_push_root(shared);
+    }
+    auto copy = copy_value(shared, to);
+    ASSERT_NE(copy, nullptr);
+    for (int i = 0; i < 20; ++i)
+    {
+        ASSERT_EQ(copy->car, copy->cdr);
+        copy = copy->car;
+    }
+    EXPECT_STRUCTURAL_EQ(copy, parse("(a b)", from));
+    from.pop_root();
+}
+
+TEST(Copy, Vectors)
+{
+    SymbolTable atoms;
+    Interpreter interp(atoms);
+    MemPool to(MemPoolConfig{.initial_cells = 64}, atoms);
+
+    // the vector holds itself, a list it shares with another slot, and an empty vector
+    auto value = interp.eval(
+        parse("(let ((v (make-vector 4 '(a b)))) (cond ((vector-set! v 3 #()) (vector-set! v 0 v))))", interp.pool()));
+    ASSERT_NE(value, nullptr);
+    interp.pool().push_root(value);
+    auto copy = copy_value(value, to);
+    ASSERT_NE(copy, nullptr);
+    ASSERT_TRUE(copy->is_vector());
+    ASSERT_EQ(copy->block_size, 4u);
+    EXPECT_EQ(copy->slot(0), copy);
+    EXPECT_EQ(copy->slot(1), copy->slot(2));
+    EXPECT_STRUCTURAL_EQ(copy->slot(1), value->slot(1));
+    ASSERT_TRUE(copy->slot(3)->is_vector());
+    EXPECT_EQ(copy->slot(3)->block_size, 0u);
+    interp.pool().pop_root();
+    EXPECT_EQ(to.num_roots(), 0);
+}
+
+TEST(Copy, FailsOnClosures)
+{
+    SymbolTable atoms;
+    Interpreter interp(atoms);
+    MemPool to(MemPoolConfig(), atoms);
+    auto closure = interp.eval(parse("(cons 'a (lambda (x) x))", interp.pool()));
+    ASSERT_NE(closure, nullptr);
+    EXPECT_EQ(copy_value(closure, to), nullptr);
+    EXPECT_EQ(copy_value(interp.eval(parse("car", interp.pool())), to), nullptr);
+    EXPECT_EQ(to.num_roots(), 0);
+}
+
+TEST(Executor, EvalAll)
+{
+    SymbolTable atoms;
+    MemPool pool(MemPoolConfig(), atoms);
+    Executor executor(atoms, 4, MemPoolConfig{.initial_cells = 256});
+    EXPECT_EQ(executor.threads(), 4);
+
+    const char* sum_to = R"(
+        (let ((sum (lambda (sum n acc) (cond ((= n 0) acc) (t (sum sum (- n 1) (+ acc n)))))))
+         (sum sum %d 0)))";
+    std::vector<Cons*> exprs;
+    std::vector<int> expected;
+    for (int i = 0; i < 40; ++i)
+    {
+        char src[256];
+        snprintf(src, sizeof(src), sum_to, i * 100);
+        exprs.push_back(parse(src, pool));
+        pool.push_root(exprs.back());
+        expected.push_back(i * 100 * (i * 100 + 1) / 2);
+    }
+    exprs.push_back(parse("(cons 'a (cons (car '(b)) '(c . d)))", pool));
+    pool.push_root(exprs.back());
+    exprs.push_back(parse("(undefined-function 'a)", pool));
+    pool.push_root(exprs.back());
+    exprs.push_back(parse("(lambda (x) x)", pool));
+    pool.push_root(exprs.back());
+
+    for (auto engine : {Engine::TreeWalker, Engine::Bytecode})
+    {
+        auto values = executor.eval_all(exprs, pool, engine);
+        ASSERT_EQ(values.size(), exprs.size());
+        for (size_t i = 0; i < expected.size(); ++i)
+        {
+            ASSERT_TRUE(is_fixnum(values[i]));
+            EXPECT_EQ(fixnum_value(values[i]), expected[i]);
+        }
+        EXPECT_STRUCTURAL_EQ(values[40], parse("(a b c . d)", pool));
+        EXPECT_EQ(values[41], nullptr);
+        // closures cannot leave their isolate
+        EXPECT_EQ(values[42], nullptr);
+    }
+    for (size_t i = 0; i < executor.threads(); ++i)
+        EXPECT_EQ(executor.isolate(i).pool().num_roots(), 1);
+    EXPECT_EQ(pool.num_roots(), exprs.size());
+}
@@ -0,0 +1,203 @@
+#include "cons.h"
+#include "image.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "testutil.h"
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+using namespace rlisp;
+
+static Cons* parse_eval(const char* src, Interpreter& interp, Engine engine = Engine::TreeWalker)
+{
+    auto e = parse(src, interp.pool());
+    if (e != nullptr)
+        return interp.eval(e, engine);
+    else
+        return nullptr;
+}
+
+static std::string image_path(const char* name) { return testing::TempDir() + name; }
+
+static bool write_bytes(const std::string& path, const std::string& bytes)
+{
+    auto f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    auto written = fwrite(bytes.data(), 1, bytes.size(), f);
+    return fclose(f) == 0 && written == bytes.size();
+}
+
+static std::string read_bytes(const std::string& path)
+{
+    std::string bytes;
+    auto f = fopen(path.c_str(), "rb");
+    if (!f) return bytes;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) != 0)
+        bytes.append(buf, n);
+    fclose(f);
+    return bytes;
+}
+
+TEST(Image, RoundTrip)
+{
+    const char* library[] = {
+        "(define xs '(a (b c) 42 . d))",
+        "(define shared (cons xs xs))",
+        "(define big (cons 1 (cons 2 nil)))",
+        "(define add (lambda (x y) (+ x y)))",
+        "(define make-adder (lambda (n) (lambda (x) (+ x n))))",
+        "(define add5 (make-adder 5))",
+        "(define first car)",
+        "(define vec (let ((v #(1 () (a b)))) (vector-set! v 1 v)))",
+        "(define fib (lambda (n) (cond ((< n 2) n) (t (+ (fib (- n 1)) (fib (- n 2)))))))",
+    };
+    auto path = image_path("rlisp-roundtrip.img");
+    {
+        Interpreter interp;
+        for (auto src : library)
+            ASSERT_NE(parse_eval(src, interp), nullptr) << src;
+        // the limits of this build's fixnums survive the trip
+        ASSERT_TRUE(interp.globals().define(interp.pool().intern_atom("lo"), make_fixnum(fixnum_min)));
+        ASSERT_TRUE(interp.globals().define(interp.pool().intern_atom("hi"), make_fixnum(fixnum_max)));
+        std::string error;
+        ASSERT_TRUE(save_image(path, interp.globals(), interp.pool(), error)) << error;
+    }
+
+    for (auto engine : {Engine::TreeWalker, Engine::Bytecode})
+    {
+        Interpreter interp;
+        auto& pool = interp.pool();
+        std::string error;
+        ASSERT_TRUE(load_image(path, interp.globals(), pool, error)) << error;
+
+        EXPECT_STRUCTURAL_EQ(parse_eval("xs", interp, engine), parse("(a (b c) 42 . d)", pool));
+        // sharing is kept
+        EXPECT_EQ(parse_eval("(eq (car shared) (cdr shared))", interp, engine), pool.symbols().t);
+        EXPECT_EQ(fixnum_value(parse_eval("(add 2 3)", interp, engine)), 5);
+        // a closure over a frame, and one over the global scope that sees later definitions
+        EXPECT_EQ(fixnum_value(parse_eval("(add5 10)", interp, engine)), 15);
+        EXPECT_EQ(fixnum_value(parse_eval("(fib 15)", interp, engine)), 610);
+        EXPECT_EQ(parse_eval("(first xs)", interp, engine), pool.intern_atom("a"));
+        // a vector that holds itself, and an empty one
+        EXPECT_EQ(parse_eval("(eq (vector-ref vec 1) vec)", interp, engine), pool.symbols().t);
+        EXPECT_STRUCTURAL_EQ(parse_eval("(vector-ref vec 2)", interp, engine), parse("(a b)", pool));
+        EXPECT_EQ(fixnum_value(parse_eval("(vector-length (make-vector 0))", interp, engine)), 0);
+        EXPECT_EQ(fixnum_value(parse_eval("lo", interp, engine)), fixnum_min);
+        EXPECT_EQ(fixnum_value(parse_eval("hi", interp, engine)), fixnum_max);
+        EXPECT_EQ(pool.num_roots(), 1);
+    }
+    remove(path.c_str());
+}
+
+TEST(Image, Collect)
+{
+    auto path = image_path("rlisp-collect.img");
+    std::string src = "(define long '(";
+    for (int i = 0; i < 10000; ++i)
+        src += std::to_string(i) + ' ';
+    src += "))";
+    {
+        Interpreter interp;
+        ASSERT_NE(parse_eval(src.c_str(), interp), nullptr);
+        ASSERT_NE(parse_eval("(define nth (lambda (n l) (cond ((= n 0) (car l)) (t (nth (- n 1) (cdr l))))))",
+                             interp),
+                  nullptr);
+        ASSERT_NE(parse_eval("(define garbage (lambda (n) (cond ((= n 0) nil) (t (cons n (garbage (- n 1)))))))",
+                             interp),
+                  nullptr);
+        std::string error;
+        ASSERT_TRUE(save_image(path, interp.globals(), interp.pool(), error)) << error;
+    }
+
+    MemPoolConfig config;
+    config.initial_cells = 64;
+    config.generational = false;
+    Interpreter interp(config);
+    std::string error;
+    ASSERT_TRUE(load_image(path, interp.globals(), interp.pool(), error)) << error;
+    // the image's cells survive collections for as long as they are bound, and are freed once they are not
+    for (int i = 0; i < 20; ++i)
+        EXPECT_NE(parse_eval("(garbage 200)", interp), nullptr);
+    EXPECT_GT(interp.pool().num_major_collections(), 0);
+    EXPECT_EQ(fixnum_value(parse_eval("(nth 9999 long)", interp)), 9999);
+    EXPECT_NE(parse_eval("(define long nil)", interp), nullptr);
+    auto collections = interp.pool().num_major_collections();
+    while (interp.pool().num_major_collections() == collections)
+        ASSERT_NE(parse_eval("(garbage 200)", interp), nullptr);
+    EXPECT_LT(interp.pool().stats().last_survivors, 10000u);
+    remove(path.c_str());
+}
+
+TEST(Image, Invalid)
+{
+    Interpreter interp;
+    auto& pool = interp.pool();
+    std::string error;
+    EXPECT_FALSE(load_image(image_path("rlisp-missing.img"), interp.globals(), pool, error));
+    EXPECT_FALSE(error.empty());
+
+    auto path = image_path("rlisp-invalid.img");
+    ASSERT_TRUE(write_bytes(path, "(define x 1)\n"));
+    EXPECT_FALSE(load_image(path, interp.globals(), pool, error));
+
+    ASSERT_NE(parse_eval("(define xs '(a b c))", interp), nullptr);
+    ASSERT_TRUE(save_image(path, interp.globals(), pool, error)) << error;
+    auto image = read_bytes(path);
+    ASSERT_FALSE(image.empty());
+
+    // every truncation is caught
+    for (size_t size = 0; size < image.size(); size += 8)
+    {
+        ASSERT_TRUE(write_bytes(path, image.substr(0, size)));
+        EXPECT_FALSE(load_image(path, interp.globals(), pool, error)) << size;
+    }
+
+    // and so is a reference out of range: the last word is the value of xs, the cell at index 0
+    auto bad = image;
+    bad[bad.size() - 8] = static_cast<char>(0xF8);
+    ASSERT_TRUE(write_bytes(path, bad));
+    EXPECT_FALSE(load_image(path, interp.globals(), pool, error));
+    EXPECT_STRUCTURAL_EQ(parse_eval("xs", interp), parse("(a b c)", pool));
+
+    // and a block whose slot count runs past the cells, however large
+    {
+        Interpreter saved;
+        ASSERT_NE(parse_eval("(define v (make-vector 1 'a))", saved), nullptr);
+        ASSERT_TRUE(save_image(path, saved.globals(), saved.pool(), error)) << error;
+    }
+    image = read_bytes(path);
+    // the 48 byte header ends with the atom, name byte, cell and binding counts
+    uint64_t counts[4];
+    ASSERT_GE(image.size(), 48u);
+    memcpy(counts, image.data() + 16, sizeof(counts));
+    auto cells = 48 + counts[0] * 8 + counts[1];
+    ASSERT_EQ(counts[2], 2u);
+    // the vector's header is the cell whose cdr is its slot count
+    auto header = cells + 8;
+    uint64_t slots;
+    memcpy(&slots, image.data() + header, 8);
+    ASSERT_EQ(slots, 1u);
+    for (uint64_t bad_slots : {uint64_t(3), uint64_t(INT64_MAX), UINT64_MAX})
+    {
+        bad = image;
+        memcpy(bad.data() + header, &bad_slots, 8);
+        ASSERT_TRUE(write_bytes(path, bad));
+        EXPECT_FALSE(load_image(path, interp.globals(), pool, error)) << bad_slots;
+    }
+    ASSERT_TRUE(write_bytes(path, image));
+    EXPECT_TRUE(load_image(path, interp.globals(), pool, error)) << error;
+    EXPECT_EQ(parse_eval("(vector-length v)", interp), make_fixnum(1));
+
+    // a failed load leaves a pool that collects as usual
+    ASSERT_NE(parse_eval("(define garbage (lambda (n) (cond ((= n 0) nil) (t (cons n (garbage (- n 1)))))))", interp),
+              nullptr);
+    EXPECT_NE(parse_eval("(garbage 2000)", interp), nullptr);
+    EXPECT_EQ(pool.num_roots(), 1);
+    remove(path.c_str());
+}
@@ -0,0 +1,155 @@
+#include "cons.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "testutil.h"
+#include <gtest/gtest.h>
+
+using namespace rlisp;
+
+static Cons* parse_eval(const char* src, Interpreter& interp, Engine engine = Engine::TreeWalker)
+{
+    auto e = parse(src, interp.pool());
+    if (e != nullptr)
+        return interp.eval(e, engine);
+    else
+        return nullptr;
+}
+
+TEST(Interpreter, Define)
+{
+    Interpreter interp;
+    auto& pool = interp.pool();
+    EXPECT_EQ(parse_eval("x", interp), nullptr);
+    EXPECT_EQ(parse_eval("(define x '(a b))", interp), pool.intern_atom("x"));
+    EXPECT_STRUCTURAL_EQ(parse_eval("x", interp), parse("(a b)", pool));
+    EXPECT_STRUCTURAL_EQ(parse_eval("(cdr x)", interp, Engine::Bytecode), parse("(b)", pool));
+
+    // redefinition replaces the value seen by existing closures
+    EXPECT_NE(parse_eval("(define get-x (lambda () x))", interp), nullptr);
+    EXPECT_NE(parse_eval("(define x 'c)", interp), nullptr);
+    EXPECT_EQ(parse_eval("(get-x)", interp), pool.intern_atom("c"));
+
+    // define always binds globally, and locals still shadow globals
+    EXPECT_NE(parse_eval("(let ((y 'd)) (define z y))", interp), nullptr);
+    EXPECT_EQ(parse_eval("z", interp), pool.intern_atom("d"));
+    EXPECT_EQ(parse_eval("(let ((z 'e)) z)", interp), pool.intern_atom("e"));
+
+    EXPECT_EQ(parse_eval("(define t 'a)", interp), nullptr);
+    EXPECT_EQ(parse_eval("(define car cdr)", interp), nullptr);
+    EXPECT_EQ(parse_eval("(define lambda 'a)", interp), nullptr);
+    EXPECT_EQ(parse_eval("(car '(a b))", interp, Engine::TreeWalker), pool.intern_atom("a"));
+    EXPECT_EQ(parse_eval("(define (f) 'a)", interp), nullptr);
+    EXPECT_EQ(parse_eval("(define f)", interp), nullptr);
+    EXPECT_EQ(pool.num_roots(), 1);
+}
+
+TEST(Interpreter, Recursion)
+{
+    Interpreter interp;
+    for (auto engine : {Engine::TreeWalker, Engine::Bytecode})
+    {
+        EXPECT_NE(parse_eval(R"(
+        (define rev
+         (lambda (xs acc)
+          (cond
+           (xs (rev (cdr xs) (cons (car xs) acc)))
+           (t acc))))
+        )",
+                             interp,
+                             engine),
+                  nullptr);
+        auto expected = parse("(c b a)", interp.pool());
+        interp.pool().push_root(expected);
+        EXPECT_STRUCTURAL_EQ(parse_eval("(rev '(a b c) nil)", interp, engine), expected);
+        interp.pool().pop_root();
+    }
+}
+
+TEST(Interpreter, GlobalsSurviveCollection)
+{
+    MemPoolConfig config;
+    config.initial_cells = 32;
+    config.min_segment_cells = 32;
+    Interpreter interp(config);
+    auto& pool = interp.pool();
+
+    // enough definitions to regrow the values block a few times
+    const char* names[] = {"a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m",
+                           "n", "o", "p", "q", "r", "s", "u", "v", "w", "x", "y", "z"};
+    for (auto name : names)
+    {
+        auto src = std::string("(define ") + name + " '(" + name + " " + name + "))";
+        ASSERT_NE(parse_eval(src.c_str(), interp), nullptr);
+    }
+    for (int x = 0; x < 30; ++x)
+    {
+        EXPECT_NE(parse_eval("'(a a a a a a a a a a a a a a a a a a)", interp), nullptr);
+    }
+    for (auto name : names)
+    {
+        auto src = std::string("(") + name + " " + name + ")";
+        EXPECT_STRUCTURAL_EQ(parse_eval(name, interp), parse(src.c_str(), pool));
+    }
+    EXPECT_GE(interp.globals().size(), 25);
+    EXPECT_EQ(pool.num_roots(), 1);
+}
+
+TEST(Interpreter, ArithmeticDoesNotAllocate)
+{
+    MemPoolConfig config;
+    config.initial_cells = 64;
+    Interpreter interp(config);
+    auto e = parse("(cond ((< (* (+ 1 2) (- 10 4)) 20) (= 3 (+ 1 2))) (t nil))", interp.pool());
+    interp.pool().push_root(e);
+    for (auto engine : {Engine::TreeWalker, Engine::Bytecode})
+    {
+        for (int x = 0; x < 10000; ++x)
+            ASSERT_EQ(interp.eval(e, engine), interp.pool().symbols().t);
+    }
+    EXPECT_EQ(interp.pool().num_minor_collections(), 0);
+    EXPECT_EQ(interp.pool().num_major_collections(), 0);
+    interp.pool().pop_root();
+}
+
+TEST(Interpreter, CallCache)
+{
+    for (auto engine : {Engine::TreeWalker, Engine::Bytecode})
+    {
+        Interpreter interp;
+        auto& pool = interp.pool();
+        auto& stats = interp.globals().calls().stats();
+        ASSERT_NE(parse_eval("(define f (lambda (n) (cond ((= n 0) 'a) (t (f (- n 1))))))", interp, engine), nullptr);
+        EXPECT_EQ(parse_eval("(f 100)", interp, engine), pool.intern_atom("a"));
+        // the recursive call looked f up once
+        EXPECT_GE(stats.hits, 99u);
+        EXPECT_LT(stats.misses, 10u);
+
+        // rebinding a function, even from inside a call through it, is seen by the next call
+        ASSERT_NE(parse_eval(R"(
+        (define f
+         (lambda (n)
+          (cond
+           ((= n 0) 'a)
+           ((= n 50) (cond ((define f (lambda (n) 'b)) (f n))))
+           (t (f (- n 1))))))
+        )",
+                             interp,
+                             engine),
+                  nullptr);
+        EXPECT_EQ(parse_eval("(f 100)", interp, engine), pool.intern_atom("b"));
+        EXPECT_EQ(parse_eval("(f 100)", interp, engine), pool.intern_atom("b"));
+
+        // a closure made in another global scope keeps looking its names up there
+        GlobalEnv other(pool);
+        ASSERT_TRUE(define_builtins(other, pool));
+        auto h = parse_eval("(lambda () (f 0))", interp, engine);
+        ASSERT_NE(h, nullptr);
+        pool.push_root(h);
+        ASSERT_TRUE(other.define(pool.intern_atom("h"), h));
+        pool.pop_root();
+        EXPECT_EQ(eval(parse("(h)", pool), other, pool, engine), pool.intern_atom("b"));
+        ASSERT_NE(parse_eval("(define f (lambda (n) 'c))", interp, engine), nullptr);
+        EXPECT_EQ(eval(parse("(h)", pool), other, pool, engine), pool.intern_atom("c"));
+        EXPECT_EQ(pool.num_roots(), 2);
+    }
+}
@@ -0,0 +1,154 @@
+#include "cons.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "parser.h"
+#include "printer.h"
+#include "profiler.h"
+#include "testutil.h"
+#include <gtest/gtest.h>
+
+#include <string>
+
+using namespace rlisp;
+
+static Cons* parse_eval(const char* src, Interpreter& interp, Engine engine = Engine::Bytecode)
+{
+    auto e = parse(src, interp.pool());
+    if (e != nullptr)
+        return interp.eval(e, engine);
+    else
+        return nullptr;
+}
+
+static const char fib[] = "(define fib (lambda (n) (cond ((< n 2) n) (t (+ (fib (- n 1)) (fib (- n 2)))))))";
+
+TEST(Jit, CompilesHotClosures)
+{
+    Interpreter interp;
+    ASSERT_NE(parse_eval(fib, interp), nullptr);
+
+    Jit cold(1000);
+    interp.pool().set_jit(&cold);
+    EXPECT_EQ(fixnum_value(parse_eval("(fib 10)", interp)), 55);
+    // fib 10 makes 177 calls
+    EXPECT_EQ(cold.stats.compiled, 0u);
+
+    Jit jit;
+    interp.pool().set_jit(&jit);
+    EXPECT_EQ(fixnum_value(parse_eval("(fib 20)", interp)), 6765);
+#if defined(RLISP_JIT)
+    EXPECT_EQ(jit.stats.compiled, 1u);
+    // once fib is compiled, its calls to itself stay in machine code
+    EXPECT_GT(jit.stats.entries, 0u);
+    EXPECT_GT(jit.stats.native_calls, 20000u);
+#else
+    EXPECT_EQ(jit.stats.compiled, 0u);
+#endif
+    // the tree walker never compiles anything
+    auto compiled = jit.stats.compiled;
+    EXPECT_EQ(fixnum_value(parse_eval("(fib 15)", interp, Engine::TreeWalker)), 610);
+    EXPECT_EQ(jit.stats.compiled, compiled);
+    interp.pool().set_jit(nullptr);
+    EXPECT_EQ(interp.pool().num_roots(), 1);
+}
+
+TEST(Jit, Failures)
+{
+    Interpreter interp;
+    Jit jit(1);
+    interp.pool().set_jit(&jit);
+    ASSERT_NE(parse_eval("(define f (lambda (g x) (g x)))", interp), nullptr);
+    auto max = "(define max (lambda () " + std::to_string(fixnum_max) + "))";
+    ASSERT_NE(parse_eval(max.c_str(), interp), nullptr);
+
+    // each fails inside compiled code, and leaves the root stack as it was
+    const char* failing[] = {
+        "(f (lambda (x) (car x)) 'a)",
+        "(f (lambda (x) (cdr x)) 1)",
+        "(f (lambda (x) (car x)) (lambda (y) y))",
+        "(f (lambda (x) (+ x 'a)) 1)",
+        "(f (lambda (x) (< 'a x)) 1)",
+        "(f (lambda (x) (+ x 1)) (max))",
+        "(f (lambda (x) (- (- 0 x) 2)) (max))",
+        "(f (lambda (x) (* x x)) (max))",
+        "(f (lambda (x) (* x 4)) (max))",
+        "(f (lambda (x) unbound) 1)",
+        "(f (lambda (x) (unbound x)) 1)",
+        "(f (lambda (x) (x x)) 'a)",
+        "(f (lambda (x) (cond (x (car)))) 1)",
+        "(f (lambda (x) (cond ((eq x 1) 'a))) 2)",
+        "(f (lambda (x) (let ((y (car x))) y)) 'a)",
+        "(f (lambda (x) ((lambda (a b) a) x)) 1)",
+    };
+    for (auto src : failing)
+    {
+        EXPECT_EQ(parse_eval(src, interp), nullptr) << src;
+        EXPECT_EQ(interp.pool().num_roots(), 1) << src;
+    }
+    EXPECT_EQ(fixnum_value(parse_eval("(f (lambda (x) (* x -1)) (max))", interp)), -fixnum_max);
+    EXPECT_EQ(fixnum_value(parse_eval("(f (lambda (x) (- (- 0 x) 1)) (max))", interp)), fixnum_min);
+#if defined(RLISP_JIT)
+    EXPECT_GT(jit.stats.compiled, 10u);
+#endif
+    interp.pool().set_jit(nullptr);
+}
+
+TEST(Jit, Collection)
+{
+    // every operand the compiled code holds must survive the collections its allocations trigger
+    const char* program = R"(
+    (let
+     ((build (lambda (build n acc)
+              (cond
+               ((= n 0) acc)
+               (t (let ((pair (cons n (cons (* n n) nil))))
+                   (build build (- n 1) (cons pair acc)))))))
+      (sum (lambda (sum xs acc)
+            (cond
+             (xs (sum sum (cdr xs) (+ acc (+ (car (car xs)) (car (cdr (car xs)))))))
+             (t acc))))
+      (go (lambda (go k acc)
+           (cond
+            ((= k 0) acc)
+            (t (go go (- k 1) (+ acc (sum sum (build build 200 nil) 0))))))))
+     (go go 20 0))
+    )";
+    for (size_t incremental_step : {0, 16})
+    {
+        MemPoolConfig config;
+        config.initial_cells = 256;
+        config.incremental_step = incremental_step;
+        Interpreter interp(config);
+        Jit jit(1);
+        interp.pool().set_jit(&jit);
+        // the sum of n + n * n for n up to 200, twenty times
+        EXPECT_EQ(fixnum_value(parse_eval(program, interp)), 20 * (20100 + 2686700));
+        EXPECT_GT(interp.pool().stats().collections(), 0u);
+        interp.pool().set_jit(nullptr);
+        EXPECT_EQ(interp.pool().num_roots(), 1);
+    }
+}
+
+TEST(Jit, Profiler)
+{
+    // machine code makes its calls and returns through the VM's own, so a profile counts the same calls with or
+    // without it
+    for (size_t threshold : {0, 1})
+    {
+        Profiler profiler;
+        Interpreter interp;
+        interp.pool().set_profiler(&profiler);
+        Jit jit(threshold);
+        interp.pool().set_jit(&jit);
+        ASSERT_NE(parse_eval(fib, interp), nullptr);
+        EXPECT_EQ(fixnum_value(parse_eval("(fib 10)", interp)), 55);
+        size_t calls = 0;
+        for (auto&& function : profiler.functions())
+        {
+            if (function.name == "fib") calls = function.calls;
+        }
+        EXPECT_EQ(calls, 177u);
+        interp.pool().set_jit(nullptr);
+        interp.pool().set_profiler(nullptr);
+    }
+}
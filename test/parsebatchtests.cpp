@@ -0,0 +1,170 @@
+#include "cons.h"
+#include "mempool.h"
+#include "parsebatch.h"
+#include "parser.h"
+#include "symtab.h"
+#include "testutil.h"
+#include "vcpkgparser.h"
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace rlisp;
+
+// the forms of src parsed one at a time, for comparison
+static std::vector<Cons*> parse_sequential(const std::string& src, MemPool& pool, std::string& error)
+{
+    std::vector<Cons*> forms;
+    vcpkg::Parse::ParserBase parser(src, "origin");
+    while (parse_more(parser))
+    {
+        auto e = parse(parser, pool);
+        if (auto err = parser.get_error())
+        {
+            error = err->format();
+            break;
+        }
+        pool.push_root(e);
+        forms.push_back(e);
+    }
+    return forms;
+}
+
+// small pools, so that every worker collects while its earlier forms are live
+static const MemPoolConfig small_pools{.initial_cells = 64};
+
+TEST(ParseBatch, Sources)
+{
+    SymbolTable atoms;
+    std::vector<std::string> texts;
+    for (int i = 0; i < 16; ++i)
+    {
+        std::string text;
+        for (int j = 0; j < 100; ++j)
+            text += "(define f" + std::to_string(j) + " (lambda (x) (cons x '(a" + std::to_string(i) + " . 12))))\n";
+        texts.push_back(text);
+    }
+    texts[5] += "(a b";
+    std::vector<ParseSource> sources;
+    for (auto&& text : texts)
+        sources.push_back({"origin", text});
+
+    auto batch = parse_batch(sources, atoms, 4, small_pools);
+    EXPECT_EQ(batch.pools.size(), 4);
+    EXPECT_FALSE(batch.ok());
+    ASSERT_EQ(batch.sources.size(), texts.size());
+
+    MemPool pool(MemPoolConfig(), atoms);
+    for (size_t i = 0; i < texts.size(); ++i)
+    {
+        std::string error;
+        auto expected = parse_sequential(texts[i], pool, error);
+        EXPECT_EQ(batch.sources[i].error, error);
+        ASSERT_EQ(batch.sources[i].forms.size(), expected.size());
+        for (size_t j = 0; j < expected.size(); ++j)
+            ASSERT_STRUCTURAL_EQ(batch.sources[i].forms[j], expected[j]);
+    }
+    EXPECT_NE(batch.sources[5].error.find("unexpected eof"), std::string::npos);
+    // atoms are shared by every pool
+    EXPECT_EQ(batch.sources[0].forms[0]->car, pool.symbols().define);
+    EXPECT_EQ(batch.sources[15].forms[99]->car, pool.symbols().define);
+}
+
+TEST(ParseBatch, Forms)
+{
+    SymbolTable atoms;
+    // atoms may contain '(' and quotes, which must not confuse the split between forms
+    std::string text;
+    for (int i = 0; i < 5000; ++i)
+        text += "(a(b 'c (d . -" + std::to_string(i) + ") e'f ((g)) ())\n x" + std::to_string(i) + " \t'y\r\n";
+
+    auto batch = parse_forms({"origin", text}, atoms, 4, small_pools);
+    ASSERT_TRUE(batch.ok());
+    EXPECT_EQ(batch.pools.size(), 4);
+    ASSERT_EQ(batch.sources.size(), 1);
+
+    MemPool pool(MemPoolConfig(), atoms);
+    std::string error;
+    auto expected = parse_sequential(text, pool, error);
+    ASSERT_EQ(batch.sources[0].forms.size(), expected.size());
+    for (size_t j = 0; j < expected.size(); ++j)
+        ASSERT_STRUCTURAL_EQ(batch.sources[0].forms[j], expected[j]);
+}
+
+TEST(ParseBatch, FormsWithVectors)
+{
+    SymbolTable atoms;
+    // "#(" opens a vector, which the split must count like a list, while "#a(" is an atom
+    std::string text;
+    for (int i = 0; i < 5000; ++i)
+        text += "(x #(a (b) #(c " + std::to_string(i) + ")) y) #() #a( '#(z)\n";
+
+    auto batch = parse_forms({"origin", text}, atoms, 4, small_pools);
+    ASSERT_TRUE(batch.ok());
+    // a piece cut inside a form would fail, and the reparse of the whole buffer would add a pool
+    EXPECT_EQ(batch.pools.size(), 4);
+    ASSERT_EQ(batch.sources.size(), 1);
+
+    MemPool pool(MemPoolConfig(), atoms);
+    std::string error;
+    auto expected = parse_sequential(text, pool, error);
+    ASSERT_EQ(batch.sources[0].forms.size(), expected.size());
+    ASSERT_EQ(expected.size(), 5000u * 4);
+    for (size_t j = 0; j < expected.size(); ++j)
+        ASSERT_STRUCTURAL_EQ(batch.sources[0].forms[j], expected[j]);
+}
+
+TEST(ParseBatch, FormsError)
+{
+    SymbolTable atoms;
+    std::string text;
+    for (int i = 0; i < 5000; ++i)
+        text += "(a (b c) d)\n";
+    text += "(a . b c)\n";
+    for (int i = 0; i < 5000; ++i)
+        text += "(a (b c) d)\n";
+
+    auto batch = parse_forms({"origin", text}, atoms, 4);
+    ASSERT_FALSE(batch.ok());
+    ASSERT_EQ(batch.sources.size(), 1);
+
+    // the position is relative to the whole buffer, not to the piece that failed
+    MemPool pool(MemPoolConfig(), atoms);
+    std::string error;
+    auto expected = parse_sequential(text, pool, error);
+    EXPECT_EQ(batch.sources[0].error, error);
+    EXPECT_EQ(batch.sources[0].forms.size(), expected.size());
+}
+
+TEST(ParseBatch, ConcurrentIntern)
+{
+    SymbolTable atoms;
+    constexpr int names = 19997;
+    std::vector<std::vector<Cons*>> results(4);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&, t] {
+            auto& out = results[t];
+            out.resize(names);
+            // each thread walks the names in a different order, so that inserts race with lookups and rehashes; names
+            // is prime, so every order is a permutation
+            for (int i = 0; i < names; ++i)
+            {
+                auto k = (i * (2 * t + 1) + t * 977) % names;
+                out[k] = atoms.intern("name-" + std::to_string(k));
+            }
+        });
+    }
+    for (auto&& t : threads)
+        t.join();
+
+    EXPECT_EQ(atoms.size(), names);
+    for (int i = 0; i < names; ++i)
+    {
+        auto name = "name-" + std::to_string(i);
+        ASSERT_TRUE(results[0][i]->is_atom(name.c_str()));
+        for (int t = 1; t < 4; ++t)
+            ASSERT_EQ(results[t][i], results[0][i]);
+    }
+}
@@ -124,6 +124,181 @@ TEST(Parser, SucceedOnNil)
     EXPECT_EQ(mempool.num_roots(), 0);
 }
 
+TEST(Parser, SucceedOnFixnums)
+{
+    rlisp::MemPool mempool;
+    auto value = rlisp::parse("(0 42 -7 +3 - + 1a -b)", mempool);
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(value->car, make_fixnum(0));
+    EXPECT_EQ(value->cdr->car, make_fixnum(42));
+    EXPECT_EQ(value->cdr->cdr->car, make_fixnum(-7));
+    EXPECT_EQ(value->cdr->cdr->cdr->car, make_fixnum(3));
+    auto rest = value->cdr->cdr->cdr->cdr;
+    EXPECT_EQ(rest->car, mempool.intern_atom("-"));
+    EXPECT_EQ(rest->cdr->car, mempool.intern_atom("+"));
+    EXPECT_EQ(rest->cdr->cdr->car, mempool.intern_atom("1a"));
+    EXPECT_EQ(rest->cdr->cdr->cdr->car, mempool.intern_atom("-b"));
+
+    EXPECT_EQ(fixnum_value(rlisp::parse(std::to_string(fixnum_max).c_str(), mempool)), fixnum_max);
+    EXPECT_EQ(fixnum_value(rlisp::parse(std::to_string(fixnum_min).c_str(), mempool)), fixnum_min);
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+TEST(Parser, FailOnFixnumOverflow)
+{
+    rlisp::MemPool mempool;
+    {
+        auto text = std::to_string(fixnum_max + 1);
+        vcpkg::Parse::ParserBase parser(text, "origin");
+        rlisp::parse(parser, mempool);
+        ASSERT_NE(parser.get_error(), nullptr);
+    }
+    {
+        vcpkg::Parse::ParserBase parser("(1 -99999999999999999999)", "origin");
+        rlisp::parse(parser, mempool);
+        ASSERT_NE(parser.get_error(), nullptr);
+    }
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Parser, ParseMore)
+{
+    rlisp::MemPool mempool;
+    vcpkg::Parse::ParserBase parser(" a (b c)\n 'd \n", "origin");
+    ASSERT_TRUE(rlisp::parse_more(parser));
+    EXPECT_EQ(rlisp::parse(parser, mempool), mempool.intern_atom("a"));
+    ASSERT_TRUE(rlisp::parse_more(parser));
+    EXPECT_STRUCTURAL_EQ(rlisp::parse(parser, mempool), rlisp::parse("(b c)", mempool));
+    ASSERT_TRUE(rlisp::parse_more(parser));
+    EXPECT_NE(rlisp::parse(parser, mempool), nullptr);
+    EXPECT_FALSE(rlisp::parse_more(parser));
+    EXPECT_EQ(parser.get_error(), nullptr);
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Parser, LongList)
+{
+    // a small heap collects many times while the list is built, promoting its front half
+    rlisp::MemPool mempool(64);
+    constexpr int n = 1 << 20;
+    std::string text = "(";
+    for (int i = 0; i < n; ++i)
+    {
+        text += std::to_string(i);
+        text += ' ';
+    }
+    text += ". end)";
+    auto value = rlisp::parse(text.c_str(), mempool);
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(mempool.num_roots(), 0);
+    mempool.push_root(value);
+    // churn the heap so that any cell the collector missed gets reused
+    for (int i = 0; i < n; ++i)
+        mempool.alloc(mempool.nil(), mempool.nil());
+    auto c = value;
+    for (int i = 0; i < n; ++i, c = c->cdr)
+    {
+        ASSERT_TRUE(c->is_cons());
+        ASSERT_EQ(fixnum_value(c->car), i);
+    }
+    EXPECT_EQ(c, mempool.intern_atom("end"));
+    mempool.pop_root();
+}
+
+TEST(Parser, Vectors)
+{
+    rlisp::MemPool mempool;
+    auto value = rlisp::parse("#(a 1 (b) #())", mempool);
+    ASSERT_NE(value, nullptr);
+    ASSERT_TRUE(value->is_vector());
+    ASSERT_EQ(value->block_size, 4u);
+    EXPECT_EQ(value->slot(0), mempool.intern_atom("a"));
+    EXPECT_EQ(fixnum_value(value->slot(1)), 1);
+    EXPECT_STRUCTURAL_EQ(value->slot(2), rlisp::parse("(b)", mempool));
+    ASSERT_TRUE(value->slot(3)->is_vector());
+    EXPECT_EQ(value->slot(3)->block_size, 0u);
+
+    // a # that does not open a vector starts an atom
+    EXPECT_EQ(rlisp::parse("#a", mempool), mempool.intern_atom("#a"));
+    auto list = rlisp::parse("(# #b)", mempool);
+    ASSERT_NE(list, nullptr);
+    EXPECT_EQ(list->car, mempool.intern_atom("#"));
+    EXPECT_EQ(list->cdr->car, mempool.intern_atom("#b"));
+
+    for (auto text : {"#(a . b)", "#(a", "#("})
+    {
+        vcpkg::Parse::ParserBase parser(text, "origin");
+        EXPECT_EQ(rlisp::parse(parser, mempool), nullptr) << text;
+        EXPECT_NE(parser.get_error(), nullptr) << text;
+    }
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Parser, LongVector)
+{
+    // the elements are collected into a list, which must stay alive until the vector holds them
+    rlisp::MemPool mempool(64);
+    constexpr int n = 1 << 16;
+    std::string text = "#(";
+    for (int i = 0; i < n; ++i)
+        text += "(" + std::to_string(i) + ") ";
+    text += ")";
+    auto value = rlisp::parse(text.c_str(), mempool);
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(mempool.num_roots(), 0);
+    mempool.push_root(value);
+    for (int i = 0; i < n; ++i)
+        mempool.alloc(mempool.nil(), mempool.nil());
+    ASSERT_TRUE(value->is_vector());
+    ASSERT_EQ(value->block_size, static_cast<size_t>(n));
+    for (int i = 0; i < n; ++i)
+    {
+        ASSERT_TRUE(value->slot(i)->is_cons());
+        ASSERT_EQ(fixnum_value(value->slot(i)->car), i);
+    }
+    mempool.pop_root();
+}
+
+TEST(Parser, DeepNesting)
+{
+    rlisp::MemPool mempool;
+    constexpr size_t depth = max_parse_depth;
+    auto text = std::string(depth / 2, '(') + std::string(depth / 2, '\'') + "a" + std::string(depth / 2, ')');
+    auto value = rlisp::parse(text.c_str(), mempool);
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(mempool.num_roots(), 0);
+    for (size_t i = 0; i < depth / 2; ++i)
+    {
+        ASSERT_TRUE(value->is_cons());
+        ASSERT_EQ(value->cdr, mempool.nil());
+        value = value->car;
+    }
+    for (size_t i = 0; i < depth / 2; ++i)
+    {
+        ASSERT_TRUE(value->is_cons());
+        ASSERT_EQ(value->car, mempool.symbols().quote);
+        value = value->cdr->car;
+    }
+    EXPECT_EQ(value, mempool.intern_atom("a"));
+}
+
+TEST(Parser, FailOnTooDeep)
+{
+    rlisp::MemPool mempool;
+    {
+        auto text = std::string(max_parse_depth + 1, '(');
+        vcpkg::Parse::ParserBase parser(text, "origin");
+        EXPECT_EQ(rlisp::parse(parser, mempool), nullptr);
+        ASSERT_NE(parser.get_error(), nullptr);
+    }
+    {
+        auto text = std::string(max_parse_depth + 1, '\'') + "a";
+        vcpkg::Parse::ParserBase parser(text, "origin");
+        EXPECT_EQ(rlisp::parse(parser, mempool), nullptr);
+        ASSERT_NE(parser.get_error(), nullptr);
+    }
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
 int main(int argc, char** argv)
 {
     testing::InitGoogleTest(&argc, argv);
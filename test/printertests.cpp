@@ -0,0 +1,48 @@
+#include "cons.h"
+#include "interpreter.h"
+#include "mempool.h"
+#include "parser.h"
+#include "printer.h"
+#include <gtest/gtest.h>
+
+using namespace rlisp;
+
+static std::string parse_print(const char* src, MemPool& pool)
+{
+    auto e = parse(src, pool);
+    if (e == nullptr) return "<parse failed>";
+    return to_string(e, pool);
+}
+
+TEST(Printer, Values)
+{
+    rlisp::MemPool mempool;
+    EXPECT_EQ(parse_print("a", mempool), "a");
+    EXPECT_EQ(parse_print("()", mempool), "nil");
+    EXPECT_EQ(parse_print("-12", mempool), "-12");
+    EXPECT_EQ(parse_print("(a (b c) . d)", mempool), "(a (b c) . d)");
+    EXPECT_EQ(parse_print("'(1 2)", mempool), "(quote (1 2))");
+    EXPECT_EQ(parse_print("#( 1 (a)  #() )", mempool), "#(1 (a) #())");
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Printer, Objects)
+{
+    Interpreter interp;
+    auto& pool = interp.pool();
+    EXPECT_EQ(to_string(interp.eval(parse("(lambda (x) x)", pool)), pool), "#<closure>");
+    EXPECT_EQ(to_string(interp.eval(parse("(cons car 1)", pool)), pool), "(#<builtin> . 1)");
+    EXPECT_EQ(pool.num_roots(), 1);
+}
+
+TEST(Printer, VectorCycles)
+{
+    Interpreter interp;
+    auto& pool = interp.pool();
+    auto print_eval = [&](const char* src) { return to_string(interp.eval(parse(src, pool)), pool); };
+    EXPECT_EQ(print_eval("(let ((v (make-vector 2 1))) (vector-set! v 0 v))"), "#(#<cycle> 1)");
+    EXPECT_EQ(print_eval("(let ((v (make-vector 1))) (vector-set! v 0 (cons 1 v)))"), "(1 . #((1 . #<cycle>)))");
+    // a vector that is only shared prints in full each time
+    EXPECT_EQ(print_eval("(let ((w #(a))) (cons w (make-vector 2 w)))"), "(#(a) . #(#(a) #(a)))");
+    EXPECT_EQ(pool.num_roots(), 1);
+}
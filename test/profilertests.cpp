@@ -0,0 +1,140 @@
+#include "cons.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "profiler.h"
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+using namespace rlisp;
+
+static Cons* parse_eval(const char* src, Interpreter& interp, Engine engine)
+{
+    auto e = parse(src, interp.pool());
+    if (e != nullptr)
+        return interp.eval(e, engine);
+    else
+        return nullptr;
+}
+
+static size_t calls(const Profiler& profiler, const char* name)
+{
+    for (auto&& f : profiler.functions())
+    {
+        if (f.name == name) return f.calls;
+    }
+    return 0;
+}
+
+TEST(Profiler, Calls)
+{
+    for (auto engine : {Engine::TreeWalker, Engine::Bytecode})
+    {
+        Profiler profiler;
+        Interpreter interp;
+        interp.pool().set_profiler(&profiler);
+        EXPECT_NE(parse_eval("(define fib (lambda (n) (cond ((< n 2) n) (t (+ (fib (- n 1)) (fib (- n 2)))))))",
+                             interp,
+                             engine),
+                  nullptr);
+        auto value = parse_eval("(fib 10)", interp, engine);
+        ASSERT_TRUE(is_fixnum(value));
+        EXPECT_EQ(fixnum_value(value), 55);
+
+        EXPECT_EQ(calls(profiler, "fib"), 177);
+        EXPECT_EQ(calls(profiler, "define"), 1);
+        // the bytecode engine runs arithmetic as instructions
+        EXPECT_EQ(calls(profiler, "<"), engine == Engine::TreeWalker ? 177 : 0);
+        EXPECT_EQ(profiler.depth(), 0);
+
+        // recursion counts once towards inclusive figures
+        auto functions = profiler.functions();
+        for (auto&& f : functions)
+        {
+            EXPECT_LE(f.exclusive, f.inclusive) << f.name;
+            EXPECT_LE(f.exclusive_cells, f.inclusive_cells) << f.name;
+        }
+
+        // an anonymous closure is named after its arguments
+        EXPECT_NE(parse_eval("((lambda (a b) a) 1 2)", interp, engine), nullptr);
+        EXPECT_EQ(calls(profiler, "(lambda (a b))"), 1);
+    }
+}
+
+TEST(Profiler, TailCalls)
+{
+    for (auto engine : {Engine::TreeWalker, Engine::Bytecode})
+    {
+        Profiler profiler;
+        Interpreter interp;
+        interp.pool().set_profiler(&profiler);
+        EXPECT_NE(parse_eval("(define count (lambda (n) (cond ((= n 0) 0) (t (count (- n 1))))))", interp, engine),
+                  nullptr);
+        EXPECT_NE(parse_eval("(count 1000)", interp, engine), nullptr);
+        EXPECT_EQ(calls(profiler, "count"), 1001);
+        // each call replaces the one before it
+        auto stacks = profiler.collapsed_stacks();
+        EXPECT_EQ(stacks.find("count;count"), std::string::npos) << stacks;
+        EXPECT_EQ(profiler.depth(), 0);
+    }
+}
+
+TEST(Profiler, Failure)
+{
+    for (auto engine : {Engine::TreeWalker, Engine::Bytecode})
+    {
+        Profiler profiler;
+        Interpreter interp;
+        interp.pool().set_profiler(&profiler);
+        EXPECT_NE(parse_eval("(define bad (lambda (x) (car x)))", interp, engine), nullptr);
+        EXPECT_NE(parse_eval("(define outer (lambda (x) (cons (bad x) nil)))", interp, engine), nullptr);
+        EXPECT_EQ(parse_eval("(outer 1)", interp, engine), nullptr);
+        EXPECT_EQ(calls(profiler, "bad"), 1);
+        EXPECT_EQ(profiler.depth(), 0);
+    }
+}
+
+TEST(Profiler, CollapsedStacks)
+{
+    const char* program[] = {
+        "(define pair (lambda (x) (cons x x)))",
+        "(define twice (lambda (x) (cons (pair x) nil)))",
+        "(twice 1)",
+    };
+    for (auto engine : {Engine::TreeWalker, Engine::Bytecode})
+    {
+        Profiler profiler;
+        Interpreter interp;
+        interp.pool().set_profiler(&profiler);
+        for (auto src : program)
+            EXPECT_NE(parse_eval(src, interp, engine), nullptr) << src;
+
+        // A closure's frame is charged to its caller: pair's is two cells. The tree walker calls pair while
+        // evaluating the arguments of the builtin cons.
+        auto stacks = profiler.collapsed_stacks(ProfileMetric::Cells);
+        if (engine == Engine::TreeWalker)
+        {
+            EXPECT_NE(stacks.find("\ntwice;cons 3\n"), std::string::npos) << stacks;
+            EXPECT_NE(stacks.find("\ntwice;cons;pair;cons 1\n"), std::string::npos) << stacks;
+        }
+        else
+        {
+            // and the bytecode engine pins the body of each closure it compiles with another cell
+            EXPECT_NE(stacks.find("\ntwice 4\n"), std::string::npos) << stacks;
+            EXPECT_NE(stacks.find("\ntwice;pair 2\n"), std::string::npos) << stacks;
+        }
+
+        // every line is a stack and a positive weight
+        std::istringstream lines(profiler.collapsed_stacks(ProfileMetric::Time));
+        std::string line;
+        size_t count = 0;
+        while (std::getline(lines, line))
+        {
+            ++count;
+            auto space = line.rfind(' ');
+            ASSERT_NE(space, std::string::npos) << line;
+            EXPECT_GT(std::stoull(line.substr(space + 1)), 0u) << line;
+        }
+        EXPECT_GT(count, 0u);
+    }
+}
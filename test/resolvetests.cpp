@@ -0,0 +1,90 @@
+#include "cons.h"
+#include "mempool.h"
+#include "parser.h"
+#include "resolve.h"
+#include "testutil.h"
+#include <gtest/gtest.h>
+
+using namespace rlisp;
+
+static void expect_local_ref(Cons* c, size_t depth, size_t index)
+{
+    ASSERT_TRUE(is_immediate(c, Immediate::LocalRef));
+    EXPECT_EQ(local_ref(c).depth, depth);
+    EXPECT_EQ(local_ref(c).index, index);
+}
+
+TEST(Resolve, LeavesFreeReferences)
+{
+    rlisp::MemPool mempool;
+    auto e = parse("(cons a '(b c))", mempool);
+    EXPECT_EQ(resolve(e, mempool), e);
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Resolve, Lambda)
+{
+    rlisp::MemPool mempool;
+    auto e = resolve(parse("(lambda (x y) (cons y z))", mempool), mempool);
+    ASSERT_NE(e, nullptr);
+    auto body = e->cdr->cdr->car;
+    EXPECT_EQ(body->car, mempool.symbols().cons);
+    expect_local_ref(body->cdr->car, 0, 1);
+    EXPECT_EQ(body->cdr->cdr->car, mempool.intern_atom("z"));
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Resolve, NestedLet)
+{
+    rlisp::MemPool mempool;
+    auto e = resolve(parse("(let ((a 'x) (b a)) (lambda (c) (cons b 'a)))", mempool), mempool);
+    ASSERT_NE(e, nullptr);
+    auto bindings = e->cdr->car;
+    EXPECT_STRUCTURAL_EQ(bindings->car, parse("(a 'x)", mempool));
+    expect_local_ref(bindings->cdr->car->cdr->car, 0, 0);
+
+    auto body = e->cdr->cdr->car->cdr->cdr->car;
+    expect_local_ref(body->cdr->car, 1, 1);
+    EXPECT_STRUCTURAL_EQ(body->cdr->cdr->car, parse("'a", mempool));
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+TEST(Resolve, DefineName)
+{
+    rlisp::MemPool mempool;
+    auto e = resolve(parse("(lambda (x) (define x x))", mempool), mempool);
+    ASSERT_NE(e, nullptr);
+    auto body = e->cdr->cdr->car;
+    EXPECT_EQ(body->cdr->car, mempool.intern_atom("x"));
+    expect_local_ref(body->cdr->cdr->car, 0, 0);
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
+
+// (lambda (x) (lambda (y) ... x)), with x bound depth frames out
+static std::string nested_lambdas(size_t depth)
+{
+    std::string src = "(lambda (x) ";
+    for (size_t i = 0; i < depth; ++i)
+        src += "(lambda (y) ";
+    src += "x";
+    src += std::string(depth + 1, ')');
+    return src;
+}
+
+TEST(Resolve, LocalRefRange)
+{
+    // compact cells leave few bits for the depth, so test at the limit there
+    if (max_local_depth > 100000) GTEST_SKIP() << "the depth limit is too deep to test";
+    rlisp::MemPool mempool;
+    auto src = nested_lambdas(max_local_depth);
+    auto e = resolve(parse(src.c_str(), mempool), mempool);
+    ASSERT_NE(e, nullptr);
+    for (size_t i = 0; i <= max_local_depth; ++i)
+        e = e->cdr->cdr->car;
+    expect_local_ref(e, max_local_depth, 0);
+
+    // one frame further out cannot be referred to, and is not mistaken for a global
+    src = nested_lambdas(max_local_depth + 1);
+    EXPECT_EQ(resolve(parse(src.c_str(), mempool), mempool), nullptr);
+    EXPECT_EQ(mempool.num_roots(), 0);
+}
@@ -5,11 +5,21 @@
 
 static bool expect_structural_eq(rlisp::Cons* c1, rlisp::Cons* c2, const char* file, unsigned long lineno)
 {
-    if (c1->is_atom() && c2->is_atom())
+    if (rlisp::is_fixnum(c1) && rlisp::is_fixnum(c2))
+    {
+        EXPECT_EQ(rlisp::fixnum_value(c1), rlisp::fixnum_value(c2)) << "at " << file << ":" << lineno;
+        return c1 == c2;
+    }
+    else if (rlisp::is_immediate(c1) || rlisp::is_immediate(c2))
+    {
+        ADD_FAILURE_AT(file, lineno) << "expected eq " << c1 << " == " << c2;
+        return false;
+    }
+    else if (c1->is_atom() && c2->is_atom())
     {
         if (c1->atom != c2->atom)
         {
-            ADD_FAILURE_AT(file, lineno) << "expected " << c1->atom << " == " << c2->atom;
+            ADD_FAILURE_AT(file, lineno) << "expected " << c1->atom->view() << " == " << c2->atom->view();
         }
         return c1->cdr == c2->cdr;
     }
@@ -18,6 +28,20 @@ static bool expect_structural_eq(rlisp::Cons* c1, rlisp::Cons* c2, const char* f
         return expect_structural_eq(c1->car, c2->car, file, lineno) &&
                expect_structural_eq(c1->cdr, c2->cdr, file, lineno);
     }
+    else if (c1->is_vector() && c2->is_vector())
+    {
+        if (c1->block_size != c2->block_size)
+        {
+            ADD_FAILURE_AT(file, lineno) << "expected vectors of " << c1->block_size << " == " << c2->block_size
+                                         << " elements";
+            return false;
+        }
+        for (size_t i = 0; i < c1->block_size; ++i)
+        {
+            if (!expect_structural_eq(c1->slot(i), c2->slot(i), file, lineno)) return false;
+        }
+        return true;
+    }
     else
     {
         ADD_FAILURE_AT(file, lineno) << "expected eq " << c1->car << " == " << c2->car;